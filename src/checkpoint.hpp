@@ -0,0 +1,225 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_CHECKPOINT
+#define NEARNESS_CHECKPOINT
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <stdint.h>
+#include <assert.h>
+
+#include "results.hpp"
+
+namespace nearness {
+
+/**
+ * A record in a checkpoint, followed by length float values.
+ */
+struct CheckpointRecord {
+    uint32_t i;
+    uint32_t length;
+};
+
+/**
+ * Appends every completed row to a checkpoint file beside the output, so a
+ * run that is killed can be resumed without recomputing those rows. A
+ * manifest holding the parameters and the hash of every object is written
+ * first, a checkpoint is only resumed when the manifest of the new run is
+ * the same.
+ *
+ * Each row is flushed as it is appended. A row cut short when the run was
+ * killed is dropped on resume.
+ */
+class Checkpoint : public ResultSink {
+public:
+
+    /**
+     * @param output   [The name of the output file, the checkpoint is kept
+     *                 beside it]
+     * @param manifest [The parameters and object hashes of the run]
+     * @param n        [The number of rows]
+     * @param resume   [Whether to resume an existing checkpoint]
+     * @param results  [The sink to pass rows on to, not owned]
+     */
+    Checkpoint(
+        const std::string &output,
+        const std::string &manifest,
+        const unsigned int n,
+        const bool resume,
+        ResultSink *results) :
+        path(output + ".checkpoint"),
+        manifest_path(output + ".manifest"),
+        offsets(n, -1),
+        completed_rows(0),
+        file(NULL),
+        restore_file(NULL),
+        results(results) {
+
+        if (resume) {
+            load(manifest);
+        }
+
+        if (completed_rows == 0) {
+            std::ofstream out(manifest_path.c_str(), std::ios::trunc);
+            out << manifest;
+            file = std::fopen(path.c_str(), "wb");
+        }
+        else {
+            file = std::fopen(path.c_str(), "ab");
+            restore_file = std::fopen(path.c_str(), "rb");
+        }
+
+        if (file == NULL) {
+            std::cerr << "warning: could not write checkpoint '" << path << "'" << std::endl;
+        }
+    }
+
+    ~Checkpoint() {
+        if (file != NULL) std::fclose(file);
+        if (restore_file != NULL) std::fclose(restore_file);
+    }
+
+    void add_row(const unsigned int i, const Result &row) {
+        results->add_row(i, row);
+
+        if (file == NULL) return;
+        CheckpointRecord record;
+        record.i = i;
+        record.length = row.size();
+
+        boost::mutex::scoped_lock lock(file_mutex);
+        std::fwrite(&record, sizeof record, 1, file);
+        if (!row.empty()) {
+            std::fwrite(&row.front(), sizeof(float), row.size(), file);
+        }
+        std::fflush(file);
+    }
+
+    /**
+     * Whether row i was completed before the run was resumed.
+     */
+    bool completed(const unsigned int i) const {
+        return offsets[i] >= 0;
+    }
+
+    /**
+     * The number of rows completed before the run was resumed.
+     */
+    unsigned int num_completed() const {
+        return completed_rows;
+    }
+
+    /**
+     * Pass a row completed before the run was resumed on to the sink. Must
+     * only be called from one thread.
+     * @param i [The row, must be completed]
+     */
+    void restore(const unsigned int i) {
+        assert(completed(i));
+
+        Result row(offsets.size() - i - 1);
+        std::fseek(restore_file, offsets[i], SEEK_SET);
+        if (!row.empty() && std::fread(&row.front(), sizeof(float), row.size(), restore_file) != row.size()) {
+            std::cerr << "error: could not read row " << i << " from checkpoint '" << path << "'" << std::endl;
+            assert(false);
+        }
+        results->add_row(i, row);
+    }
+
+    /**
+     * The sink rows are passed on to.
+     */
+    ResultSink *sink() const {
+        return results;
+    }
+
+    /**
+     * Remove the checkpoint, once the output is complete.
+     */
+    void remove() {
+        if (file != NULL) std::fclose(file);
+        if (restore_file != NULL) std::fclose(restore_file);
+        file = NULL;
+        restore_file = NULL;
+
+        boost::system::error_code error;
+        boost::filesystem::remove(path, error);
+        boost::filesystem::remove(manifest_path, error);
+    }
+
+private:
+
+    /**
+     * Find the rows in an existing checkpoint with the same manifest,
+     * dropping any row cut short.
+     */
+    void load(const std::string &manifest) {
+        std::ifstream manifest_in(manifest_path.c_str());
+        std::stringstream existing;
+        existing << manifest_in.rdbuf();
+        if (!manifest_in || existing.str() != manifest) {
+            if (manifest_in) {
+                std::cerr << "warning: checkpoint '" << path << "' is from a different run, starting again" << std::endl;
+            }
+            return;
+        }
+
+        FILE *in = std::fopen(path.c_str(), "rb");
+        if (in == NULL) return;
+
+        long size = boost::filesystem::file_size(path);
+        long good = 0;
+        CheckpointRecord record;
+        while (std::fread(&record, sizeof record, 1, in) == 1) {
+            if (record.i >= offsets.size() || record.length != offsets.size() - record.i - 1) break;
+            long offset = good + sizeof record;
+            long end = offset + (long)record.length * sizeof(float);
+            if (end > size || std::fseek(in, end, SEEK_SET) != 0) break;
+
+            if (offsets[record.i] < 0) ++completed_rows;
+            offsets[record.i] = offset;
+            good = end;
+        }
+        std::fclose(in);
+
+        boost::filesystem::resize_file(path, good);
+    }
+
+    std::string path;
+    std::string manifest_path;
+
+    // the offset of the values of each completed row, -1 if not completed
+    std::vector<long> offsets;
+    unsigned int completed_rows;
+
+    FILE *file;
+    FILE *restore_file;
+    boost::mutex file_mutex;
+
+    ResultSink *results;
+};
+
+} // namespace nearness
+
+#endif
@@ -0,0 +1,324 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_CLUSTER
+#define NEARNESS_CLUSTER
+
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+
+#include "results.hpp"
+
+namespace nearness {
+
+/**
+ * How objects are clustered from the pairs near enough to join them.
+ * components     - each object is labelled with its connected component
+ * single-linkage - the dendrogram of merging the nearest clusters first
+ */
+enum ClusterMethod {
+    CLUSTER_NONE,
+    CLUSTER_COMPONENTS,
+    CLUSTER_SINGLE_LINKAGE
+};
+
+/**
+ * Parse the name of a cluster method.
+ * @param  name   [Either 'components' or 'single-linkage']
+ * @param  method [The method to write to]
+ * @return        [False if the name is not a method]
+ */
+inline bool parse_cluster_method(const std::string &name, ClusterMethod &method) {
+    if (name == "components") {
+        method = CLUSTER_COMPONENTS;
+    }
+    else if (name == "single-linkage") {
+        method = CLUSTER_SINGLE_LINKAGE;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * A pair near enough to join its objects. Score is the value oriented so
+ * larger is always nearer.
+ */
+struct ClusterEdge {
+    uint32_t i;
+    uint32_t j;
+    float value;
+    float score;
+
+    ClusterEdge(const uint32_t i, const uint32_t j, const float value, const float score) :
+        i(i), j(j), value(value), score(score) {}
+};
+
+/**
+ * Orders edges from nearest to furthest, ties broken by the lower pair so
+ * the edges kept do not depend on the order rows are added.
+ */
+inline bool stronger(const ClusterEdge &a, const ClusterEdge &b) {
+    if (a.score != b.score) return a.score > b.score;
+    if (a.i != b.i) return a.i < b.i;
+    return a.j < b.j;
+}
+
+/**
+ * One merge of a dendrogram. Object i is cluster i and the k-th merge
+ * creates cluster n + k, as in the linkage matrices of SciPy.
+ */
+struct ClusterMerge {
+    uint32_t a;
+    uint32_t b;
+    float value;
+    uint32_t size;
+};
+
+/**
+ * Union find over the objects, by size with path halving.
+ */
+class DisjointSets {
+public:
+
+    /**
+     * @param n [The number of objects, each starting in its own set]
+     */
+    DisjointSets(const unsigned int n) : parent(n), sizes(n, 1) {
+        for (unsigned int i = 0; i < n; ++i) {
+            parent[i] = i;
+        }
+    }
+
+    /**
+     * The representative of the set holding i.
+     */
+    unsigned int find(unsigned int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    }
+
+    /**
+     * Join the sets holding i and j.
+     * @return [False if they were already the same set]
+     */
+    bool unite(unsigned int i, unsigned int j) {
+        i = find(i);
+        j = find(j);
+        if (i == j) return false;
+        if (sizes[i] < sizes[j]) std::swap(i, j);
+        parent[j] = i;
+        sizes[i] += sizes[j];
+        return true;
+    }
+
+    /**
+     * The size of the set whose representative is i.
+     */
+    unsigned int size(const unsigned int i) const {
+        return sizes[i];
+    }
+
+private:
+    std::vector<unsigned int> parent;
+    std::vector<unsigned int> sizes;
+};
+
+/**
+ * Clusters objects as rows are completed rather than holding the triangle,
+ * so only the clusters are written. A pair joins its objects when it is near
+ * enough: a nearness of at least the threshold or a distance of at most it.
+ * Without a threshold every pair whose objects meet, or whose distance is
+ * finite, joins them.
+ *
+ * Components are joined as each row arrives. Single linkage is the minimum
+ * spanning forest of the pairs, found by Kruskal. Pairs are buffered and
+ * whenever the buffer fills the forest is found again from its own edges and
+ * the buffer. A pair left out of the forest of some of the pairs is never in
+ * the forest of all of them, so memory stays linear in the number of
+ * objects.
+ */
+class ClusterResults : public ResultSink {
+public:
+
+    /**
+     * @param n                [The number of objects]
+     * @param method           [How objects are clustered]
+     * @param larger_is_nearer [Whether larger values are nearer for the
+     *                         measure]
+     * @param threshold        [How near a pair must be to join its objects,
+     *                         NaN to join every pair whose objects meet]
+     */
+    ClusterResults(
+        const unsigned int n,
+        const ClusterMethod method,
+        const bool larger_is_nearer,
+        const float threshold) :
+        n(n),
+        method(method),
+        larger_is_nearer(larger_is_nearer),
+        threshold(threshold),
+        sets(n),
+        capacity(std::max(2 * n, 1024u)) {
+
+        if (threshold != threshold) {
+            this->threshold = larger_is_nearer ? 0 : std::numeric_limits<float>::infinity();
+        }
+    }
+
+    void add_row(const unsigned int i, const Result &row) {
+        std::vector<ClusterEdge> edges;
+        for (unsigned int l = 0; l < row.size(); ++l) {
+            if (joins(row[l])) {
+                float score = larger_is_nearer ? row[l] : -row[l];
+                edges.push_back(ClusterEdge(i, i + 1 + l, row[l], score));
+            }
+        }
+        if (edges.empty()) return;
+
+        boost::mutex::scoped_lock lock(mutex);
+        if (method == CLUSTER_COMPONENTS) {
+            for (unsigned int e = 0; e < edges.size(); ++e) {
+                sets.unite(edges[e].i, edges[e].j);
+            }
+            return;
+        }
+        pending.insert(pending.end(), edges.begin(), edges.end());
+        if (pending.size() >= capacity) {
+            compact();
+        }
+    }
+
+    /**
+     * The component of each object, named by its first object. Must be
+     * called once every row has been added.
+     */
+    std::vector<uint32_t> labels() {
+        std::vector<uint32_t> first(n, n);
+        std::vector<uint32_t> result(n);
+        for (unsigned int i = 0; i < n; ++i) {
+            unsigned int root = sets.find(i);
+            if (first[root] == n) first[root] = i;
+            result[i] = first[root];
+        }
+        return result;
+    }
+
+    /**
+     * The merges of single linkage from nearest to furthest, one fewer than
+     * the objects for each component. Must be called once every row has
+     * been added.
+     */
+    std::vector<ClusterMerge> merges() {
+        compact();
+
+        // the cluster each set of the forest so far is
+        DisjointSets merged(n);
+        std::vector<uint32_t> cluster(n);
+        for (unsigned int i = 0; i < n; ++i) {
+            cluster[i] = i;
+        }
+
+        std::vector<ClusterMerge> result;
+        for (unsigned int e = 0; e < forest.size(); ++e) {
+            unsigned int a = merged.find(forest[e].i);
+            unsigned int b = merged.find(forest[e].j);
+
+            ClusterMerge merge;
+            merge.a = std::min(cluster[a], cluster[b]);
+            merge.b = std::max(cluster[a], cluster[b]);
+            merge.value = forest[e].value;
+            merge.size = merged.size(a) + merged.size(b);
+            result.push_back(merge);
+
+            merged.unite(a, b);
+            cluster[merged.find(a)] = n + e;
+        }
+        return result;
+    }
+
+    /**
+     * How objects are clustered.
+     */
+    ClusterMethod cluster_method() const {
+        return method;
+    }
+
+    /**
+     * The number of objects.
+     */
+    unsigned int size() const {
+        return n;
+    }
+
+private:
+
+    /**
+     * Whether a pair with the given value joins its objects.
+     */
+    bool joins(const float value) const {
+        if (larger_is_nearer) {
+            return value > 0 && value >= threshold;
+        }
+        return value <= threshold && value < std::numeric_limits<float>::infinity();
+    }
+
+    /**
+     * Replace the forest by the minimum spanning forest of its edges and
+     * the pending edges, in order from nearest to furthest.
+     */
+    void compact() {
+        pending.insert(pending.end(), forest.begin(), forest.end());
+        std::sort(pending.begin(), pending.end(), stronger);
+
+        DisjointSets spanning(n);
+        forest.clear();
+        for (unsigned int e = 0; e < pending.size(); ++e) {
+            if (spanning.unite(pending[e].i, pending[e].j)) {
+                forest.push_back(pending[e]);
+            }
+        }
+        std::vector<ClusterEdge>().swap(pending);
+    }
+
+    unsigned int n;
+    ClusterMethod method;
+    bool larger_is_nearer;
+    float threshold;
+
+    // the components joined so far
+    DisjointSets sets;
+
+    // the spanning forest so far and the edges added since it was found
+    std::vector<ClusterEdge> forest;
+    std::vector<ClusterEdge> pending;
+    size_t capacity;
+
+    boost::mutex mutex;
+};
+
+} // namespace nearness
+
+#endif
@@ -26,8 +26,12 @@
 #include <vector>
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
 
 #include "maximal_clique_basic_includes.hpp"
+#include "spatial_index.hpp"
+
+namespace nearness {
 
  /**
   * Squared euclidean distance between two n-degree points
@@ -38,7 +42,7 @@
   * @param  size      [The numbers of features]
   * @return           [The squared distance]
   */
-float distance(
+inline float distance(
     const std::vector<float> &objects_a,
     const std::vector<float> &objects_b,
     const int a,
@@ -75,19 +79,22 @@ const int BUFFER_SIZE = 512;
  * Reads input file of features values into a vector.
  * @param in      [The name of the input file]
  * @param results [The vector to put feature values into]
+ * @return        [False if the file could not be opened]
  */
-void read_features_fast(
+inline bool read_features_fast(
     const std::string &in,
     std::vector<float> &results) {
 
     // read in objects
     FILE *fp = fopen(in.c_str(), "rb");
+    if (fp == NULL) return false;
     char buffer[BUFFER_SIZE];
     setvbuf(fp, (char *)NULL, _IOFBF, BUFFER_SIZE * 16);
     while (fgets(buffer, sizeof buffer, fp) != NULL) {
         results.push_back(atof(buffer));
     }
     fclose(fp);
+    return true;
 }
 
 /**
@@ -97,7 +104,7 @@ void read_features_fast(
  * @param epsilon      [The epsilon value to use]
  * @param num_features [The number of features per object]
  */
-void features_to_graph(
+inline void features_to_graph(
     std::vector<float> &features,
     std::vector<IdSet> &results,
     const float epsilon,
@@ -134,6 +141,56 @@ void features_to_graph(
 
 }
 
+/**
+ * Creates a neighbourhood graph from a list of feature values, only computing
+ * the distance between objects the index finds within epsilon of each other.
+ * @param features     [The vector of input values]
+ * @param index        [The spatial index of the features]
+ * @param results      [The vector to output the neighbourhood graph to]
+ * @param epsilon      [The epsilon value to use]
+ * @param num_features [The number of features per object]
+ */
+inline void features_to_graph(
+    std::vector<float> &features,
+    const ProjectionIndex &index,
+    std::vector<IdSet> &results,
+    const float epsilon,
+    const unsigned int num_features) {
+
+    // ensure all objects have the right number of features
+    assert(features.size() % num_features == 0);
+
+    unsigned int num_objects = features.size() / num_features;
+    assert(index.size() == num_objects);
+
+    results.resize(num_objects);
+
+    #ifdef DYNAMIC_BITSET
+        for (unsigned int i = 0; i < num_objects; ++i) {
+            results[i].resize(num_objects * 2);
+        }
+    #endif
+
+    // sweep along the sorted projection, stopping once objects are too far
+    // apart along it to be neighbours
+    float sqr_epsilon = epsilon * epsilon;
+    for (unsigned int p = 0; p < num_objects; ++p) {
+        unsigned int i = index.object(p);
+        for (unsigned int q = p + 1;
+                q < num_objects && index.key(q) - index.key(p) < epsilon; ++q) {
+            unsigned int j = index.object(q);
+            if (distance(
+                    features,
+                    i * num_features,
+                    j * num_features,
+                    num_features) < sqr_epsilon) {
+                results[i].set(j);
+                results[j].set(i);
+            }
+        }
+    }
+}
+
 /**
  * Combines two neighbourhood graphs with their feature vectors.
  * @param  features_a   [The features of the first object]
@@ -145,7 +202,7 @@ void features_to_graph(
  * @param  num_features [The number of features per object]
  * @return              [True if the two objects were not disjoint]
  */
-bool features_to_graph(
+inline bool features_to_graph(
     std::vector<float> &features_a,
     std::vector<float> &features_b,
     std::vector<IdSet> &graph_a,
@@ -201,4 +258,228 @@ bool features_to_graph(
     return meet;
 }
 
+/**
+ * Combines two neighbourhood graphs with their feature vectors, querying the
+ * index of the second object with each feature of the first so only nearby
+ * pairs have their distance computed.
+ * @param  features_a   [The features of the first object]
+ * @param  features_b   [The features of the second object]
+ * @param  graph_a      [The partial graph of the first object]
+ * @param  graph_b      [The partial graph of the second object]
+ * @param  index_b      [The spatial index of the second object]
+ * @param  results      [The combined graph]
+ * @param  epsilon      [The epsilon to use]
+ * @param  num_features [The number of features per object]
+ * @return              [True if the two objects were not disjoint]
+ */
+inline bool features_to_graph(
+    std::vector<float> &features_a,
+    std::vector<float> &features_b,
+    std::vector<IdSet> &graph_a,
+    std::vector<IdSet> &graph_b,
+    const ProjectionIndex &index_b,
+    std::vector<IdSet> &results,
+    const float epsilon,
+    const unsigned int num_features) {
+
+    // ensure all objects have the right number of features
+    assert(features_b.size() % num_features == 0);
+    assert(features_a.size() % num_features == 0);
+
+    unsigned int num_objects_a = features_a.size() / num_features;
+    unsigned int num_objects_b = features_b.size() / num_features;
+    unsigned int num_objects = num_objects_a + num_objects_b;
+
+    #ifndef DYNAMIC_BITSET
+        assert(num_objects <= MAX_VERTICES);
+    #endif
+
+    // copy starting graph
+    results = graph_a;
+
+    // size bitsets
+    results.resize(num_objects);
+
+    // add shifted second graph
+    for (unsigned int i = 0; i < num_objects_b; ++i) {
+        results[num_objects_a + i] = graph_b[i] << num_objects_a;
+    }
+
+    // if the two graphs meet can be used to optimize
+    bool meet = false;
+
+    // compare each object of the first graph to the nearby objects of the
+    // second
+    float sqr_epsilon = epsilon * epsilon;
+    unsigned int dim = index_b.dimension();
+    for (unsigned int i = 0; i < num_objects_a; ++i) {
+        unsigned int first, last;
+        index_b.range(features_a[i * num_features + dim], epsilon, first, last);
+        for (unsigned int p = first; p < last; ++p) {
+            unsigned int j = index_b.object(p);
+            if (distance(
+                    features_a,
+                    features_b,
+                    i * num_features,
+                    j * num_features,
+                    num_features) < sqr_epsilon) {
+                results[i].set(num_objects_a + j);
+                results[num_objects_a + j].set(i);
+                meet = true;
+            }
+        }
+    }
+
+    return meet;
+}
+
+/**
+ * An edge between two objects along with their squared distance.
+ */
+struct Edge {
+    float sqr_distance;
+    unsigned int a;
+    unsigned int b;
+
+    Edge(const float sqr_distance, const unsigned int a, const unsigned int b) :
+        sqr_distance(sqr_distance), a(a), b(b) {}
+};
+
+/**
+ * Comparison function used to sort edges from shortest to longest.
+ */
+inline bool edge_compare(const Edge &x, const Edge &y) {
+    return x.sqr_distance < y.sqr_distance;
+}
+
+/**
+ * Finds every edge within a single object shorter than epsilon, sorted from
+ * shortest to longest so the neighbourhood graph at any smaller epsilon is a
+ * prefix of the edges.
+ * @param features     [The vector of input values]
+ * @param index        [The spatial index of the features, or NULL to compare
+ *                     every pair]
+ * @param edges        [The vector to output the sorted edges to]
+ * @param epsilon      [The largest epsilon value to use]
+ * @param num_features [The number of features per object]
+ */
+inline void features_to_edges(
+    std::vector<float> &features,
+    const ProjectionIndex *index,
+    std::vector<Edge> &edges,
+    const float epsilon,
+    const unsigned int num_features) {
+
+    // ensure all objects have the right number of features
+    assert(features.size() % num_features == 0);
+
+    unsigned int num_objects = features.size() / num_features;
+
+    edges.clear();
+    float sqr_epsilon = epsilon * epsilon;
+    for (unsigned int p = 0; p < num_objects; ++p) {
+        unsigned int i = index ? index->object(p) : p;
+        for (unsigned int q = p + 1; q < num_objects; ++q) {
+            if (index && index->key(q) - index->key(p) >= epsilon) break;
+            unsigned int j = index ? index->object(q) : q;
+            float sqr_distance = distance(
+                features,
+                i * num_features,
+                j * num_features,
+                num_features);
+            if (sqr_distance < sqr_epsilon) {
+                edges.push_back(Edge(sqr_distance, i, j));
+            }
+        }
+    }
+
+    std::sort(edges.begin(), edges.end(), edge_compare);
+}
+
+/**
+ * Finds every edge between two objects shorter than epsilon, sorted from
+ * shortest to longest. Edges go from an object of the first to an object of
+ * the second, numbered within their own object.
+ * @param features_a   [The features of the first object]
+ * @param features_b   [The features of the second object]
+ * @param index_b      [The spatial index of the second object, or NULL to
+ *                     compare every pair]
+ * @param edges        [The vector to output the sorted edges to]
+ * @param epsilon      [The largest epsilon value to use]
+ * @param num_features [The number of features per object]
+ */
+inline void features_to_edges(
+    std::vector<float> &features_a,
+    std::vector<float> &features_b,
+    const ProjectionIndex *index_b,
+    std::vector<Edge> &edges,
+    const float epsilon,
+    const unsigned int num_features) {
+
+    // ensure all objects have the right number of features
+    assert(features_b.size() % num_features == 0);
+    assert(features_a.size() % num_features == 0);
+
+    unsigned int num_objects_a = features_a.size() / num_features;
+    unsigned int num_objects_b = features_b.size() / num_features;
+
+    edges.clear();
+    float sqr_epsilon = epsilon * epsilon;
+    for (unsigned int i = 0; i < num_objects_a; ++i) {
+        unsigned int first = 0, last = num_objects_b;
+        if (index_b) {
+            index_b->range(features_a[i * num_features + index_b->dimension()],
+                epsilon, first, last);
+        }
+        for (unsigned int p = first; p < last; ++p) {
+            unsigned int j = index_b ? index_b->object(p) : p;
+            float sqr_distance = distance(
+                features_a,
+                features_b,
+                i * num_features,
+                j * num_features,
+                num_features);
+            if (sqr_distance < sqr_epsilon) {
+                edges.push_back(Edge(sqr_distance, i, j));
+            }
+        }
+    }
+
+    std::sort(edges.begin(), edges.end(), edge_compare);
+}
+
+/**
+ * Adds the edges shorter than epsilon to a graph, starting from the first
+ * edge not yet added. Calling this with increasing epsilons grows the graph
+ * from one neighbourhood graph to the next.
+ * @param  edges       [The edges sorted from shortest to longest]
+ * @param  next        [The first edge not yet added, updated to the first
+ *                     edge not added by this call]
+ * @param  sqr_epsilon [The squared epsilon]
+ * @param  offset_a    [Added to the first vertex of each edge]
+ * @param  offset_b    [Added to the second vertex of each edge]
+ * @param  results     [The graph to add edges to]
+ * @return             [The number of edges added]
+ */
+inline unsigned int add_edges(
+    const std::vector<Edge> &edges,
+    unsigned int &next,
+    const float sqr_epsilon,
+    const unsigned int offset_a,
+    const unsigned int offset_b,
+    std::vector<IdSet> &results) {
+
+    unsigned int added = 0;
+    for (; next < edges.size() && edges[next].sqr_distance < sqr_epsilon; ++next) {
+        unsigned int a = edges[next].a + offset_a;
+        unsigned int b = edges[next].b + offset_b;
+        results[a].set(b);
+        results[b].set(a);
+        ++added;
+    }
+    return added;
+}
+
+} // namespace nearness
+
 #endif
\ No newline at end of file
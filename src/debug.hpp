@@ -0,0 +1,61 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The debug and timing macros used through the library. Like assert.h there
+ * is no include guard, each inclusion defines them again for whether DEBUG and
+ * TIMING are defined. nearness.hpp removes them at its end so they never reach
+ * programs that embed the library.
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <ctime>
+
+#undef d
+#undef d_var
+#undef d_clique_var
+#undef create_timing
+#undef start_timing
+#undef stop_timing
+#undef get_timing
+#undef report_timing
+
+// Debug macros
+#ifdef DEBUG
+    #define d(x) do {std::cout << __LINE__ << ":'" << __FUNCTION__ << "' " << x << std::endl; } while (0)
+    #define d_var(x) do { d(#x << " = " << x); } while (0)
+    #define d_clique_var(x) do { d(#x << " = {" << clique_to_string(x) << "}"); } while (0)
+#else
+    #define d(x)
+    #define d_var(x)
+    #define d_clique_var(x)
+#endif
+
+// Timing Macros
+#ifdef TIMING
+    #define create_timing(label) clock_t start_clock_##label = 0; clock_t stop_clock_##label = 0; int count_##label = 0; clock_t total_clock_##label = 0;
+    #define start_timing(label) start_clock_##label = std::clock()
+    #define stop_timing(label) stop_clock_##label = std::clock(); ++count_##label; total_clock_##label += stop_clock_##label - start_clock_##label
+    #define get_timing(label) ((float)total_clock_##label / CLOCKS_PER_SEC * count_##label)
+    #define report_timing(label) printf("%12s %2.2fs\n", #label, get_timing(label))
+#else
+    #define create_timing(label)
+    #define start_timing(label)
+    #define stop_timing(label)
+    #define get_timing(label)
+    #define report_timing(label)
+#endif
@@ -0,0 +1,224 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_DEGREE_INDEX
+#define NEARNESS_DEGREE_INDEX
+
+#include <boost/function.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstdlib>
+#include <limits>
+
+#include "topk.hpp"
+
+namespace nearness {
+
+/**
+ * Sort the degrees of each object, the summaries sgmd_lower_bound works from.
+ * @param subset_sizes [The degree of each vertex of each partial graph]
+ * @param sorted_sizes [The sorted degrees of each to write to]
+ */
+inline void sort_subset_sizes(
+    const std::vector<std::vector<int> > &subset_sizes,
+    std::vector<std::vector<int> > &sorted_sizes) {
+
+    sorted_sizes = subset_sizes;
+    for (unsigned int i = 0; i < sorted_sizes.size(); ++i) {
+        std::sort(sorted_sizes[i].begin(), sorted_sizes[i].end());
+    }
+}
+
+/**
+ * A lower bound of the sgmd distance between two objects from their sorted
+ * degrees, found in linear time rather than by solving the matching. Every
+ * degree of the smaller object is matched to a different degree of the
+ * larger, so costs at least its distance to the nearest degree of the
+ * larger. When both have the same number of degrees matching them in sorted
+ * order is optimal, so the bound is the distance itself.
+ * @param  sorted_a [The sorted degrees of the first object]
+ * @param  sorted_b [The sorted degrees of the second object]
+ * @return          [A value the distance is at least]
+ */
+inline float sgmd_lower_bound(
+    const std::vector<int> &sorted_a,
+    const std::vector<int> &sorted_b) {
+
+    if (sorted_a.empty() || sorted_b.empty()) return 0;
+
+    int cost = 0;
+    if (sorted_a.size() == sorted_b.size()) {
+        for (unsigned int k = 0; k < sorted_a.size(); ++k) {
+            cost += std::abs(sorted_a[k] - sorted_b[k]);
+        }
+        return cost;
+    }
+
+    const std::vector<int> &smaller = sorted_a.size() < sorted_b.size() ? sorted_a : sorted_b;
+    const std::vector<int> &larger = sorted_a.size() < sorted_b.size() ? sorted_b : sorted_a;
+    unsigned int l = 0;
+    for (unsigned int k = 0; k < smaller.size(); ++k) {
+        while (l + 1 < larger.size() && larger[l + 1] <= smaller[k]) ++l;
+        int nearest = std::abs(smaller[k] - larger[l]);
+        if (l + 1 < larger.size()) {
+            nearest = std::min(nearest, larger[l + 1] - smaller[k]);
+        }
+        cost += nearest;
+    }
+    return cost;
+}
+
+/**
+ * Index of the sorted degrees of every object of a corpus, finding the
+ * objects nearest by sgmd while solving the matching of only a few pairs.
+ *
+ * sgmd does not obey the triangle inequality, since the degrees of the larger
+ * object left unmatched cost nothing, so a metric tree or pivots could lose
+ * true neighbours. Instead the lower bound of every object is found from the
+ * sorted degrees, which is linear in the size of the pair rather than cubic,
+ * and objects are matched in order of their bound until the next bound is
+ * further than the k nearest found so far. Those objects can not be nearer,
+ * so the result is exactly that of matching every pair.
+ *
+ * When searching from each object of the corpus in turn, the distances a
+ * completed search matched to later objects are kept, so no pair is matched
+ * twice however the searches overlap.
+ */
+class DegreeIndex {
+public:
+
+    /**
+     * @param subset_sizes [The degree of each vertex of each object]
+     */
+    DegreeIndex(const std::vector<std::vector<int> > &subset_sizes) :
+        known(subset_sizes.size()),
+        complete(subset_sizes.size(), 0),
+        evaluated(0) {
+
+        sort_subset_sizes(subset_sizes, sorted_sizes);
+    }
+
+    /**
+     * Find the k nearest objects to a query. Ties are broken by the lower
+     * index, as with TopKResults.
+     * @param sorted_query [The sorted degrees of the query]
+     * @param k            [The number of nearest objects to find]
+     * @param exclude      [The object of the corpus searched from, left out and
+     *                     its matched distances kept for later searches, or
+     *                     size() to consider every object]
+     * @param distance     [The exact distance from the query to an object]
+     * @param result       [Set to the k nearest objects, nearest first]
+     */
+    void nearest(
+        const std::vector<int> &sorted_query,
+        const unsigned int k,
+        const unsigned int exclude,
+        const boost::function<float (unsigned int)> &distance,
+        std::vector<Neighbour> &result) {
+
+        std::vector<std::pair<float, unsigned int> > bounds;
+        bounds.reserve(size());
+        for (unsigned int j = 0; j < size(); ++j) {
+            if (j == exclude) continue;
+            bounds.push_back(std::make_pair(sgmd_lower_bound(sorted_query, sorted_sizes[j]), j));
+        }
+        std::sort(bounds.begin(), bounds.end());
+
+        result.clear();
+        std::vector<std::pair<unsigned int, float> > matched;
+        for (unsigned int c = 0; c < bounds.size(); ++c) {
+            // an equal bound may still tie and win by its lower index
+            if (result.size() == k && bounds[c].first > result.front().value) break;
+
+            unsigned int j = bounds[c].second;
+            float value;
+            if (!recall(j, exclude, value)) {
+                value = distance(j);
+                matched.push_back(std::make_pair(j, value));
+            }
+            push_bounded(result, k, Neighbour(j, value, -value));
+        }
+        std::sort(result.begin(), result.end(), nearer);
+
+        __sync_add_and_fetch(&evaluated, matched.size());
+
+        // keep the pairs later objects will search for, then publish them
+        if (exclude < size()) {
+            std::vector<std::pair<unsigned int, float> > &later = known[exclude];
+            for (unsigned int m = 0; m < matched.size(); ++m) {
+                if (matched[m].first > exclude) later.push_back(matched[m]);
+            }
+            std::sort(later.begin(), later.end());
+            __sync_synchronize();
+            complete[exclude] = 1;
+        }
+    }
+
+    /**
+     * The sorted degrees of object j.
+     */
+    const std::vector<int> &sorted(const unsigned int j) const {
+        return sorted_sizes[j];
+    }
+
+    /**
+     * The number of objects.
+     */
+    unsigned int size() const {
+        return sorted_sizes.size();
+    }
+
+    /**
+     * The number of pairs matched by every search so far.
+     */
+    unsigned long num_evaluated() const {
+        return evaluated;
+    }
+
+private:
+
+    /**
+     * Find the distance between an earlier object and a later one kept by the
+     * completed search from the earlier object.
+     * @param  j     [The object matched against]
+     * @param  i     [The object searched from]
+     * @param  value [Set to the distance if it is known]
+     * @return       [Whether the distance is known]
+     */
+    bool recall(const unsigned int j, const unsigned int i, float &value) const {
+        if (i >= size() || j > i || !complete[j]) return false;
+        __sync_synchronize();
+
+        const std::vector<std::pair<unsigned int, float> > &later = known[j];
+        std::vector<std::pair<unsigned int, float> >::const_iterator it = std::lower_bound(
+            later.begin(), later.end(), std::make_pair(i, -std::numeric_limits<float>::infinity()));
+        if (it == later.end() || it->first != i) return false;
+        value = it->second;
+        return true;
+    }
+
+    std::vector<std::vector<int> > sorted_sizes;
+    // the distances each completed search matched to later objects
+    std::vector<std::vector<std::pair<unsigned int, float> > > known;
+    std::vector<char> complete;
+    volatile unsigned long evaluated;
+};
+
+} // namespace nearness
+
+#endif
@@ -0,0 +1,160 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Checks that NearnessEngine gives each pair the value of a run, with and
+ * without duplicates and with one or several threads, and that the nearness
+ * and queries of objects outside the corpus agree with it.
+ *
+ * usage: make engine_test && bin/engine_test data features epsilon
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#include "nearness.hpp"
+
+using namespace nearness;
+
+/**
+ * Compare every pair of a run of an engine with the pair computed alone.
+ * @return [The number of pairs that differ]
+ */
+unsigned int check_run(NearnessEngine &engine) {
+    std::string error;
+    TriangleResults results(engine.size());
+    if (!engine.run(results, error)) {
+        std::cout << "run failed: " << error << std::endl;
+        return 1;
+    }
+
+    unsigned int errors = 0;
+    for (unsigned int i = 0; i < engine.size(); ++i) {
+        for (unsigned int j = 0; j < engine.size(); ++j) {
+            if (i == j) continue;
+            float value;
+            if (!engine.pair(i, j, value, error)) {
+                std::cout << "pair failed: " << error << std::endl;
+                return errors + 1;
+            }
+            if (value != results.get(i, j)) {
+                std::cout << i << "\t" << j << "\t" << value << " is not " << results.get(i, j) << std::endl;
+                ++errors;
+            }
+        }
+    }
+    return errors;
+}
+
+/**
+ * Compare the nearness of objects outside the corpus and a query against the
+ * corpus with the pairs of the corpus.
+ * @return [The number of values that differ]
+ */
+unsigned int check_outside(NearnessEngine &engine, const std::vector<Object> &objects) {
+    std::string error;
+    unsigned int errors = 0;
+
+    std::vector<QueryEntry> answer;
+    if (!engine.query(objects[0], 0, answer, error) || answer.size() != objects.size()) {
+        std::cout << "query failed: " << error << std::endl;
+        return 1;
+    }
+
+    for (unsigned int j = 1; j < objects.size(); ++j) {
+        float value, expected;
+        if (!engine.nearness(objects[0], objects[j], value, error)
+            || !engine.pair(0, j, expected, error)) {
+            std::cout << "nearness failed: " << error << std::endl;
+            return errors + 1;
+        }
+        if (value != expected) {
+            std::cout << "nearness 0\t" << j << "\t" << value << " is not " << expected << std::endl;
+            ++errors;
+        }
+        if (answer[j].index != j || answer[j].value != expected) {
+            std::cout << "query 0\t" << j << "\t" << answer[j].value << " is not " << expected << std::endl;
+            ++errors;
+        }
+    }
+
+    // objects must have a whole number of features
+    Object partial(objects[0]);
+    partial.push_back(0);
+    float value;
+    if (engine.nearness(partial, objects[0], value, error) || engine.add(partial, error)) {
+        std::cout << "an object with a partial feature was accepted" << std::endl;
+        ++errors;
+    }
+    return errors;
+}
+
+int main(int argc, char const *argv[]) {
+    if (argc < 4) {
+        std::cout << "usage: " << argv[0] << " data features epsilon" << std::endl;
+        return 1;
+    }
+    std::vector<std::string> input(1, argv[1]);
+    unsigned int num_features = std::atoi(argv[2]);
+    float epsilon = std::atof(argv[3]);
+
+    std::vector<Object> objects;
+    std::string error;
+    if (!read_objects(input, objects, error) || objects.size() < 2) {
+        std::cout << "error: " << error << std::endl;
+        return 1;
+    }
+
+    bool failed = false;
+    const char *measures[] = {"mce", "sgmd"};
+    for (unsigned int m = 0; m < 2; ++m) {
+        for (unsigned int threads = 1; threads <= 4; threads += 3) {
+            for (unsigned int copies = 0; copies < 2; ++copies) {
+                NearnessEngine engine(num_features, epsilon, measures[m]);
+                engine.set_threads(threads);
+
+                // copies of the last object read first and the first read last
+                if (copies) {
+                    engine.set_deduplicate(true);
+                    engine.add(objects.back(), error);
+                }
+                engine.read(input, error);
+                if (copies) {
+                    engine.add(objects.front(), error);
+                }
+
+                unsigned int errors = check_run(engine);
+                if (!copies) {
+                    errors += check_outside(engine, objects);
+                }
+
+                std::cout << measures[m] << " threads = " << threads
+                          << (copies ? " deduplicated" : "") << std::endl;
+                if (errors == 0) {
+                    std::cout << "Correct!" << std::endl;
+                }
+                else {
+                    std::cout << errors << " error(s)" << std::endl;
+                    failed = true;
+                }
+            }
+        }
+    }
+
+    return failed ? 1 : 0;
+}
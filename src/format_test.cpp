@@ -0,0 +1,164 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * Checks that text values are written as an iostream writes them, and that
+ * exact text values read back as the same float with no shorter text that
+ * would. Then times formatting with each against an iostream.
+ *
+ * usage: make format_test && bin/format_test [count]
+ */
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <limits>
+
+#include "output.hpp"
+
+using namespace nearness;
+
+/**
+ * The values to check, those a run writes and floats of every magnitude.
+ * @param  count [The number of random floats]
+ * @return       [The values]
+ */
+std::vector<float> test_values(const unsigned int count) {
+    std::vector<float> values;
+    values.push_back(0);
+    values.push_back(1);
+    values.push_back(-1);
+    values.push_back(999999);
+    values.push_back(1000000);
+    values.push_back(16777216);
+    values.push_back(FLT_MIN);
+    values.push_back(FLT_MAX);
+    values.push_back(std::numeric_limits<float>::infinity());
+
+    // the nearness of cliques of up to 100 objects
+    for (unsigned int d = 1; d <= 100; ++d) {
+        for (unsigned int n = 0; n <= d; ++n) {
+            values.push_back((float)n / d);
+        }
+    }
+
+    // any finite bit pattern
+    srand(1);
+    while (values.size() < count) {
+        uint32_t bits = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        float value;
+        std::memcpy(&value, &bits, sizeof value);
+        if (value == value && std::fabs(value) <= FLT_MAX) values.push_back(value);
+    }
+    return values;
+}
+
+/**
+ * Check every value is formatted as expected.
+ * @return [The number of values that were not]
+ */
+unsigned int check(const std::vector<float> &values) {
+    unsigned int errors = 0;
+    char buffer[64];
+    for (unsigned int v = 0; v < values.size(); ++v) {
+        float value = values[v];
+
+        std::ostringstream stream;
+        stream << value;
+        std::string text(buffer, format_float(buffer, value, OUTPUT_TEXT));
+        if (text != stream.str()) {
+            std::cout << "text " << text << " is not " << stream.str() << std::endl;
+            ++errors;
+        }
+
+        std::string exact(buffer, format_float(buffer, value, OUTPUT_EXACT_TEXT));
+        if (strtof(exact.c_str(), NULL) != value && value == value) {
+            std::cout << "exact " << exact << " does not read back as " << stream.str() << std::endl;
+            ++errors;
+        }
+
+        // the shortest text holds the fewest digits in %g form
+        int digits = 0;
+        for (unsigned int c = 0; c < exact.size() && exact[c] != 'e'; ++c) {
+            if ('0' <= exact[c] && exact[c] <= '9') ++digits;
+        }
+        if (digits > 1 && value == value && std::fabs(value) <= FLT_MAX) {
+            char shorter[320];
+            std::sprintf(shorter, "%.*g", digits - 1, value);
+            if (strtof(shorter, NULL) == value && std::strlen(shorter) < exact.size()) {
+                std::cout << "exact " << exact << " is longer than " << shorter << std::endl;
+                ++errors;
+            }
+        }
+    }
+    return errors;
+}
+
+/**
+ * Time writing lines of every value with an iostream, as text and as exact
+ * text.
+ */
+void time_formats(const std::vector<float> &values) {
+    clock_t start = clock();
+    std::ostringstream stream;
+    for (unsigned int v = 0; v < values.size(); ++v) {
+        stream << v << '\t' << v << '\t' << values[v] << '\n';
+    }
+    double iostream_time = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    double times[2];
+    OutputFormat formats[2] = {OUTPUT_TEXT, OUTPUT_EXACT_TEXT};
+    for (unsigned int f = 0; f < 2; ++f) {
+        start = clock();
+        std::string buffer;
+        for (unsigned int v = 0; v < values.size(); ++v) {
+            format_line(buffer, formats[f], v, v, values[v]);
+        }
+        times[f] = (double)(clock() - start) / CLOCKS_PER_SEC;
+    }
+
+    std::cout << values.size() << " lines" << std::endl;
+    std::cout << "iostream " << iostream_time << "s" << std::endl;
+    std::cout << "text     " << times[0] << "s" << std::endl;
+    std::cout << "exact    " << times[1] << "s" << std::endl;
+}
+
+int main(int argc, char const *argv[]) {
+    unsigned int count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    std::vector<float> values = test_values(count);
+
+    unsigned int errors = check(values);
+    if (errors == 0) {
+        std::cout << "Correct!" << std::endl;
+    }
+    else {
+        std::cout << errors << " error(s)" << std::endl;
+    }
+
+    // the nearness values of a run, most of which are small fractions
+    std::vector<float> nearness;
+    for (unsigned int v = 0; nearness.size() < count; ++v) {
+        unsigned int d = 1 + v % 12;
+        nearness.push_back((float)(v / 12 % (d + 1)) / d);
+    }
+    time_formats(nearness);
+
+    return errors == 0 ? 0 : 1;
+}
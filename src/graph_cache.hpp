@@ -0,0 +1,294 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_GRAPH_CACHE
+#define NEARNESS_GRAPH_CACHE
+
+#include <boost/filesystem.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+#include "maximal_clique_basic_includes.hpp"
+
+namespace nearness {
+
+/**
+ * Header at the start of every cached graph. It is followed by the degree of
+ * each vertex as a uint32_t, then the adjacency of each vertex as a bitset of
+ * the given number of uint64_t words.
+ */
+struct GraphCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_vertices;
+    uint32_t words;
+};
+
+/**
+ * 64 bit FNV-1a hash.
+ * @param  data [The bytes to hash]
+ * @param  size [The number of bytes]
+ * @param  h    [The hash to continue from]
+ * @return      [The hash including data]
+ */
+inline uint64_t fnv1a(
+    const void *data,
+    const size_t size,
+    uint64_t h = 14695981039346656037ULL) {
+
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * A directory of partial neighbourhood graphs addressed by a hash of the
+ * feature values, epsilon and feature count they were built from. Graphs are
+ * read back with mmap so repeated runs over the same images skip computing
+ * the distances within each image. Since the name is derived from the content
+ * an entry never goes stale, a changed image simply gets a new entry.
+ */
+class GraphCache {
+public:
+
+    static const uint32_t VERSION = 1;
+
+    /**
+     * @param directory [The directory to keep graphs in, created if missing]
+     */
+    GraphCache(const std::string &directory) : directory(directory) {
+        boost::filesystem::create_directories(directory);
+    }
+
+    /**
+     * The file a graph is cached in.
+     * @param  features     [The feature values of the image]
+     * @param  epsilon      [The epsilon used to find the neighbourhood]
+     * @param  num_features [The number of features per object]
+     * @return              [The path of the cache entry]
+     */
+    std::string path(
+        const std::vector<float> &features,
+        const float epsilon,
+        const unsigned int num_features) const {
+
+        // hashed from a copy, the constant itself has no definition
+        const uint32_t version = VERSION;
+        uint64_t h = fnv1a(&version, sizeof version);
+        h = fnv1a(&epsilon, sizeof epsilon, h);
+        h = fnv1a(&num_features, sizeof num_features, h);
+        if (!features.empty()) {
+            h = fnv1a(&features.front(), features.size() * sizeof(float), h);
+        }
+
+        char name[32];
+        std::sprintf(name, "%016llx.graph", (unsigned long long)h);
+        return (boost::filesystem::path(directory) / name).string();
+    }
+
+    /**
+     * Load a cached graph.
+     * @param  features     [The feature values of the image]
+     * @param  epsilon      [The epsilon used to find the neighbourhood]
+     * @param  num_features [The number of features per object]
+     * @param  graph        [The graph to write to, sized as features_to_graph
+     *                      would]
+     * @param  degrees      [The degree of each vertex to write to]
+     * @return              [False if the graph is not cached]
+     */
+    bool load(
+        const std::vector<float> &features,
+        const float epsilon,
+        const unsigned int num_features,
+        std::vector<IdSet> &graph,
+        std::vector<int> &degrees) const {
+
+        std::vector<char> buffer;
+        const char *data = NULL;
+        size_t size = 0;
+
+        std::string file = path(features, epsilon, num_features);
+
+        #ifdef _WIN32
+            std::ifstream in(file.c_str(), std::ios::binary);
+            if (!in) return false;
+            buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            data = buffer.empty() ? NULL : &buffer.front();
+            size = buffer.size();
+        #else
+            int fd = open(file.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            void *mapped = MAP_FAILED;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                size = st.st_size;
+                mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            }
+            close(fd);
+            if (mapped == MAP_FAILED) return false;
+            data = static_cast<const char *>(mapped);
+        #endif
+
+        bool loaded = parse(data, size, features.size() / num_features, graph, degrees);
+
+        #ifndef _WIN32
+            munmap(mapped, size);
+        #endif
+
+        return loaded;
+    }
+
+    /**
+     * Cache a graph. The entry is written to a temporary file first so other
+     * runs never see a partial entry.
+     * @param features     [The feature values of the image]
+     * @param epsilon      [The epsilon used to find the neighbourhood]
+     * @param num_features [The number of features per object]
+     * @param graph        [The graph to cache]
+     * @param degrees      [The degree of each vertex]
+     */
+    void store(
+        const std::vector<float> &features,
+        const float epsilon,
+        const unsigned int num_features,
+        const std::vector<IdSet> &graph,
+        const std::vector<int> &degrees) const {
+
+        uint32_t num_vertices = graph.size();
+
+        GraphCacheHeader header;
+        std::memcpy(header.magic, "NRNG", 4);
+        header.version = VERSION;
+        header.num_vertices = num_vertices;
+        header.words = (num_vertices + 63) / 64;
+
+        std::vector<uint32_t> degree_words(degrees.begin(), degrees.end());
+        std::vector<uint64_t> rows((size_t)num_vertices * header.words, 0);
+        for (uint32_t v = 0; v < num_vertices; ++v) {
+            uint64_t *row = &rows[(size_t)v * header.words];
+            for (uint32_t u = 0; u < num_vertices; ++u) {
+                if (graph[v][u]) row[u / 64] |= (uint64_t)1 << (u % 64);
+            }
+        }
+
+        std::string file = path(features, epsilon, num_features);
+        std::string tmp = file + ".tmp";
+        {
+            std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&header), sizeof header);
+            if (num_vertices > 0) {
+                out.write(reinterpret_cast<const char *>(&degree_words.front()),
+                    degree_words.size() * sizeof(uint32_t));
+            }
+            if (!rows.empty()) {
+                out.write(reinterpret_cast<const char *>(&rows.front()),
+                    rows.size() * sizeof(uint64_t));
+            }
+            if (!out) {
+                std::cerr << "warning: could not write graph cache '" << tmp << "'" << std::endl;
+                return;
+            }
+        }
+
+        boost::system::error_code error;
+        boost::filesystem::rename(tmp, file, error);
+        if (error) {
+            std::cerr << "warning: could not write graph cache '" << file << "'" << std::endl;
+        }
+    }
+
+private:
+
+    /**
+     * Read a graph from the bytes of a cache entry.
+     * @return [False if the entry is malformed or of the wrong size]
+     */
+    static bool parse(
+        const char *data,
+        const size_t size,
+        const unsigned int num_vertices,
+        std::vector<IdSet> &graph,
+        std::vector<int> &degrees) {
+
+        GraphCacheHeader header;
+        if (size < sizeof header) return false;
+        std::memcpy(&header, data, sizeof header);
+
+        if (std::memcmp(header.magic, "NRNG", 4) != 0
+            || header.version != VERSION
+            || header.num_vertices != num_vertices
+            || header.words != (num_vertices + 63) / 64) {
+            return false;
+        }
+
+        size_t degrees_offset = sizeof header;
+        size_t rows_offset = degrees_offset + (size_t)num_vertices * sizeof(uint32_t);
+        if (size != rows_offset + (size_t)num_vertices * header.words * sizeof(uint64_t)) {
+            return false;
+        }
+
+        #ifndef DYNAMIC_BITSET
+            if (num_vertices > MAX_VERTICES) return false;
+        #endif
+
+        graph.assign(num_vertices, IdSet());
+        degrees.resize(num_vertices);
+        for (unsigned int v = 0; v < num_vertices; ++v) {
+            #ifdef DYNAMIC_BITSET
+                graph[v].resize(num_vertices * 2);
+            #endif
+
+            uint32_t degree;
+            std::memcpy(&degree, data + degrees_offset + v * sizeof(uint32_t), sizeof degree);
+            degrees[v] = degree;
+
+            for (unsigned int w = 0; w < header.words; ++w) {
+                uint64_t word;
+                std::memcpy(&word,
+                    data + rows_offset + ((size_t)v * header.words + w) * sizeof(uint64_t),
+                    sizeof word);
+                while (word != 0) {
+                    unsigned int u = w * 64 + __builtin_ctzll(word);
+                    if (u >= num_vertices) return false;
+                    graph[v].set(u);
+                    word &= word - 1;
+                }
+            }
+        }
+        return true;
+    }
+
+    std::string directory;
+};
+
+} // namespace nearness
+
+#endif
@@ -0,0 +1,180 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_GRID_INDEX
+#define NEARNESS_GRID_INDEX
+
+#include <boost/unordered_map.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <stdint.h>
+#include <assert.h>
+
+namespace nearness {
+
+/**
+ * Inverted index from grid cells of side epsilon to the images with an object
+ * in that cell, using only the leading feature dimensions.
+ *
+ * Two objects closer than epsilon differ by less than epsilon in every
+ * dimension, so their cells differ by at most one along each indexed
+ * dimension. Two images can therefore only meet if one has an object in a
+ * cell the same as or adjacent to a cell of the other. Images that never
+ * share such cells are disjoint and can be given a nearness of 0 without
+ * computing any distances.
+ *
+ * Cells are identified by a hash of their coordinates. A collision can only
+ * add candidates, never remove them, so the index is exact.
+ */
+class GridIndex {
+public:
+
+    /**
+     * @param objects      [The feature values of every image]
+     * @param epsilon      [The epsilon used to find neighbourhoods]
+     * @param num_features [The number of features per object]
+     * @param dims         [The number of leading dimensions to index]
+     */
+    GridIndex(
+        const std::vector<std::vector<float> > &objects,
+        const float epsilon,
+        const unsigned int num_features,
+        const unsigned int dims) :
+        dims(std::min(dims, num_features)),
+        num_images(objects.size()),
+        // slightly wider than epsilon so rounding in the division can never
+        // push two neighbours two cells apart
+        side(epsilon * (1 + 1e-5f)),
+        cells(objects.size()) {
+
+        assert(this->dims > 0);
+
+        for (unsigned int i = 0; i < objects.size(); ++i) {
+            unsigned int num_objects = objects[i].size() / num_features;
+
+            std::vector<std::vector<int> > &image_cells = cells[i];
+            image_cells.reserve(num_objects);
+            for (unsigned int o = 0; o < num_objects; ++o) {
+                std::vector<int> cell(this->dims);
+                for (unsigned int d = 0; d < this->dims; ++d) {
+                    cell[d] = coordinate(objects[i][o * num_features + d]);
+                }
+                image_cells.push_back(cell);
+            }
+            std::sort(image_cells.begin(), image_cells.end());
+            image_cells.erase(std::unique(image_cells.begin(), image_cells.end()), image_cells.end());
+
+            // images are added in order so each list stays sorted
+            for (unsigned int c = 0; c < image_cells.size(); ++c) {
+                std::vector<unsigned int> &list = index[key(image_cells[c])];
+                if (list.empty() || list.back() != i) list.push_back(i);
+            }
+        }
+    }
+
+    /**
+     * Mark the images after i that may meet i.
+     * @param i          [The image to find candidates for]
+     * @param candidates [Set to the number of images, true for each j > i
+     *                   that may meet i]
+     */
+    void candidates(const unsigned int i, std::vector<char> &candidates) const {
+        candidates.assign(num_images, 0);
+
+        std::vector<int> neighbour(dims);
+        const std::vector<std::vector<int> > &image_cells = cells[i];
+        for (unsigned int c = 0; c < image_cells.size(); ++c) {
+
+            // visit all 3^dims cells around the cell like an odometer
+            std::vector<int> offset(dims, -1);
+            while (true) {
+                for (unsigned int d = 0; d < dims; ++d) {
+                    neighbour[d] = image_cells[c][d] + offset[d];
+                }
+
+                Index::const_iterator it = index.find(key(neighbour));
+                if (it != index.end()) {
+                    const std::vector<unsigned int> &list = it->second;
+                    std::vector<unsigned int>::const_iterator j =
+                        std::upper_bound(list.begin(), list.end(), i);
+                    for (; j != list.end(); ++j) {
+                        candidates[*j] = 1;
+                    }
+                }
+
+                unsigned int d = 0;
+                while (d < dims && offset[d] == 1) {
+                    offset[d] = -1;
+                    ++d;
+                }
+                if (d == dims) break;
+                ++offset[d];
+            }
+        }
+    }
+
+    /**
+     * The number of occupied cells.
+     */
+    size_t size() const {
+        return index.size();
+    }
+
+private:
+
+    typedef boost::unordered_map<uint64_t, std::vector<unsigned int> > Index;
+
+    /**
+     * The cell coordinate of a feature value, clamped so it can not overflow
+     * when looking at neighbours.
+     */
+    int coordinate(const float value) const {
+        float c = std::floor(value / side);
+        if (c < INT_MIN / 2) return INT_MIN / 2;
+        if (c > INT_MAX / 2) return INT_MAX / 2;
+        return (int)c;
+    }
+
+    /**
+     * Hash the coordinates of a cell.
+     */
+    static uint64_t key(const std::vector<int> &cell) {
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned int d = 0; d < cell.size(); ++d) {
+            h ^= (uint32_t)cell[d];
+            h *= 1099511628211ULL;
+            h ^= h >> 29;
+        }
+        return h;
+    }
+
+    unsigned int dims;
+    unsigned int num_images;
+    float side;
+
+    // the unique occupied cells of each image
+    std::vector<std::vector<std::vector<int> > > cells;
+
+    // the images occupying each cell
+    Index index;
+};
+
+} // namespace nearness
+
+#endif
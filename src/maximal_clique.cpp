@@ -30,6 +30,8 @@ namespace po = boost::program_options;
 #include "convert_features.hpp"
 #include "recursive.hpp"
 
+using namespace nearness;
+
 const std::string VERSION = "1.0";
 
 int main(int argc, const char ** argv) {
@@ -19,481 +19,574 @@
 
 // #define DYNAMIC_BITSET
 
-#include <boost/thread/mutex.hpp>
-#include "boost/threadpool.hpp"
-
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
 
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
 
-#include <iostream>
-#include <string>
-#include <vector>
-#include <iomanip>
-
-#include "maximal_clique_basic_includes.hpp"
-
-#include "convert_features.hpp"
-#include "recursive.hpp"
-
-#include "alphanum.hpp"
-#include "libhungarian_c/hungarian.h"
-
-typedef std::vector<float> Object;
-typedef std::vector<float> Result;
+#include <cstdlib>
+#ifndef _WIN32
+    #include <unistd.h>
+#endif
 
-const std::string VERSION = "1.1";
+#include "nearness.hpp"
+#include "debug.hpp"
 
-// mutex used for writing results
-boost::mutex results_mutex;
+using namespace nearness;
 
 /**
- * Simple adapter from fs::path to std::string to sort files in a nautral order.
- * eg. file1.txt, file2.txt, file10.txt
- * @param  p1 [First path object]
- * @param  p2 [Second path object]
- * @return    [p1 < p2]
+ * Parse a comma separated list of epsilons, sorting them in increasing order
+ * and removing duplicates.
+ * @param  list     [The comma separated list]
+ * @param  epsilons [The epsilons to write to]
+ * @param  names    [The text of each epsilon as given, used to name outputs]
+ * @return          [False if the list is empty or not all numbers]
  */
-bool alphanum(const fs::path &p1, const fs::path &p2) {
-    return doj::alphanum_comp(p1.string(), p2.string()) < 0;
+bool parse_epsilons(
+    const std::string &list,
+    std::vector<float> &epsilons,
+    std::vector<std::string> &names) {
+
+    std::vector<std::pair<float, std::string> > parsed;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        const char *start = item.c_str();
+        char *end;
+        float value = strtof(start, &end);
+        if (end == start || *end != '\0') return false;
+        parsed.push_back(std::make_pair(value, item));
+    }
+    if (parsed.empty()) return false;
+
+    std::sort(parsed.begin(), parsed.end());
+    epsilons.clear();
+    names.clear();
+    for (unsigned int k = 0; k < parsed.size(); ++k) {
+        if (k > 0 && parsed[k].first == parsed[k - 1].first) continue;
+        epsilons.push_back(parsed[k].first);
+        names.push_back(parsed[k].second);
+    }
+    return true;
 }
 
 /**
- * Recursively reads files and directories of files containing one feature value
- * per line.
- * @param p       [The path of the file to load]
- * @param objects [The two-dimensional vector of feature values to write to]
+ * Parse a comma separated list of distance measures, keeping the order given
+ * and removing duplicates.
+ * @param  list     [The comma separated list]
+ * @param  measures [The measures to write to]
+ * @return          [False if the list is empty or has an unknown measure]
  */
-void read_file(const fs::path &p, std::vector<Object> &objects) {
-    if (fs::is_regular_file(p)) {
-        Object obj;
-        read_features_fast(p.string(), obj);
-        objects.push_back(obj);
-    }
-    else if (fs::is_directory(p)) {
-        typedef std::vector<fs::path> vec;
-        vec v;
-        copy(fs::directory_iterator(p), fs::directory_iterator(), back_inserter(v));
-        sort(v.begin(), v.end(), alphanum);
-        for (vec::const_iterator it(v.begin()), it_end(v.end()); it != it_end; ++it) {
-            read_file(*it, objects);
+bool parse_measures(
+    const std::string &list,
+    std::vector<std::string> &measures) {
+
+    std::stringstream ss(list);
+    std::string item;
+    measures.clear();
+    while (std::getline(ss, item, ',')) {
+        if (item != "mce" && item != "sgmd") return false;
+        if (std::find(measures.begin(), measures.end(), item) == measures.end()) {
+            measures.push_back(item);
         }
     }
-    else {
-        std::cerr << "error: Given file is neither a regular file nor a directory" << std::endl;
-        assert(false);
-    }
+    return !measures.empty();
 }
 
 /**
- * Reads all given files recursively for feature values.
- * @param input   [The vector of input file names]
- * @param objects [The two-dimensional vector of feature values to write to]
+ * Read and check the options that cluster the objects rather than writing
+ * their nearness.
+ * @param  vm      [The parsed options]
+ * @param  method  [The name of the cluster method given]
+ * @param  options [The output options to set the method of]
+ * @return         [False if the options are not valid]
  */
-void read_objects(std::vector<std::string> &input, std::vector<Object> &objects) {
-
-    for (unsigned int i = 0; i < input.size(); ++i) {
-        const fs::path p(input[i]);
+bool valid_cluster_options(
+    const po::variables_map &vm,
+    const std::string &method,
+    OutputOptions &options) {
+
+    bool valid = true;
+    if (vm.count("cluster") && !parse_cluster_method(method, options.cluster)) {
+        std::cerr << "error: Must specify a valid cluster method" << std::endl;
+        valid = false;
+    }
+    if (vm.count("cluster-threshold")
+        && (!vm.count("cluster") || options.cluster_threshold != options.cluster_threshold)) {
+        std::cerr << "error: Must specify a cluster method and a cluster threshold that is a number" << std::endl;
+        valid = false;
+    }
 
-        try {
-            if (fs::exists(p)) {
-                read_file(p, objects);
-            }
-            else {
-                std::cerr << "error: '" << p.string() << "' file does not exist" << std::endl;
-                assert(false);
-            }
-        }
-        catch (const fs::filesystem_error& ex) {
-            std::cerr << ex.what() << std::endl;
-            assert(false);
-        }
+    // only the clusters are kept, never the nearness itself
+    if (vm.count("cluster") && (options.top_k > 0 || options.stream_rows > 0
+        || vm.count("sparse") || vm.count("half-precision"))) {
+        std::cerr << "error: Cannot combine cluster with top-k, stream, sparse or half-precision" << std::endl;
+        valid = false;
     }
+    return valid;
 }
 
 /**
- * Write progress bar to the console.
- * @param x [The current progress]
- * @param n [The maximum progress]
- * @param w [The width of the progress bar]
+ * Merge the partial results of every shard of a run into one output.
+ * @param  argc [The number of arguments after 'merge']
+ * @param  argv [The arguments after 'merge']
+ * @return      [The exit code]
  */
-static inline void loadbar(
-    unsigned int x,
-    unsigned int n,
-    unsigned int w = 50) {
-
-    float ratio = x/(float)n;
-    unsigned int c = ratio * w;
-
-    std::cerr << std::setw(5) << std::setprecision(2) << (ratio*100) << "% [";
-    for (unsigned int i=0; i<c; ++i) std::cerr << "=";
-    for (unsigned int i=c; i<w; ++i) std::cerr << " ";
-    std::cerr << "]";
-
-    // if finished move to next line
-    if (x != n)
-        std::cerr << '\r' << std::flush;
-    else
-        std::cerr << std::endl;
-}
+int run_merge(int argc, char const *argv[]) {
 
-/**
- * Writes nearness values to the given file in the form i \t j \t value
- * @param out     [The path to the write to]
- * @param results [The nearness values to write]
- */
-void output_results(
-    std::string &out,
-    std::vector<Result> &results) {
+    OutputOptions output_options;
+    std::string output_format;
+    std::string output;
+    std::vector<std::string> input;
+    std::string cluster_method;
+    int num_threads;
 
-    std::ofstream out_file(out.c_str(), std::ofstream::trunc);
-    for (unsigned int i = 0; i < results.size(); ++i) {
-        for (unsigned int j = 0; j < results.size(); ++j) {
-            // min and max are so we can treat the vector as though it is fully
-            // populated. eg [i][j] == [j][i]
-            out_file << i << '\t' << j << '\t'
-                << results[std::min(i,j)][std::max(i,j)] << std::endl;
-        }
-    }
-    out_file.close();
-}
+    po::options_description desc("Usage: nearness merge [options] partial...\nAllowed options");
+    desc.add_options()
+        ("help,h", "Display this help message")
+        ("output,o", po::value<std::string>(&output)->default_value("output"),
+            "The file to output results to")
+        ("output-format", po::value<std::string>(&output_format)->default_value("text"),
+            "The format to write results in. Options are 'text', 'exact' or 'binary'")
+        ("compress", po::value<int>(&output_options.compress_level)->implicit_value(6),
+            "Compress the output as gzip at the given level in [1, 9]")
+        ("top-k", po::value<unsigned int>(&output_options.top_k),
+            "Only write the given number of nearest objects to each object")
+        ("sparse", "Only write pairs with a non-zero nearness")
+        ("half-precision", "Store results in memory as half precision floats")
+        ("stream", po::value<unsigned int>(&output_options.stream_rows)->implicit_value(256),
+            "Write rows to the output as they are read")
+        ("cluster", po::value<std::string>(&cluster_method),
+            "Only write the clusters of the objects. Options are 'components' or 'single-linkage'")
+        ("cluster-threshold", po::value<float>(&output_options.cluster_threshold),
+            "Only join objects by pairs at least this near")
+        ("threads", po::value<int>(&num_threads)->default_value(boost::thread::hardware_concurrency()),
+            "The number of threads to format output with")
+        ("input", po::value<std::vector<std::string> >(&input),
+            "The partial results of every shard")
+    ;
 
-/**
- * Calculates the nearness of two sets given their maximal cliques.
- * @param  cliques     [The maximal clique found in the union of the two objects]
- * @param  num_objects [The total number of objects]
- * @param  singletons  [Whether to include singleton cliques in the result]
- * @return             [The nearness between the two objects]
- */
-void nearness_mce(
-    const unsigned int num_objects,
-    const bool singletons,
-    IdSet &clique,
-    float &numerator,
-    int &denominator) {
+    try {
+        po::positional_options_description p;
+        p.add("input", -1);
 
-        unsigned int count = clique.count();
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).positional(p).options(desc).run(), vm);
+        po::notify(vm);
 
-        // ignore singletons unless set otherwise
-        if (singletons || count > 1) {
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
 
-            unsigned int x = 0;
-            unsigned int y = 0;
+        bool error = false;
+        if (input.empty()) {
+            std::cerr << "error: Must give at least 1 partial result file" << std::endl;
+            error = true;
+        }
+        if (!parse_output_format(output_format, output_options.format)) {
+            std::cerr << "error: Must specify a valid output format" << std::endl;
+            error = true;
+        }
+        if (vm.count("compress") && !(1 <= output_options.compress_level && output_options.compress_level <= 9)) {
+            std::cerr << "error: Must specify a compression level in [1, 9]" << std::endl;
+            error = true;
+        }
+        if (output_options.top_k > 0 && (output_options.stream_rows > 0 || vm.count("sparse"))) {
+            std::cerr << "error: Cannot combine top-k with stream or sparse" << std::endl;
+            error = true;
+        }
+        if (!valid_cluster_options(vm, cluster_method, output_options)) {
+            error = true;
+        }
+        if (error) {
+            std::cout << desc << std::endl;
+            return 1;
+        }
 
-            for (unsigned int i = 0; i < num_objects/2; ++i) {
-                if (clique[i]) ++x;
-            }
-            for (unsigned int i = num_objects/2; i < num_objects; ++i) {
-                if (clique[i]) ++y;
-            }
+        output_options.sparse = vm.count("sparse") > 0;
+        output_options.half = vm.count("half-precision") > 0;
+        num_threads = std::max(num_threads, 1);
+    }
+    catch(std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
 
-            numerator += (std::min(x, y) / (float) std::max(x, y)) * count;
-            denominator += count;
+    // the shards must cover every row exactly once
+    std::vector<PartialFile> partials(input.size());
+    for (unsigned int f = 0; f < input.size(); ++f) {
+        if (!partials[f].open(input[f])) {
+            std::cerr << "error: '" << input[f] << "' is not a partial result file" << std::endl;
+            return 1;
         }
-}
+    }
+    std::sort(partials.begin(), partials.end(), partial_before);
 
-/**
- * Task to calculate the nearness from one object to all later objects.
- * @param i            [The outer set that will be compared]
- * @param objects      [The vector of all objects]
- * @param partial_graphs  [The vector of partial neighborhoods]
- * @param results      [The vector of nearness values to write to]
- * @param epsilon      [The epsilon value used to find the neighborhoods]
- * @param num_features [The number of features per object]
- * @param singletons   [Whether singletons should be included in the results]
- * @param total        [The total number of comparisons to be computed, used for
- *                     progress reporting]
- * @param current      [The number of completed comparisons, used for progress
- *                     reporting]
- */
-void nearness_task_mce(
-    const unsigned int i,
-    std::vector<Object> &objects,
-    std::vector<std::vector<IdSet> > &partial_graphs,
-    std::vector<Result> &results,
-    const float epsilon,
-    const unsigned int num_features,
-    const bool singletons,
-    const unsigned int total,
-    unsigned int &current ) {
-
-    std::vector<float> tmp(objects.size());
-
-    // no need to calculate the nearness to the same object
-    tmp[i] = 0;
-
-    // compare to each object that hasn't been compared to yet
-    for (unsigned int j = i + 1; j < objects.size(); ++j) {
-
-        // create the graph
-        // d("Combine Graphs");
-        std::vector<IdSet> graph;
-        bool meet = features_to_graph(objects[i], objects[j],
-            partial_graphs[i], partial_graphs[j],
-            graph, epsilon, num_features);
-
-        // if the two graphs are disjoint the can have no relevant maximal
-        // cliques and thus we can assume the nearness is 0
-        if (meet) {
-            // find maximal cliques
-            // d("Calculate Cliques");
-            float numerator = 0;
-            int denominator = 0;
-            clique_enumerate(graph,
-                boost::bind(nearness_mce,
-                    graph.size(),
-                    singletons,
-                    _1,
-                    boost::ref(numerator),
-                    boost::ref(denominator)));
-
-            // d("Calculate Nearness");
-            tmp[j] = numerator / denominator;
+    unsigned int num_objects = partials[0].header.num_objects;
+    unsigned int next = 0;
+    for (unsigned int f = 0; f < partials.size(); ++f) {
+        if (!partials[f].same_run(partials[0])) {
+            std::cerr << "error: '" << partials[f].path << "' is from a different run" << std::endl;
+            return 1;
         }
-        else {
-            tmp[j] = 0;
+        if (partials[f].partial.first != next) {
+            std::cerr << "error: rows " << next << " to " << partials[f].partial.first
+                << " are missing or given twice" << std::endl;
+            return 1;
+        }
+        next = partials[f].partial.last;
+    }
+    if (next != num_objects) {
+        std::cerr << "error: rows " << next << " to " << num_objects << " are missing" << std::endl;
+        return 1;
+    }
+
+    ResultSink *results = create_results(output, output_options, num_objects,
+        partials[0].partial.larger_is_nearer != 0);
+    for (unsigned int f = 0; f < partials.size(); ++f) {
+        if (!partials[f].read_rows(*results)) {
+            std::cerr << "error: '" << partials[f].path << "' is cut short" << std::endl;
+            return 1;
         }
     }
+    finish_results(output, results, output_options, num_threads);
+    delete results;
 
-    results_mutex.lock();
-    results[i] = tmp;
-    current += (objects.size() - i);
-    loadbar(current, total);
-    results_mutex.unlock();
+    return 0;
 }
 
 /**
- * Read files, calculate nearness, and output results.
- * @param input        [Vector of input files and directories]
- * @param output       [The name of the output file]
- * @param epsilon      [The epsilon value used to calculate neighborhoods]
- * @param num_features [The number of features per object]
- * @param singletons   [Whether to include singletons in the results]
- * @param num_threads  [The number of threads to run with, when set to 1 runs
- *                     in serial]
+ * Send images to a server started with serve-queries and print the nearness
+ * of each to the corpus of the server, one image per line.
+ * @param  argc [The number of arguments after 'query']
+ * @param  argv [The arguments after 'query']
+ * @return      [The exit code]
  */
-void run_mce(
-    std::vector<std::string> &input,
-    std::string &output,
-    const float epsilon,
-    const unsigned int num_features,
-    const bool singletons,
-    const unsigned int num_threads) {
+int run_query(int argc, char const *argv[]) {
 
-    assert(num_threads > 0);
-    assert(num_features > 0);
-    assert(epsilon > 0);
+    std::string socket_path;
+    unsigned int top_k = 0;
+    std::vector<std::string> input;
 
-    d("Read Objects");
-    std::vector<Object> objects;
-    read_objects(input, objects);
-    d_var(objects.size());
+    po::options_description desc("Usage: nearness query --socket path [options] image...\nAllowed options");
+    desc.add_options()
+        ("help,h", "Display this help message")
+        ("socket", po::value<std::string>(&socket_path),
+            "The Unix domain socket the server listens on")
+        ("top-k", po::value<unsigned int>(&top_k),
+            "Only print the given number of nearest images to each image")
+        ("input", po::value<std::vector<std::string> >(&input),
+            "The feature files of the images, or directories of them")
+    ;
 
-    std::vector<Result> results(objects.size());
+    try {
+        po::positional_options_description p;
+        p.add("input", -1);
 
-    d("Calculate Partial Graphs");
-    std::vector<std::vector<IdSet> > partial_graphs(objects.size());
-    for (unsigned int i = 0; i < objects.size(); ++i) {
-        features_to_graph(objects[i], partial_graphs[i], epsilon, num_features);
-    }
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv).positional(p).options(desc).run(), vm);
+        po::notify(vm);
 
-    // progress
-    unsigned int total = (objects.size() + 1) * (objects.size() / 2);
-    unsigned int current = 0;
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        if (socket_path.empty() || input.empty()) {
+            std::cerr << "error: Must give the socket of the server and at least 1 image" << std::endl;
+            std::cout << desc << std::endl;
+            return 1;
+        }
+    }
+    catch(std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
 
-    // if in serial mode
-    if (num_threads == 1) {
-        d("Serial Mode");
-        for (unsigned int i = 0; i < objects.size(); ++i) {
-            nearness_task_mce(
-                i,
-                objects, partial_graphs, results,
-                epsilon, num_features, singletons,
-                total, current);
+    // directories are queried with each file in a natural order
+    std::vector<fs::path> files;
+    for (unsigned int f = 0; f < input.size(); ++f) {
+        fs::path path(input[f]);
+        if (fs::is_directory(path)) {
+            std::vector<fs::path> entries;
+            copy(fs::directory_iterator(path), fs::directory_iterator(), back_inserter(entries));
+            sort(entries.begin(), entries.end(), alphanum);
+            files.insert(files.end(), entries.begin(), entries.end());
         }
+        else {
+            files.push_back(path);
+        }
+    }
+
+    QueryClient client(socket_path);
+    if (!client.connected()) {
+        std::cerr << "error: could not connect to a server on '" << socket_path << "'" << std::endl;
+        return 1;
     }
-    else {
-        d("Parallel Mode");
-        // create a threadpool with a thread for each core
-        boost::threadpool::pool threadpool(num_threads);
 
-        // find cliques
-        for (unsigned int i = 0; i < objects.size(); ++i) {
-            threadpool.schedule(
-                boost::bind(nearness_task_mce,
-                    i,
-                    boost::ref(objects), boost::ref(partial_graphs), boost::ref(results),
-                    epsilon, num_features, singletons,
-                    total, boost::ref(current)));
+    int status = 0;
+    std::vector<QueryEntry> answer;
+    std::string error;
+    for (unsigned int f = 0; f < files.size(); ++f) {
+        if (!fs::is_regular_file(files[f])) {
+            std::cerr << "error: '" << files[f].string() << "' is not a file" << std::endl;
+            status = 1;
+            continue;
         }
 
-        d("All tasks scheduled");
+        Object features;
+        if (!read_features_fast(files[f].string(), features)) {
+            std::cerr << "error: '" << files[f].string() << "' could not be opened" << std::endl;
+            status = 1;
+            continue;
+        }
+        if (!client.query(features, top_k, answer, error)) {
+            std::cerr << "error: '" << files[f].string() << "': " << error << std::endl;
+            status = 1;
+            if (!client.connected()) break;
+            continue;
+        }
 
-        // wait for tasks to complete
-        threadpool.wait();
+        // values are written as the text output writes them
+        std::string line = files[f].string();
+        char buffer[64];
+        for (unsigned int e = 0; e < answer.size(); ++e) {
+            char *p = buffer;
+            *p++ = ' ';
+            p = format_uint(p, answer[e].index);
+            *p++ = ':';
+            p = format_float(p, answer[e].value, OUTPUT_TEXT);
+            line.append(buffer, p);
+        }
+        std::cout << line << std::endl;
     }
+    return status;
+}
 
-    // output results
-    d("Output");
-    output_results(output, results);
+/**
+ * The configuration of a run sent to each worker, as key=value lines.
+ * @param  measure       [The name of the measure]
+ * @param  epsilon_list  [The epsilons as given]
+ * @param  num_features  [The number of features per object]
+ * @param  singletons    [Whether singletons are included in the results]
+ * @param  grid_dims     [The number of dimensions of the grid index]
+ * @param  min_nearness  [The least mce nearness kept]
+ * @param  max_distance  [The greatest sgmd distance kept]
+ * @param  spatial_index [Whether to use spatial indices]
+ * @param  cache_dir     [The directory of cached graphs, or empty]
+ * @param  deduplicate   [Whether to only compare one copy of each object]
+ * @param  input         [The input files and directories]
+ * @return               [The configuration]
+ */
+std::string work_config(
+    const std::string &measure,
+    const std::string &epsilon_list,
+    const unsigned int num_features,
+    const bool singletons,
+    const unsigned int grid_dims,
+    const float min_nearness,
+    const float max_distance,
+    const bool spatial_index,
+    const std::string &cache_dir,
+    const bool deduplicate,
+    const std::vector<std::string> &input) {
+
+    std::stringstream config;
+    config << std::setprecision(9);
+    config << "measure=" << measure << std::endl;
+    config << "epsilons=" << epsilon_list << std::endl;
+    config << "features=" << num_features << std::endl;
+    config << "singletons=" << singletons << std::endl;
+    config << "grid_dims=" << grid_dims << std::endl;
+    config << "min_nearness=" << min_nearness << std::endl;
+    if (max_distance < std::numeric_limits<float>::infinity()) {
+        config << "max_distance=" << max_distance << std::endl;
+    }
+    config << "spatial_index=" << spatial_index << std::endl;
+    config << "deduplicate=" << deduplicate << std::endl;
+    if (!cache_dir.empty()) {
+        config << "cache=" << fs::absolute(cache_dir).string() << std::endl;
+    }
+    for (unsigned int f = 0; f < input.size(); ++f) {
+        config << "input=" << fs::absolute(input[f]).string() << std::endl;
+    }
+    return config.str();
 }
 
 /**
- * Task to calculate the nearness from one object to all later objects.
- * @param i            [The outer set that will be compared]
- * @param partial_graphs  [The vector of partial neighborhoods]
- * @param results      [The vector of nearness values to write to]
- * @param epsilon      [The epsilon value used to find the neighborhoods]
- * @param total        [The total number of comparisons to be computed, used for
- *                     progress reporting]
- * @param current      [The number of completed comparisons, used for progress
- *                     reporting]
+ * Compute rows handed out by a coordinator started with serve-work until
+ * every row is complete. The objects are read and prepared as configured by
+ * the coordinator.
+ * @param  argc [The number of arguments after 'worker']
+ * @param  argv [The arguments after 'worker']
+ * @return      [The exit code]
  */
-void nearness_task_sgmd(
-    const unsigned int i,
-    std::vector<std::vector<IdSet> > &partial_graphs,
-    std::vector<std::vector<int> > &subset_sizes,
-    std::vector<Result> &results,
-    const unsigned int total,
-    unsigned int &current ) {
-
-    Result tmp(partial_graphs.size());
-
-    // no need to calculate the nearness to the same object
-    tmp[i] = 0;
-
-    hungarian_problem_t* hungarian = new hungarian_problem_t;
-
-    for (unsigned int j = i+1; j < partial_graphs.size(); ++j) {
-
-        // d("Calculate Distance Matrix"); 
-        std::vector<std::vector<int> > distance_matrix(partial_graphs[i].size());
-        std::vector<int*> ptrs(distance_matrix.size() * partial_graphs[0].size());
-        for (unsigned int k = 0; k < distance_matrix.size(); ++k) {
-            distance_matrix[k].resize(partial_graphs[j].size());
-            for (unsigned int l = 0; l < distance_matrix[k].size(); ++l) {
-                distance_matrix[k][l] = std::abs(subset_sizes[i][k] - subset_sizes[j][l]);
-                ptrs[k * distance_matrix[k].size() + l] = &distance_matrix[k][l];
-            }
-        }
+int run_worker(int argc, char const *argv[]) {
 
-        // d("Hungarian Algorithm");
+    std::string socket_path;
 
-        // setup
-        hungarian_init(hungarian, &ptrs.front(), partial_graphs[i].size(), partial_graphs[j].size(), 
-            HUNGARIAN_MODE_MINIMIZE_COST);
-        hungarian_solve(hungarian);
+    po::options_description desc("Usage: nearness worker --socket path\nAllowed options");
+    desc.add_options()
+        ("help,h", "Display this help message")
+        ("socket", po::value<std::string>(&socket_path),
+            "The Unix domain socket the coordinator listens on")
+    ;
 
-        // Sum the assignment cost
-        tmp[j] = 0;
-        for (int k = 0; k < hungarian->num_rows; ++k) {
-            for (int l = 0; l < hungarian->num_cols; ++l) {
-                if (hungarian->assignment[k][l]) {
-                    tmp[j] += distance_matrix[k][l];
-                }
-            }
+    try {
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+
+        if (vm.count("help")) {
+            std::cout << desc << std::endl;
+            return 0;
+        }
+        if (socket_path.empty()) {
+            std::cerr << "error: Must give the socket of the coordinator" << std::endl;
+            std::cout << desc << std::endl;
+            return 1;
         }
+    }
+    catch(std::exception& e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
 
-        // without this we get a large memory leak
-        hungarian_free(hungarian);
+    WorkClient client(socket_path);
+    std::string config;
+    if (!client.connected() || !client.receive_config(config)) {
+        std::cerr << "error: could not connect to a coordinator on '" << socket_path << "'" << std::endl;
+        return 1;
     }
-        
-    // free memory
-    delete hungarian;
 
-    results_mutex.lock();
-    results[i] = tmp;
-    current += (partial_graphs.size() - i);
-    loadbar(current, total);
-    results_mutex.unlock();
-}
+    std::string measure;
+    std::string epsilon_list;
+    unsigned int num_features = 0;
+    bool singletons = false;
+    unsigned int grid_dims = 0;
+    float min_nearness = 0;
+    float max_distance = std::numeric_limits<float>::infinity();
+    bool spatial_index = false;
+    bool deduplicate = false;
+    std::string cache_dir;
+    std::vector<std::string> input;
 
-/**
- * Read files, calculate nearness, and output results.
- * @param input        [Vector of input files and directories]
- * @param output       [The name of the output file]
- * @param epsilon      [The epsilon value used to calculate neighborhoods]
- * @param num_features [The number of features per object]
- * @param singletons   [Whether to include singletons in the results]
- * @param num_threads  [The number of threads to run with, when set to 1 runs
- *                     in serial]
- */
-void run_sgmd(
-    std::vector<std::string> &input,
-    std::string &output,
-    const float epsilon,
-    const unsigned int num_features,
-    const unsigned int num_threads) {
+    std::stringstream lines(config);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t split = line.find('=');
+        if (split == std::string::npos) continue;
+        std::string key = line.substr(0, split);
+        std::stringstream value(line.substr(split + 1));
+        if (key == "measure") value >> measure;
+        else if (key == "epsilons") value >> epsilon_list;
+        else if (key == "features") value >> num_features;
+        else if (key == "singletons") value >> singletons;
+        else if (key == "grid_dims") value >> grid_dims;
+        else if (key == "min_nearness") value >> min_nearness;
+        else if (key == "max_distance") value >> max_distance;
+        else if (key == "spatial_index") value >> spatial_index;
+        else if (key == "deduplicate") value >> deduplicate;
+        else if (key == "cache") cache_dir = value.str();
+        else if (key == "input") input.push_back(value.str());
+    }
 
-    assert(num_threads > 0);
-    assert(num_features > 0);
-    assert(epsilon > 0);
+    std::vector<float> epsilons;
+    std::vector<std::string> epsilon_names;
+    if (!parse_epsilons(epsilon_list, epsilons, epsilon_names) || num_features == 0
+        || (measure != "mce" && measure != "sgmd")) {
+        std::cerr << "error: the coordinator sent an invalid configuration" << std::endl;
+        return 1;
+    }
 
-    d("Read Objects");
-    std::vector<Object> objects;
-    read_objects(input, objects);
-    d_var(objects.size());
+    GraphCache *cache = NULL;
+    if (!cache_dir.empty()) {
+        cache = new GraphCache(cache_dir);
+    }
 
-    // size results
-    std::vector<Result> results(objects.size());
-    for (unsigned int i = 0; i < results.size(); ++i) {
-        results[i].resize(objects.size());
+    NearnessEngine engine(num_features, epsilons[0], measure);
+    engine.set_epsilons(epsilons);
+    engine.set_spatial_index(spatial_index);
+    engine.set_graph_cache(cache);
+    engine.set_deduplicate(deduplicate);
+    std::string error;
+    bool read = engine.read(input, error) && engine.prepare(error);
+    delete cache;
+    if (!read) {
+        std::cerr << "error: " << error << std::endl;
+        return 1;
     }
+    Corpus &corpus = engine.objects();
 
-    d("Calculate Partial Graphs");
-    std::vector<std::vector<IdSet> > partial_graphs(objects.size());
-    for (unsigned int i = 0; i < objects.size(); ++i) {
-        features_to_graph(objects[i], partial_graphs[i], epsilon, num_features);
+    if (!client.ready(corpus_fingerprint(corpus))) {
+        std::cerr << "error: lost the coordinator" << std::endl;
+        return 1;
     }
 
-    d("Count Subsets Size");
-    std::vector<std::vector<int> > subset_sizes(partial_graphs.size());
-    for (unsigned int i = 0; i < subset_sizes.size(); ++i) {
-        subset_sizes[i].resize(partial_graphs[i].size());
-        for (unsigned int j = 0; j < subset_sizes[i].size(); ++j) {
-            subset_sizes[i][j] = partial_graphs[i][j].count();
+    GridIndex *grid = NULL;
+    std::vector<std::vector<std::vector<int> > > subset_sizes(epsilons.size());
+    if (measure == "mce" && grid_dims > 0) {
+        grid = new GridIndex(corpus.objects, epsilons.back(), num_features, grid_dims);
+    }
+    if (measure == "sgmd" && epsilons.size() > 1) {
+        for (unsigned int k = 0; k < epsilons.size(); ++k) {
+            count_subset_sizes(corpus, epsilons[k], num_features, subset_sizes[k]);
         }
     }
+    else if (measure == "sgmd") {
+        subset_sizes[0] = corpus.degrees;
+    }
 
-    // progress
-    unsigned int total = (objects.size() + 1) * (objects.size() / 2);
-    unsigned int current = 0;
-
-    // if in serial mode
-    if (num_threads == 1) {
-        d("Serial Mode");
-        for (unsigned int i = 0; i < objects.size(); ++i) {
-            nearness_task_sgmd(
-                i,
-                partial_graphs, subset_sizes, results,
-                total, current);
-        }
+    Pruning pruning;
+    pruning.grid = grid;
+    pruning.min_nearness = min_nearness;
+    bool bounded = max_distance < std::numeric_limits<float>::infinity();
+    std::vector<std::vector<std::vector<int> > > sorted_sizes(epsilons.size());
+    for (unsigned int k = 0; bounded && k < epsilons.size(); ++k) {
+        sort_subset_sizes(subset_sizes[k], sorted_sizes[k]);
     }
-    else {
-        d("Parallel Mode");
-        // create a threadpool with a thread for each core
-        boost::threadpool::pool threadpool(num_threads);
 
-        // find cliques
-        for (unsigned int i = 0; i < objects.size(); ++i) {
-            threadpool.schedule(
-                boost::bind(nearness_task_sgmd,
-                    i,
-                    boost::ref(partial_graphs), boost::ref(subset_sizes), boost::ref(results),
-                    total, boost::ref(current)));
+    // the row of each output, sent on as each is completed
+    std::vector<CapturedRow> captured(epsilons.size());
+    std::vector<ResultSink *> sinks;
+    for (unsigned int k = 0; k < captured.size(); ++k) {
+        sinks.push_back(&captured[k]);
+    }
+    std::vector<PairCache *> caches;
+    std::vector<Result> rows(epsilons.size());
+    Progress progress(0);
+
+    d("Work");
+    unsigned int i;
+    while (client.next_row(i)) {
+        if (i >= corpus.size()) break;
+
+        double start = monotonic_seconds();
+        if (measure == "sgmd") {
+            for (unsigned int k = 0; k < epsilons.size(); ++k) {
+                nearness_task_sgmd(i, subset_sizes[k], *sinks[k],
+                    bounded ? &sorted_sizes[k] : NULL, max_distance, NULL, progress);
+            }
+        }
+        else if (epsilons.size() > 1) {
+            nearness_task_mce_sweep(i, corpus, sinks, epsilons, num_features, singletons, grid, caches, progress);
+        }
+        else {
+            nearness_task_mce(i, corpus, *sinks[0], epsilons[0], num_features, singletons, pruning, NULL, progress);
         }
 
-        d("All tasks scheduled");
-
-        // wait for tasks to complete
-        threadpool.wait();
+        for (unsigned int k = 0; k < rows.size(); ++k) {
+            rows[k].swap(captured[k].row);
+        }
+        if (!client.send_result(i, monotonic_seconds() - start, rows)) break;
     }
 
-    // output results
-    d("Output");
-    output_results(output, results);
+    delete grid;
+    return 0;
 }
 
 /**
@@ -504,13 +597,55 @@ void run_sgmd(
  */
 int main(int argc, char const *argv[]) {
 
-    float epsilon = 0;
+    // merging shards and workers have their own arguments
+    if (argc > 1 && std::string(argv[1]) == "merge") {
+        return run_merge(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "worker") {
+        return run_worker(argc - 1, argv + 1);
+    }
+    if (argc > 1 && std::string(argv[1]) == "query") {
+        return run_query(argc - 1, argv + 1);
+    }
+
+    // serving work or queries takes the arguments of a run
+    bool serve = argc > 1 && std::string(argv[1]) == "serve-work";
+    bool serve_queries = argc > 1 && std::string(argv[1]) == "serve-queries";
+    if (serve || serve_queries) {
+        --argc;
+        ++argv;
+    }
+
+    std::string epsilon_list;
+    std::vector<float> epsilons;
     int num_features = 0;
     bool singletons = false;
+    OutputOptions output_options;
+    std::string output_format;
     std::string output;
+    std::vector<std::vector<std::string> > outputs;
     std::string distance_measure;
+    std::vector<std::string> measures;
     std::vector<std::string> input;
+    std::vector<std::string> query_input;
+    std::vector<std::string> reference_input;
+    unsigned int band = 0;
+    std::string cluster_method;
     int num_threads;
+    int num_processes = 1;
+    unsigned int grid_dims = 0;
+    float min_nearness = 0;
+    float max_distance = std::numeric_limits<float>::infinity();
+    bool spatial_index = false;
+    std::string cache_dir;
+    std::string pair_cache;
+    std::string socket_path;
+    bool deduplicate = false;
+    bool checkpoint = false;
+    bool resume = false;
+    std::string shard_text;
+    std::string rows_text;
+    Shard shard;
 
     // Args
     po::options_description desc("Allowed options");
@@ -518,17 +653,59 @@ int main(int argc, char const *argv[]) {
         ("help,h", "Display this help message")
         ("version,v", "Display the current version")
         ("distance-measure,d", po::value<std::string>(&distance_measure)->default_value("mce"), 
-        		"Determine the graph distance measure to use. Options are \'mce\'' or \'sgmd\'")
-        ("epsilon,e", po::value<float>(&epsilon),
-            "Set the epsilon used to determine the maximum distance allowed between neighbouring Objects in (0, sqrt(features)]")
+        		"Determine the graph distance measure to use. Options are \'mce\'' or \'sgmd\'. A comma separated list computes each measure in one run, sharing the neighbourhoods and writing each to the output name followed by _<measure>")
+        ("epsilon,e", po::value<std::string>(&epsilon_list),
+            "Set the epsilon used to determine the maximum distance allowed between neighbouring Objects in (0, sqrt(features)]. A comma separated list sweeps each epsilon in one run, computing distances once and writing each to the output name followed by _e<epsilon>")
         ("features,f", po::value<int>(&num_features),
             "Set the number of feature values per object")
         ("output,o", po::value<std::string>(&output)->default_value("output"),
             "The file to output results to")
         ("singletons", "Include singleton cliques in results")
+        ("grid-index", po::value<unsigned int>(&grid_dims)->implicit_value(3),
+            "Index objects in a grid of side epsilon over the given number of leading features so mce skips pairs of disjoint objects without comparing them")
+        ("min-nearness", po::value<float>(&min_nearness),
+            "Only keep mce pairs with at least the given nearness, giving the rest 0. Pairs whose nearness is bounded below it from the degrees of their combined graph are not enumerated")
+        ("max-distance", po::value<float>(&max_distance),
+            "Only keep sgmd pairs with at most the given distance, giving the rest infinity. Pairs whose distance is bounded above it from their sorted degrees are not matched")
+        ("cache", po::value<std::string>(&cache_dir),
+            "Keep the neighbourhood graph of each object in the given directory, addressed by a hash of its features, epsilon and feature count, so later runs load them instead of calculating them")
+        ("socket", po::value<std::string>(&socket_path),
+            "With 'nearness serve-work', the Unix domain socket to hand rows out on. Workers started with 'nearness worker --socket' read the same input and take rows as they finish them. With 'nearness serve-queries', the socket to answer queries from 'nearness query --socket' on, keeping the input in memory")
+        ("pair-cache", po::value<std::string>(&pair_cache),
+            "Keep the results of each measure in the given directory keyed by the content of each object, so later runs only compute the pairs involving new or changed objects")
+        ("shard", po::value<std::string>(&shard_text),
+            "Only compute shard k/N of the rows, with k in [0, N), balanced by estimated cost. Writes partial results to be combined with 'nearness merge'")
+        ("rows", po::value<std::string>(&rows_text),
+            "Only compute the rows a:b, the rows [a, b). Writes partial results to be combined with 'nearness merge'")
+        ("checkpoint", "Append each completed row to a checkpoint beside the output, removed once the output is written")
+        ("resume", "Resume from the checkpoints of an earlier run with the same parameters and objects, only computing the rows it did not complete. Implies --checkpoint")
+        ("deduplicate", "Only compare one copy of objects with identical features, copying its results to the others")
+        ("spatial-index", "Index the objects within each image so only objects close along one feature have their distance computed")
+        ("output-format", po::value<std::string>(&output_format)->default_value("text"),
+            "The format to write results in. Options are 'text', 'exact' or 'binary'")
+        ("compress", po::value<int>(&output_options.compress_level)->implicit_value(6),
+            "Compress the output as gzip at the given level in [1, 9]. Blocks are compressed in parallel")
+        ("top-k", po::value<unsigned int>(&output_options.top_k),
+            "Only keep and write the given number of nearest objects to each object. With sgmd the nearest are found by matching only the objects whose degrees could be near enough")
+        ("sparse", "Only store and write pairs with a non-zero nearness. Text output then gives each pair once")
+        ("half-precision", "Store dense results in memory as half precision floats, halving memory use at the cost of precision")
+        ("stream", po::value<unsigned int>(&output_options.stream_rows)->implicit_value(256),
+            "Write rows to the output as they are completed, buffering at most the given number of rows. Text output then gives each pair once")
+        ("cluster", po::value<std::string>(&cluster_method),
+            "Cluster the objects as rows are completed and only write the clusters rather than the nearness. Options are 'components', writing i and the label of each object, or 'single-linkage', writing the a, b, value and size of each merge of the dendrogram")
+        ("cluster-threshold", po::value<float>(&output_options.cluster_threshold),
+            "Only join objects by pairs at least this near, a nearness of at least or a distance of at most the threshold. Without it every pair whose objects meet joins them")
         ("threads", po::value<int>(&num_threads)->default_value(boost::thread::hardware_concurrency()),
             "Explicitly set the number of threads to execute with. This does not include the main thread. Specifying 1 runs the test in serial mode")
         ("serial", "Runs the test in serial. This is the same as specifying '--threads=1'")
+        ("processes", po::value<int>(&num_processes),
+            "Compute with the given number of forked worker processes instead of threads. Workers share the objects and neighbourhoods built by this process and take rows from a shared queue, rows of a worker that fails are computed again")
+        ("queries", po::value<std::vector<std::string> >(&query_input)->multitoken(),
+            "The query feature files and directories. With --references computes only the nearness from each query to each reference rather than between every pair of the input, writing q, r and the value of every pair")
+        ("references", po::value<std::vector<std::string> >(&reference_input)->multitoken(),
+            "The reference feature files and directories compared with --queries. With --cache their neighbourhoods are loaded rather than calculated by later runs")
+        ("band", po::value<unsigned int>(&band),
+            "Only compute the nearness between objects at most the given number apart in the order read, such as nearby frames of a video, writing the pairs i, j and value within the band")
         ("input", po::value<std::vector<std::string> >(&input),
             "The list of input feature files")
     ;
@@ -565,11 +742,16 @@ int main(int argc, char const *argv[]) {
 
         bool error = false;
 
-        // ensure input files were given
-        if (input.empty()) {
+        // ensure input files were given, either one set or queries and references
+        bool rectangle = !query_input.empty() || !reference_input.empty();
+        if (!rectangle && input.empty()) {
             std::cerr << "error: Must give at least 1 input file" << std::endl;
             error = true;
         }
+        if (rectangle && (query_input.empty() || reference_input.empty() || !input.empty())) {
+            std::cerr << "error: Must give both queries and references and no other input" << std::endl;
+            error = true;
+        }
 
         //ensure features were given
         if (num_features <= 0) {
@@ -577,9 +759,113 @@ int main(int argc, char const *argv[]) {
             error = true;
         }
 
-        // ensure valid epsilon was given
-        if (!(0 < epsilon && epsilon <= std::sqrt(num_features))) {
-            std::cerr << "error: Must specify an epsilon in (0, sqrt(features)]" << std::endl;
+        // ensure valid epsilons were given
+        std::vector<std::string> epsilon_names;
+        if (!parse_epsilons(epsilon_list, epsilons, epsilon_names)) {
+            std::cerr << "error: Must specify epsilons as a comma separated list of numbers" << std::endl;
+            error = true;
+        }
+        for (unsigned int k = 0; k < epsilons.size(); ++k) {
+            if (!(0 < epsilons[k] && epsilons[k] <= std::sqrt(num_features))) {
+                std::cerr << "error: Must specify an epsilon in (0, sqrt(features)]" << std::endl;
+                error = true;
+                break;
+            }
+        }
+
+        // ensure valid distance measures were given
+        if (!parse_measures(distance_measure, measures)) {
+            std::cerr << "error: Must specify a valid distance measure" << std::endl;
+            error = true;
+        }
+
+        // each measure and each epsilon of a sweep is written to its own output
+        for (unsigned int m = 0; m < measures.size(); ++m) {
+            std::string name = measures.size() > 1 ? output + "_" + measures[m] : output;
+            outputs.push_back(std::vector<std::string>());
+            if (epsilons.size() == 1) {
+                outputs[m].push_back(name);
+            }
+            for (unsigned int k = 0; epsilons.size() > 1 && k < epsilons.size(); ++k) {
+                outputs[m].push_back(name + "_e" + epsilon_names[k]);
+            }
+        }
+
+        // ensure a valid output format was given
+        if (!parse_output_format(output_format, output_options.format)) {
+            std::cerr << "error: Must specify a valid output format" << std::endl;
+            error = true;
+        }
+
+        // ensure a valid compression level was given
+        if (vm.count("compress") && !(1 <= output_options.compress_level && output_options.compress_level <= 9)) {
+            std::cerr << "error: Must specify a compression level in [1, 9]" << std::endl;
+            error = true;
+        }
+
+        // top k results are only known once every row is complete
+        if (output_options.top_k > 0 && (output_options.stream_rows > 0 || vm.count("sparse"))) {
+            std::cerr << "error: Cannot combine top-k with stream or sparse" << std::endl;
+            error = true;
+        }
+
+        // ensure a valid shard or rows were given
+        if (!shard_text.empty() && !rows_text.empty()) {
+            std::cerr << "error: Cannot combine shard and rows" << std::endl;
+            error = true;
+        }
+        if (!shard_text.empty() && !parse_shard(shard_text, shard)) {
+            std::cerr << "error: Must specify a shard as k/N with k in [0, N)" << std::endl;
+            error = true;
+        }
+        if (!rows_text.empty() && !parse_rows(rows_text, shard)) {
+            std::cerr << "error: Must specify rows as a:b with a < b" << std::endl;
+            error = true;
+        }
+
+        // a shard writes partial results, the output is decided when merging
+        if (shard.enabled() && (output_format != "text"
+            || output_options.compress_level > 0 || output_options.top_k > 0
+            || output_options.stream_rows > 0 || vm.count("sparse") || vm.count("half-precision")
+            || vm.count("cluster"))) {
+            std::cerr << "error: Output options are given to merge when sharding" << std::endl;
+            error = true;
+        }
+
+        // clusters are found over every pair of the triangle, a shard clusters
+        // when merging
+        if (!valid_cluster_options(vm, cluster_method, output_options)) {
+            error = true;
+        }
+        if (output_options.cluster != CLUSTER_NONE
+            && (shard.enabled() || serve_queries || !query_input.empty() || !reference_input.empty() || band > 0)) {
+            std::cerr << "error: Cannot cluster a shard, queries, references or a band" << std::endl;
+            error = true;
+        }
+        if (vm.count("cluster-threshold") && measures.size() > 1) {
+            std::cerr << "error: Cannot give a cluster threshold for several measures" << std::endl;
+            error = true;
+        }
+
+        // every row must be known to expand duplicates or store pairs
+        if (shard.enabled() && (vm.count("deduplicate") || !pair_cache.empty())) {
+            std::cerr << "error: Cannot combine shard or rows with deduplicate or pair-cache" << std::endl;
+            error = true;
+        }
+
+        // copies are filled in from a whole triangle once every row is
+        // complete, the output options that bound memory would not hold it
+        if (vm.count("deduplicate") && (output_options.top_k > 0 || output_options.stream_rows > 0
+            || vm.count("sparse") || vm.count("half-precision"))) {
+            std::cerr << "error: Cannot combine deduplicate with top-k, stream, sparse or half-precision" << std::endl;
+            error = true;
+        }
+
+        // a pair cache holds the whole triangle of this run and the last, the
+        // output options that bound memory would not
+        if (!pair_cache.empty() && (output_options.top_k > 0 || output_options.stream_rows > 0
+            || vm.count("sparse") || vm.count("half-precision"))) {
+            std::cerr << "error: Cannot combine pair-cache with top-k, stream, sparse or half-precision" << std::endl;
             error = true;
         }
 
@@ -588,6 +874,74 @@ int main(int argc, char const *argv[]) {
             error = true;
         }
 
+        if (num_processes < 1) {
+            std::cerr << "error: Must use at least 1 process" << std::endl;
+            error = true;
+        }
+
+        // workers are configured for a single measure and compute every pair
+        if (serve && socket_path.empty()) {
+            std::cerr << "error: Must give a socket to serve work on" << std::endl;
+            error = true;
+        }
+        if (serve && (measures.size() > 1 || !pair_cache.empty() || num_processes > 1)) {
+            std::cerr << "error: Cannot serve work for several measures, or with pair-cache or processes" << std::endl;
+            error = true;
+        }
+
+        // queries are answered with one measure at one epsilon
+        if (serve_queries && socket_path.empty()) {
+            std::cerr << "error: Must give a socket to serve queries on" << std::endl;
+            error = true;
+        }
+        if (serve_queries && (measures.size() > 1 || epsilons.size() > 1
+            || min_nearness > 0 || vm.count("max-distance"))) {
+            std::cerr << "error: Cannot serve queries for several measures or epsilons, or with thresholds" << std::endl;
+            error = true;
+        }
+
+        // ensure valid thresholds were given, the pairs kept are not stored by
+        // caches or checkpoints
+        if (!(0 <= min_nearness && min_nearness <= 1) || !(max_distance >= 0)) {
+            std::cerr << "error: Must specify a min-nearness in [0, 1] and a max-distance of at least 0" << std::endl;
+            error = true;
+        }
+        if ((min_nearness > 0 || vm.count("max-distance"))
+            && (!pair_cache.empty() || vm.count("checkpoint") || vm.count("resume"))) {
+            std::cerr << "error: Cannot combine min-nearness or max-distance with pair-cache or checkpoints" << std::endl;
+            error = true;
+        }
+
+        // a sweep carries cliques from one epsilon to the next so can not skip any
+        if (min_nearness > 0 && epsilons.size() > 1) {
+            std::cerr << "error: Cannot combine min-nearness with several epsilons" << std::endl;
+            error = true;
+        }
+
+        // the rectangle is computed in memory by threads at one epsilon
+        if (rectangle && (epsilons.size() > 1 || shard.enabled() || grid_dims > 0
+            || vm.count("deduplicate") || !pair_cache.empty() || vm.count("checkpoint") || vm.count("resume")
+            || output_options.top_k > 0 || output_options.stream_rows > 0
+            || vm.count("sparse") || vm.count("half-precision")
+            || num_processes > 1 || serve || serve_queries)) {
+            std::cerr << "error: Queries and references only support a single epsilon with the output format, compress, cache, spatial-index and threads options" << std::endl;
+            error = true;
+        }
+
+        // the band is computed in memory by threads at one epsilon
+        if (vm.count("band") && band == 0) {
+            std::cerr << "error: Must specify a band of at least 1" << std::endl;
+            error = true;
+        }
+        if (band > 0 && (rectangle || epsilons.size() > 1 || shard.enabled() || grid_dims > 0
+            || vm.count("deduplicate") || !pair_cache.empty() || vm.count("checkpoint") || vm.count("resume")
+            || output_options.top_k > 0 || output_options.stream_rows > 0
+            || vm.count("sparse") || vm.count("half-precision")
+            || num_processes > 1 || serve || serve_queries)) {
+            std::cerr << "error: A band only supports a single epsilon with the output format, compress, cache, spatial-index, threads and threshold options" << std::endl;
+            error = true;
+        }
+
         // exit if an error occurred
         if (error) {
             std::cout << desc << std::endl;
@@ -598,6 +952,34 @@ int main(int argc, char const *argv[]) {
         if (vm.count("singletons")) {
             singletons = true;
         }
+
+        // read sparse value
+        if (vm.count("sparse")) {
+            output_options.sparse = true;
+        }
+
+        // read checkpoint values
+        if (vm.count("checkpoint") || vm.count("resume")) {
+            checkpoint = true;
+        }
+        if (vm.count("resume")) {
+            resume = true;
+        }
+
+        // read deduplicate value
+        if (vm.count("deduplicate")) {
+            deduplicate = true;
+        }
+
+        // read spatial index value
+        if (vm.count("spatial-index")) {
+            spatial_index = true;
+        }
+
+        // read half precision value
+        if (vm.count("half-precision")) {
+            output_options.half = true;
+        }
     }
     catch(std::exception& e) {
         std::cerr << "error: " << e.what() << std::endl;
@@ -609,24 +991,121 @@ int main(int argc, char const *argv[]) {
     }
 
     // debug info
-    d_var(epsilon);
+    d_var(epsilon_list);
     d_var(num_features);
     d_var(output);
     d_var(num_threads);
+    d_var(num_processes);
     d_var(distance_measure);
 
-    // run
-    if (distance_measure == "mce") {
-        run_mce(input, output, epsilon, num_features, singletons, num_threads);
+    // every measure shares the objects and their neighbourhoods
+    GraphCache *cache = NULL;
+    if (!cache_dir.empty()) {
+        cache = new GraphCache(cache_dir);
     }
-    else if (distance_measure == "sgmd") {
-        run_sgmd(input, output, epsilon, num_features, num_threads);        
+
+    NearnessEngine engine(num_features, epsilons[0], measures[0]);
+    engine.set_epsilons(epsilons);
+    engine.set_singletons(singletons);
+    engine.set_threads(std::max(num_threads, 1));
+    engine.set_min_nearness(min_nearness);
+    engine.set_max_distance(max_distance);
+    engine.set_spatial_index(spatial_index);
+    engine.set_graph_cache(cache);
+
+    std::string error;
+
+    // only the pairs of a query and a reference
+    if (!query_input.empty()) {
+        NearnessEngine references(num_features, epsilons[0]);
+        references.set_spatial_index(spatial_index);
+        references.set_graph_cache(cache);
+        bool read = engine.read(query_input, error) && engine.prepare(error)
+            && references.read(reference_input, error) && references.prepare(error);
+        delete cache;
+        if (!read) {
+            std::cerr << "error: " << error << std::endl;
+            return 1;
+        }
+
+        for (unsigned int m = 0; m < measures.size(); ++m) {
+            engine.set_measure(measures[m]);
+            if (!engine.write_rectangle(references, outputs[m][0], output_options, error)) {
+                std::cerr << "error: " << error << std::endl;
+                return 1;
+            }
+        }
+        return 0;
     }
-    else {
-        std::cerr << "error: Must specify a valid distance measure" << std::endl;
-        std::cout << desc << std::endl;
+
+    engine.set_deduplicate(deduplicate);
+    bool read = engine.read(input, error) && engine.prepare(error);
+    delete cache;
+    if (!read) {
+        std::cerr << "error: " << error << std::endl;
         return 1;
     }
 
+    // only the pairs of nearby objects
+    if (band > 0) {
+        for (unsigned int m = 0; m < measures.size(); ++m) {
+            engine.set_measure(measures[m]);
+            if (!engine.write_band(outputs[m][0], output_options, band, error)) {
+                std::cerr << "error: " << error << std::endl;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    // answer queries until stopped
+    if (serve_queries) {
+        QueryServer query_server(socket_path);
+        if (!query_server.listening()) {
+            return 1;
+        }
+
+        d("Serve Queries");
+        query_server.serve(boost::bind(&NearnessEngine::query,
+            boost::ref(engine), _1, _2, _3, _4));
+        // the socket failed, but clients already accepted are still answered
+        // from the engine on detached threads, so leave without destroying it
+        std::cout.flush();
+        std::cerr.flush();
+        _exit(1);
+    }
+
+    WorkServer *server = NULL;
+    if (serve) {
+        server = new WorkServer(socket_path,
+            work_config(measures[0], epsilon_list, num_features, singletons, grid_dims,
+                min_nearness, max_distance, spatial_index, cache_dir, deduplicate, input),
+            corpus_fingerprint(engine.objects()));
+        if (!server->listening()) {
+            delete server;
+            return 1;
+        }
+    }
+
+    // run
+    WriteOptions write_options;
+    write_options.output = output_options;
+    write_options.num_processes = num_processes;
+    write_options.grid_dims = grid_dims;
+    write_options.pair_cache = pair_cache;
+    write_options.checkpoint = checkpoint;
+    write_options.resume = resume;
+    write_options.shard = shard;
+    write_options.server = server;
+    for (unsigned int m = 0; m < measures.size(); ++m) {
+        engine.set_measure(measures[m]);
+        if (!engine.write(outputs[m], write_options, error)) {
+            std::cerr << "error: " << error << std::endl;
+            delete server;
+            return 1;
+        }
+    }
+
+    delete server;
     return 0;
 }
\ No newline at end of file
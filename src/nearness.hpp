@@ -0,0 +1,3205 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef NEARNESS_LIBRARY
+#define NEARNESS_LIBRARY
+
+/*
+ * The nearness library. Everything the command line tool computes is built
+ * from the functions here, programs that embed nearness include this header
+ * and use nearness::NearnessEngine. Everything is in namespace nearness.
+ * Define DEBUG before including it to print the progress of each step, the
+ * debug macros themselves end with this header.
+ */
+
+#include <boost/thread/mutex.hpp>
+#include "boost/threadpool.hpp"
+
+#include <boost/filesystem.hpp>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <limits>
+
+#include "maximal_clique_basic_includes.hpp"
+
+#include "convert_features.hpp"
+#include "recursive.hpp"
+#include "results.hpp"
+#include "output.hpp"
+#include "grid_index.hpp"
+#include "degree_index.hpp"
+#include "graph_cache.hpp"
+#include "pair_cache.hpp"
+#include "checkpoint.hpp"
+#include "shard.hpp"
+#include "workers.hpp"
+#include "work_server.hpp"
+#include "query_server.hpp"
+
+#include "alphanum.hpp"
+#include "libhungarian_c/hungarian.h"
+
+namespace nearness {
+
+typedef std::vector<float> Object;
+
+const std::string VERSION = "1.1";
+
+/**
+ * Simple adapter from boost::filesystem::path to std::string to sort files in
+ * a nautral order.
+ * eg. file1.txt, file2.txt, file10.txt
+ * @param  p1 [First path object]
+ * @param  p2 [Second path object]
+ * @return    [p1 < p2]
+ */
+inline bool alphanum(const boost::filesystem::path &p1, const boost::filesystem::path &p2) {
+    return doj::alphanum_comp(p1.string(), p2.string()) < 0;
+}
+
+/**
+ * Recursively reads files and directories of files containing one feature value
+ * per line.
+ * @param  p       [The path of the file to load]
+ * @param  objects [The two-dimensional vector of feature values to write to]
+ * @param  error   [Set to why the path could not be read]
+ * @return         [False if the path or any file under it could not be read]
+ */
+inline bool read_file(
+    const boost::filesystem::path &p,
+    std::vector<Object> &objects,
+    std::string &error) {
+
+    namespace fs = boost::filesystem;
+
+    if (fs::is_regular_file(p)) {
+        Object obj;
+        if (!read_features_fast(p.string(), obj)) {
+            error = "'" + p.string() + "' could not be opened";
+            return false;
+        }
+        objects.push_back(obj);
+    }
+    else if (fs::is_directory(p)) {
+        typedef std::vector<fs::path> vec;
+        vec v;
+        copy(fs::directory_iterator(p), fs::directory_iterator(), back_inserter(v));
+        sort(v.begin(), v.end(), alphanum);
+        for (vec::const_iterator it(v.begin()), it_end(v.end()); it != it_end; ++it) {
+            if (!read_file(*it, objects, error)) return false;
+        }
+    }
+    else {
+        error = "'" + p.string() + "' is neither a regular file nor a directory";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reads all given files recursively for feature values.
+ * @param  input   [The vector of input file names]
+ * @param  objects [The two-dimensional vector of feature values to write to]
+ * @param  error   [Set to why an input could not be read]
+ * @return         [False if any input could not be read]
+ */
+inline bool read_objects(
+    const std::vector<std::string> &input,
+    std::vector<Object> &objects,
+    std::string &error) {
+
+    namespace fs = boost::filesystem;
+
+    for (unsigned int i = 0; i < input.size(); ++i) {
+        const fs::path p(input[i]);
+
+        try {
+            if (!fs::exists(p)) {
+                error = "'" + p.string() + "' file does not exist";
+                return false;
+            }
+            if (!read_file(p, objects, error)) return false;
+        }
+        catch (const fs::filesystem_error& ex) {
+            error = ex.what();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * The objects being compared along with everything precomputed from them
+ * before any pair is compared.
+ */
+struct Corpus {
+    // the feature values of each object
+    std::vector<Object> objects;
+
+    // the hash of the feature values of each object
+    std::vector<uint64_t> hashes;
+
+    // the unique object of each object read, empty when duplicates are kept
+    std::vector<unsigned int> representatives;
+
+    // the neighbourhood graph within each object
+    std::vector<std::vector<IdSet> > partial_graphs;
+
+    // the degree of each vertex of each partial graph
+    std::vector<std::vector<int> > degrees;
+
+    // the spatial index of each object, empty when not used
+    std::vector<ProjectionIndex> indices;
+
+    // the edges within each object sorted by length, only used when sweeping
+    // several epsilons
+    std::vector<std::vector<Edge> > edges;
+
+    /**
+     * The number of objects.
+     */
+    unsigned int size() const {
+        return objects.size();
+    }
+
+    /**
+     * The number of objects read, including duplicates.
+     */
+    unsigned int num_read() const {
+        return representatives.empty() ? objects.size() : representatives.size();
+    }
+};
+
+/**
+ * Keep only the first copy of each object with the same feature values,
+ * recording the unique object of every object read.
+ * @param corpus [The corpus, with objects read and hashed]
+ */
+inline void remove_duplicates(Corpus &corpus) {
+    std::vector<Object> objects;
+    std::vector<uint64_t> hashes;
+    std::vector<unsigned int> &representatives = corpus.representatives;
+    representatives.resize(corpus.size());
+
+    // the unique objects with each hash, compared in full in case of collision
+    boost::unordered_map<uint64_t, std::vector<unsigned int> > seen;
+
+    for (unsigned int i = 0; i < corpus.size(); ++i) {
+        std::vector<unsigned int> &same_hash = seen[corpus.hashes[i]];
+        unsigned int u = 0;
+        while (u < same_hash.size() && objects[same_hash[u]] != corpus.objects[i]) ++u;
+
+        if (u < same_hash.size()) {
+            representatives[i] = same_hash[u];
+        }
+        else {
+            representatives[i] = objects.size();
+            same_hash.push_back(objects.size());
+            objects.push_back(Object());
+            objects.back().swap(corpus.objects[i]);
+            hashes.push_back(corpus.hashes[i]);
+        }
+    }
+
+    corpus.objects.swap(objects);
+    corpus.hashes.swap(hashes);
+}
+
+/**
+ * Calculate the partial graph and degrees of every object, optionally building
+ * a spatial index of each first and using it to find the neighbours within
+ * the object. Graphs found in the cache are loaded instead of calculated, the
+ * rest are added to it.
+ * @param corpus        [The corpus, with objects already read]
+ * @param epsilon       [The epsilon value used to find the neighborhoods]
+ * @param num_features  [The number of features per object]
+ * @param spatial_index [Whether to build and use spatial indices]
+ * @param cache         [The cache of partial graphs, or NULL to not cache]
+ */
+inline void build_partial_graphs(
+    Corpus &corpus,
+    const float epsilon,
+    const unsigned int num_features,
+    const bool spatial_index,
+    const GraphCache *cache) {
+
+    corpus.partial_graphs.assign(corpus.size(), std::vector<IdSet>());
+    corpus.degrees.assign(corpus.size(), std::vector<int>());
+    corpus.indices.clear();
+
+    if (spatial_index) {
+        corpus.indices.reserve(corpus.size());
+    }
+
+    unsigned int hits = 0;
+    for (unsigned int i = 0; i < corpus.size(); ++i) {
+        // the index is still needed to find neighbours between objects
+        if (spatial_index) {
+            corpus.indices.push_back(ProjectionIndex(corpus.objects[i], num_features));
+        }
+
+        std::vector<IdSet> &graph = corpus.partial_graphs[i];
+        std::vector<int> &degrees = corpus.degrees[i];
+        if (cache != NULL && cache->load(corpus.objects[i], epsilon, num_features, graph, degrees)) {
+            ++hits;
+            continue;
+        }
+
+        if (spatial_index) {
+            features_to_graph(corpus.objects[i], corpus.indices[i], graph, epsilon, num_features);
+        }
+        else {
+            features_to_graph(corpus.objects[i], graph, epsilon, num_features);
+        }
+
+        degrees.resize(graph.size());
+        for (unsigned int v = 0; v < graph.size(); ++v) {
+            degrees[v] = graph[v].count();
+        }
+
+        if (cache != NULL) {
+            cache->store(corpus.objects[i], epsilon, num_features, graph, degrees);
+        }
+    }
+    d_var(hits);
+}
+
+/**
+ * Find the edges within every object up to the largest epsilon of a sweep,
+ * optionally building a spatial index of each first. The indices are kept to
+ * find the edges between objects.
+ * @param corpus        [The corpus, with objects already read]
+ * @param epsilon       [The largest epsilon of the sweep]
+ * @param num_features  [The number of features per object]
+ * @param spatial_index [Whether to build and use spatial indices]
+ */
+inline void build_edges(
+    Corpus &corpus,
+    const float epsilon,
+    const unsigned int num_features,
+    const bool spatial_index) {
+
+    corpus.edges.assign(corpus.size(), std::vector<Edge>());
+    corpus.indices.clear();
+
+    if (spatial_index) {
+        corpus.indices.reserve(corpus.size());
+    }
+    for (unsigned int i = 0; i < corpus.size(); ++i) {
+        if (spatial_index) {
+            corpus.indices.push_back(ProjectionIndex(corpus.objects[i], num_features));
+        }
+        features_to_edges(corpus.objects[i],
+            spatial_index ? &corpus.indices[i] : NULL,
+            corpus.edges[i], epsilon, num_features);
+    }
+}
+
+/**
+ * The degree of each vertex of each partial graph at one epsilon of a sweep,
+ * counted from the sorted edges.
+ * @param corpus       [The corpus, with edges already found]
+ * @param epsilon      [The epsilon to count edges shorter than]
+ * @param num_features [The number of features per object]
+ * @param subset_sizes [The degrees to write to]
+ */
+inline void count_subset_sizes(
+    Corpus &corpus,
+    const float epsilon,
+    const unsigned int num_features,
+    std::vector<std::vector<int> > &subset_sizes) {
+
+    float sqr_epsilon = epsilon * epsilon;
+    subset_sizes.assign(corpus.size(), std::vector<int>());
+    for (unsigned int i = 0; i < corpus.size(); ++i) {
+        subset_sizes[i].assign(corpus.objects[i].size() / num_features, 0);
+        std::vector<Edge> &edges = corpus.edges[i];
+        for (unsigned int e = 0; e < edges.size() && edges[e].sqr_distance < sqr_epsilon; ++e) {
+            ++subset_sizes[i][edges[e].a];
+            ++subset_sizes[i][edges[e].b];
+        }
+    }
+}
+
+/**
+ * Build the neighbourhoods within each object of a corpus, shared by every
+ * measure of a run.
+ * @param corpus        [The corpus, with objects read]
+ * @param epsilons      [The epsilons of the run in increasing order]
+ * @param num_features  [The number of features per object]
+ * @param spatial_index [Whether to build and use spatial indices]
+ * @param cache         [The cache of partial graphs, or NULL to not cache]
+ * @param deduplicate   [Whether to only compare one copy of each object]
+ */
+inline void prepare_objects(
+    Corpus &corpus,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool spatial_index,
+    const GraphCache *cache,
+    const bool deduplicate) {
+
+    corpus.hashes.resize(corpus.size());
+    for (unsigned int i = 0; i < corpus.size(); ++i) {
+        const Object &object = corpus.objects[i];
+        corpus.hashes[i] = object.empty() ? fnv1a(NULL, 0)
+            : fnv1a(&object.front(), object.size() * sizeof(float));
+    }
+
+    if (deduplicate) {
+        d("Remove Duplicates");
+        remove_duplicates(corpus);
+        d_var(corpus.size());
+    }
+
+    // a sweep keeps the sorted edges so each epsilon can be derived from them
+    if (epsilons.size() > 1) {
+        d("Calculate Sorted Edges");
+        build_edges(corpus, epsilons.back(), num_features, spatial_index);
+    }
+    else {
+        d("Calculate Partial Graphs");
+        build_partial_graphs(corpus, epsilons.back(), num_features, spatial_index, cache);
+    }
+}
+
+/**
+ * Read the objects and build the neighbourhoods within each of them, shared
+ * by every measure of a run.
+ * @param input         [Vector of input files and directories]
+ * @param corpus        [The corpus to fill]
+ * @param epsilons      [The epsilons of the run in increasing order]
+ * @param num_features  [The number of features per object]
+ * @param spatial_index [Whether to build and use spatial indices]
+ * @param cache         [The cache of partial graphs, or NULL to not cache]
+ * @param deduplicate   [Whether to only compare one copy of each object]
+ * @return              [False if the input could not be read, after writing
+ *                      why to stderr]
+ */
+inline bool prepare_corpus(
+    const std::vector<std::string> &input,
+    Corpus &corpus,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool spatial_index,
+    const GraphCache *cache,
+    const bool deduplicate) {
+
+    d("Read Objects");
+    std::string error;
+    if (!read_objects(input, corpus.objects, error)) {
+        std::cerr << "error: " << error << std::endl;
+        return false;
+    }
+    for (unsigned int i = 0; i < corpus.objects.size(); ++i) {
+        if (corpus.objects[i].size() % num_features != 0) {
+            std::cerr << "error: object " << i << " has " << corpus.objects[i].size()
+                      << " values, not a multiple of " << num_features << " features" << std::endl;
+            return false;
+        }
+    }
+    d_var(corpus.size());
+
+    prepare_objects(corpus, epsilons, num_features, spatial_index, cache, deduplicate);
+    return true;
+}
+
+/**
+ * A fingerprint of the objects of a prepared corpus, the same for every
+ * process that reads the same input with the same settings.
+ * @param  corpus [The prepared corpus]
+ * @return        [The fingerprint]
+ */
+inline uint64_t corpus_fingerprint(const Corpus &corpus) {
+    unsigned int num_read = corpus.num_read();
+    uint64_t h = fnv1a(&num_read, sizeof num_read);
+    if (!corpus.hashes.empty()) {
+        h = fnv1a(&corpus.hashes.front(), corpus.hashes.size() * sizeof(uint64_t), h);
+    }
+    return h;
+}
+
+/**
+ * Write progress bar to the console.
+ * @param x [The current progress]
+ * @param n [The maximum progress]
+ * @param w [The width of the progress bar]
+ */
+static inline void loadbar(
+    unsigned int x,
+    unsigned int n,
+    unsigned int w = 50) {
+
+    float ratio = x/(float)n;
+    unsigned int c = ratio * w;
+
+    std::cerr << std::setw(5) << std::setprecision(2) << (ratio*100) << "% [";
+    for (unsigned int i=0; i<c; ++i) std::cerr << "=";
+    for (unsigned int i=c; i<w; ++i) std::cerr << " ";
+    std::cerr << "]";
+
+    // if finished move to next line
+    if (x != n)
+        std::cerr << '\r' << std::flush;
+    else
+        std::cerr << std::endl;
+}
+
+/**
+ * Progress through the comparisons, reported to the console as tasks
+ * complete.
+ */
+struct Progress {
+    // the total number of comparisons to be computed
+    unsigned int total;
+
+    // the number of completed comparisons
+    unsigned int current;
+
+    // where completed comparisons are counted, current unless shared with
+    // worker processes
+    unsigned int *count;
+
+    // held while counting and drawing
+    boost::mutex mutex;
+
+    // a total of 0 counts without drawing, for workers
+    Progress(const unsigned int total) : total(total), current(0), count(&current) {}
+
+    /**
+     * Count completed comparisons in memory shared with worker processes.
+     * @param shared [The shared count, starting from the current count]
+     */
+    void share(unsigned int *shared) {
+        *shared = *count;
+        count = shared;
+    }
+
+    /**
+     * Record completed comparisons and redraw the progress bar.
+     * @param n [The number of comparisons completed]
+     */
+    void advance(const unsigned int n) {
+        boost::mutex::scoped_lock lock(mutex);
+        unsigned int completed = __sync_add_and_fetch(count, n);
+        if (total > 0) loadbar(completed, total);
+    }
+};
+
+/**
+ * Settings for how results are stored and written.
+ */
+struct OutputOptions {
+    // the format to write results in
+    OutputFormat format;
+
+    // whether to store results in memory as half precision floats
+    bool half;
+
+    // whether to store and write only the pairs with a non-zero nearness
+    bool sparse;
+
+    // when greater than 0 results are streamed to the output as they are
+    // completed, buffering at most this many rows
+    unsigned int stream_rows;
+
+    // the zlib level to compress the output with, 0 to not compress
+    int compress_level;
+
+    // when greater than 0 only this many nearest objects to each object are
+    // kept and written
+    unsigned int top_k;
+
+    // when set objects are clustered as rows complete and only the clusters
+    // are written, joined by pairs at least as near as the threshold, or by
+    // every pair whose objects meet when it is NaN
+    ClusterMethod cluster;
+    float cluster_threshold;
+
+    OutputOptions() :
+        format(OUTPUT_TEXT), half(false), sparse(false),
+        stream_rows(0), compress_level(0), top_k(0),
+        cluster(CLUSTER_NONE), cluster_threshold(std::numeric_limits<float>::quiet_NaN()) {}
+};
+
+/**
+ * Create where completed rows will be sent, either a dense or sparse triangle
+ * or the nearest objects held in memory until every task is complete, a
+ * writer streaming rows to the output, or the clusters of the objects.
+ * @param  output           [The name of the output file]
+ * @param  options          [How results are stored and written]
+ * @param  num_objects      [The number of objects]
+ * @param  larger_is_nearer [Whether larger values are nearer for the measure]
+ * @return                  [The new sink]
+ */
+inline ResultSink *create_results(
+    const std::string &output,
+    const OutputOptions &options,
+    const unsigned int num_objects,
+    const bool larger_is_nearer) {
+
+    if (options.cluster != CLUSTER_NONE) {
+        return new ClusterResults(num_objects, options.cluster, larger_is_nearer,
+            options.cluster_threshold);
+    }
+    if (options.top_k > 0) {
+        return new TopKResults(num_objects, options.top_k, larger_is_nearer);
+    }
+    if (options.stream_rows > 0) {
+        return new StreamingWriter(output, options.format, num_objects,
+            options.stream_rows, options.sparse, options.compress_level);
+    }
+    if (options.sparse) {
+        return new SparseResults(num_objects);
+    }
+    return new TriangleResults(num_objects, options.half);
+}
+
+/**
+ * Write any results still held in memory once every task is complete.
+ * @param output      [The name of the output file]
+ * @param results     [The sink created by create_results]
+ * @param options     [How results are stored and written]
+ * @param num_threads [The number of threads to format output with]
+ */
+inline void finish_results(
+    std::string &output,
+    ResultSink *results,
+    const OutputOptions &options,
+    const unsigned int num_threads) {
+
+    if (options.cluster != CLUSTER_NONE) {
+        output_results(output, *static_cast<ClusterResults *>(results),
+            options.format, options.compress_level);
+    }
+    else if (options.top_k > 0) {
+        TopKResults *top_k = static_cast<TopKResults *>(results);
+        top_k->merge();
+        output_results(output, *top_k, options.format, num_threads, options.compress_level);
+    }
+    else if (options.stream_rows > 0) {
+        static_cast<StreamingWriter *>(results)->finish();
+    }
+    else if (options.sparse) {
+        output_results(output, *static_cast<SparseResults *>(results),
+            options.format, num_threads, options.compress_level);
+    }
+    else {
+        output_results(output, *static_cast<TriangleResults *>(results),
+            options.format, num_threads, options.compress_level);
+    }
+}
+
+/**
+ * Create a sink for each output of a run.
+ * @param  outputs          [The name of each output file]
+ * @param  options          [How results are stored and written]
+ * @param  num_objects      [The number of objects]
+ * @param  larger_is_nearer [Whether larger values are nearer for the measure]
+ * @return                  [The new sinks]
+ */
+inline std::vector<ResultSink *> create_results(
+    const std::vector<std::string> &outputs,
+    const OutputOptions &options,
+    const unsigned int num_objects,
+    const bool larger_is_nearer) {
+
+    std::vector<ResultSink *> results;
+    for (unsigned int k = 0; k < outputs.size(); ++k) {
+        results.push_back(create_results(outputs[k], options, num_objects, larger_is_nearer));
+    }
+    return results;
+}
+
+/**
+ * Write and free the sink of each output of a run.
+ * @param outputs     [The name of each output file]
+ * @param results     [The sinks created by create_results]
+ * @param options     [How results are stored and written]
+ * @param num_threads [The number of threads to format output with]
+ */
+inline void finish_results(
+    std::vector<std::string> &outputs,
+    std::vector<ResultSink *> &results,
+    const OutputOptions &options,
+    const unsigned int num_threads) {
+
+    for (unsigned int k = 0; k < results.size(); ++k) {
+        finish_results(outputs[k], results[k], options, num_threads);
+        delete results[k];
+    }
+    results.clear();
+}
+
+/**
+ * Describes everything besides the objects that the results of a measure
+ * depend on.
+ * @param  measure      [The name of the measure]
+ * @param  epsilon      [The epsilon used to find the neighbourhoods]
+ * @param  num_features [The number of features per object]
+ * @param  singletons   [Whether singletons are included in the results]
+ * @return              [The description]
+ */
+inline std::string run_parameters(
+    const std::string &measure,
+    const float epsilon,
+    const unsigned int num_features,
+    const bool singletons) {
+
+    uint32_t epsilon_bits;
+    std::memcpy(&epsilon_bits, &epsilon, sizeof epsilon_bits);
+    char parameters[128];
+    std::sprintf(parameters, "%s epsilon=%08x features=%u singletons=%d",
+        measure.c_str(), epsilon_bits, num_features, (int)singletons);
+    return parameters;
+}
+
+/**
+ * When the corpus has had duplicates removed put a sink in front of each
+ * output that expands the rows of the unique objects to every object.
+ * @param  corpus      [The objects, prepared by prepare_corpus]
+ * @param  self_values [The nearness of each unique object to a copy of
+ *                     itself]
+ * @param  results     [The sink of each output, replaced by the expanding
+ *                     sink]
+ * @return             [The expanding sink of each output, empty if not
+ *                     deduplicating]
+ */
+inline std::vector<DuplicateResults *> create_duplicate_results(
+    const Corpus &corpus,
+    const std::vector<float> &self_values,
+    std::vector<ResultSink *> &results) {
+
+    std::vector<DuplicateResults *> duplicates;
+    if (corpus.representatives.empty()) return duplicates;
+
+    for (unsigned int k = 0; k < results.size(); ++k) {
+        duplicates.push_back(new DuplicateResults(corpus.representatives, self_values, results[k]));
+        results[k] = duplicates.back();
+    }
+    return duplicates;
+}
+
+/**
+ * Expand the rows of each output to every object and restore the sinks they
+ * were in front of.
+ * @param duplicates [The sinks created by create_duplicate_results]
+ * @param results    [The sink of each output]
+ */
+inline void finish_duplicate_results(
+    std::vector<DuplicateResults *> &duplicates,
+    std::vector<ResultSink *> &results) {
+
+    for (unsigned int k = 0; k < duplicates.size(); ++k) {
+        duplicates[k]->expand();
+        results[k] = duplicates[k]->sink();
+        delete duplicates[k];
+    }
+    duplicates.clear();
+}
+
+/**
+ * Put a pair cache in front of the sink of each output, so pairs computed by
+ * an earlier run are looked up instead.
+ * @param  directory    [The directory of the pair caches, empty to not cache]
+ * @param  measure      [The name of the measure]
+ * @param  corpus       [The objects, prepared by prepare_corpus]
+ * @param  epsilons     [The epsilon of each output]
+ * @param  num_features [The number of features per object]
+ * @param  singletons   [Whether singletons are included in the results]
+ * @param  results      [The sink of each output, replaced by its cache]
+ * @return              [The cache of each output, empty if not caching]
+ */
+inline std::vector<PairCache *> create_pair_caches(
+    const std::string &directory,
+    const std::string &measure,
+    const Corpus &corpus,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool singletons,
+    std::vector<ResultSink *> &results) {
+
+    std::vector<PairCache *> caches;
+    if (directory.empty()) return caches;
+
+    for (unsigned int k = 0; k < results.size(); ++k) {
+        std::string parameters = run_parameters(measure, epsilons[k], num_features, singletons);
+        caches.push_back(new PairCache(directory, parameters, corpus.hashes,
+            measure == "sgmd", results[k]));
+        results[k] = caches.back();
+        d_var(caches.back()->known());
+    }
+    return caches;
+}
+
+/**
+ * Store the results of each pair cache and restore the sinks they were in
+ * front of.
+ * @param caches  [The caches created by create_pair_caches]
+ * @param results [The sink of each output]
+ */
+inline void finish_pair_caches(
+    std::vector<PairCache *> &caches,
+    std::vector<ResultSink *> &results) {
+
+    for (unsigned int k = 0; k < caches.size(); ++k) {
+        caches[k]->save();
+        results[k] = caches[k]->sink();
+        delete caches[k];
+    }
+    caches.clear();
+}
+
+/**
+ * Estimate the cost of each row of a measure from the number of objects in
+ * each object, used to balance shards. Comparing two objects for mce costs
+ * roughly the product of their sizes in distances, sgmd solves an assignment
+ * problem cubic in the larger of the two.
+ * @param  corpus       [The objects, prepared by prepare_corpus]
+ * @param  num_features [The number of features per object]
+ * @param  measure      [The name of the measure]
+ * @return              [The estimated cost of each row]
+ */
+inline std::vector<double> estimate_row_costs(
+    const Corpus &corpus,
+    const unsigned int num_features,
+    const std::string &measure) {
+
+    unsigned int n = corpus.size();
+    std::vector<double> sizes(n);
+    for (unsigned int i = 0; i < n; ++i) {
+        sizes[i] = corpus.objects[i].size() / num_features;
+    }
+
+    std::vector<double> costs(n, 0);
+    if (measure == "mce") {
+        double later = 0;
+        for (unsigned int i = n; i-- > 0;) {
+            costs[i] = sizes[i] * later;
+            later += sizes[i];
+        }
+    }
+    else {
+        for (unsigned int i = 0; i < n; ++i) {
+            for (unsigned int j = i + 1; j < n; ++j) {
+                double size = std::max(sizes[i], sizes[j]);
+                costs[i] += size * size * size;
+            }
+        }
+    }
+    return costs;
+}
+
+/**
+ * Create a sink for each output of a shard, holding only its rows.
+ * @param  num_objects  [The number of objects]
+ * @param  first        [The first row of the shard]
+ * @param  last         [One past the last row of the shard]
+ * @param  measure      [The name of the measure]
+ * @param  epsilons     [The epsilon of each output]
+ * @param  num_features [The number of features per object]
+ * @param  singletons   [Whether singletons are included in the results]
+ * @return              [The new sinks]
+ */
+inline std::vector<ResultSink *> create_partial_results(
+    const unsigned int num_objects,
+    const unsigned int first,
+    const unsigned int last,
+    const std::string &measure,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool singletons) {
+
+    std::vector<ResultSink *> results;
+    for (unsigned int k = 0; k < epsilons.size(); ++k) {
+        results.push_back(new PartialResults(num_objects,
+            partial_header(first, last, measure, epsilons[k], num_features, singletons)));
+    }
+    return results;
+}
+
+/**
+ * Write and free the partial results of each output of a shard.
+ * @param outputs [The name of each output file]
+ * @param results [The sinks created by create_partial_results]
+ */
+inline void finish_partial_results(
+    std::vector<std::string> &outputs,
+    std::vector<ResultSink *> &results) {
+
+    for (unsigned int k = 0; k < results.size(); ++k) {
+        static_cast<PartialResults *>(results[k])->write(outputs[k]);
+        delete results[k];
+    }
+    results.clear();
+}
+
+/**
+ * Put a checkpoint in front of the sink of each output, so completed rows
+ * survive the run being killed.
+ * @param  enabled      [Whether to checkpoint]
+ * @param  resume       [Whether to resume existing checkpoints]
+ * @param  outputs      [The name of each output file]
+ * @param  measure      [The name of the measure]
+ * @param  corpus       [The objects, prepared by prepare_corpus]
+ * @param  epsilons     [The epsilon of each output]
+ * @param  num_features [The number of features per object]
+ * @param  singletons   [Whether singletons are included in the results]
+ * @param  results      [The sink of each output, replaced by its checkpoint]
+ * @return              [The checkpoint of each output, empty if not
+ *                      checkpointing]
+ */
+inline std::vector<Checkpoint *> create_checkpoints(
+    const bool enabled,
+    const bool resume,
+    const std::vector<std::string> &outputs,
+    const std::string &measure,
+    const Corpus &corpus,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool singletons,
+    std::vector<ResultSink *> &results) {
+
+    std::vector<Checkpoint *> checkpoints;
+    if (!enabled) return checkpoints;
+
+    for (unsigned int k = 0; k < results.size(); ++k) {
+        std::stringstream manifest;
+        manifest << run_parameters(measure, epsilons[k], num_features, singletons) << std::endl;
+        manifest << "objects=" << corpus.num_read() << std::endl;
+        manifest << std::hex;
+        for (unsigned int i = 0; i < corpus.size(); ++i) {
+            manifest << corpus.hashes[i] << std::endl;
+        }
+
+        checkpoints.push_back(new Checkpoint(outputs[k], manifest.str(), corpus.size(), resume, results[k]));
+        results[k] = checkpoints.back();
+        d_var(checkpoints.back()->num_completed());
+    }
+    return checkpoints;
+}
+
+/**
+ * Pass on row i of every checkpoint if it was completed before the run was
+ * resumed.
+ * @param  checkpoints [The checkpoints created by create_checkpoints]
+ * @param  i           [The row]
+ * @return             [True if row i was completed for every output]
+ */
+inline bool restore_row(
+    std::vector<Checkpoint *> &checkpoints,
+    const unsigned int i) {
+
+    if (checkpoints.empty()) return false;
+    for (unsigned int k = 0; k < checkpoints.size(); ++k) {
+        if (!checkpoints[k]->completed(i)) return false;
+    }
+    for (unsigned int k = 0; k < checkpoints.size(); ++k) {
+        checkpoints[k]->restore(i);
+    }
+    return true;
+}
+
+/**
+ * Restore the sinks each checkpoint was in front of. The checkpoints are kept
+ * until the outputs are written.
+ * @param checkpoints [The checkpoints created by create_checkpoints]
+ * @param results     [The sink of each output]
+ */
+inline void finish_checkpoints(
+    std::vector<Checkpoint *> &checkpoints,
+    std::vector<ResultSink *> &results) {
+
+    for (unsigned int k = 0; k < checkpoints.size(); ++k) {
+        results[k] = checkpoints[k]->sink();
+    }
+}
+
+/**
+ * Remove each checkpoint once the outputs are written.
+ * @param checkpoints [The checkpoints created by create_checkpoints]
+ */
+inline void remove_checkpoints(std::vector<Checkpoint *> &checkpoints) {
+    for (unsigned int k = 0; k < checkpoints.size(); ++k) {
+        checkpoints[k]->remove();
+        delete checkpoints[k];
+    }
+    checkpoints.clear();
+}
+
+/**
+ * Create shared results for each output, for worker processes to send rows
+ * to.
+ * @param  num_outputs [The number of outputs]
+ * @param  num_objects [The number of objects]
+ * @param  first       [The first row computed]
+ * @param  last        [One past the last row computed]
+ * @return             [The new shared results]
+ */
+inline std::vector<SharedResults *> create_shared_results(
+    const unsigned int num_outputs,
+    const unsigned int num_objects,
+    const unsigned int first,
+    const unsigned int last) {
+
+    std::vector<SharedResults *> shared;
+    for (unsigned int k = 0; k < num_outputs; ++k) {
+        shared.push_back(new SharedResults(num_objects, first, last));
+    }
+    return shared;
+}
+
+/**
+ * Pass on row i of every output once a worker process has completed it, or
+ * restore it if it was completed before the run was resumed.
+ * @param i           [The row]
+ * @param shared      [The shared results workers send rows to]
+ * @param results     [The sink of each output]
+ * @param checkpoints [The checkpoints created by create_checkpoints]
+ * @param num_objects [The number of objects]
+ * @param progress    [The progress to report restored comparisons to]
+ */
+inline void collect_row(
+    const unsigned int i,
+    std::vector<SharedResults *> &shared,
+    std::vector<ResultSink *> &results,
+    std::vector<Checkpoint *> &checkpoints,
+    const unsigned int num_objects,
+    Progress &progress) {
+
+    if (restore_row(checkpoints, i)) {
+        progress.advance((num_objects - i) * results.size());
+        return;
+    }
+    for (unsigned int k = 0; k < shared.size(); ++k) {
+        shared[k]->forward(i, *results[k]);
+    }
+}
+
+/**
+ * Whether each row in [first, last) was completed for every output before the
+ * run was resumed.
+ * @param  checkpoints [The checkpoints created by create_checkpoints]
+ * @param  first       [The first row]
+ * @param  last        [One past the last row]
+ * @return             [Whether each row is complete, indexed from first]
+ */
+inline std::vector<bool> completed_rows(
+    const std::vector<Checkpoint *> &checkpoints,
+    const unsigned int first,
+    const unsigned int last) {
+
+    std::vector<bool> completed(last - first, !checkpoints.empty());
+    for (unsigned int k = 0; k < checkpoints.size(); ++k) {
+        for (unsigned int i = first; i < last; ++i) {
+            if (!checkpoints[k]->completed(i)) completed[i - first] = false;
+        }
+    }
+    return completed;
+}
+
+/**
+ * Pass on row i of every output once a worker has sent it, or restore it if it
+ * was completed before the run was resumed.
+ * @param i           [The row]
+ * @param rows        [The values of the row for each output, empty if
+ *                    restored]
+ * @param results     [The sink of each output]
+ * @param checkpoints [The checkpoints created by create_checkpoints]
+ * @param num_objects [The number of objects]
+ * @param progress    [The progress to report completed comparisons to]
+ */
+inline void collect_remote_row(
+    const unsigned int i,
+    std::vector<Result> &rows,
+    std::vector<ResultSink *> &results,
+    std::vector<Checkpoint *> &checkpoints,
+    const unsigned int num_objects,
+    Progress &progress) {
+
+    if (rows.empty()) {
+        restore_row(checkpoints, i);
+    }
+    for (unsigned int k = 0; k < rows.size(); ++k) {
+        results[k]->add_row(i, rows[k]);
+    }
+    progress.advance((num_objects - i) * results.size());
+}
+
+/**
+ * Free the shared results of each output.
+ * @param shared [The shared results created by create_shared_results]
+ */
+inline void free_shared_results(std::vector<SharedResults *> &shared) {
+    for (unsigned int k = 0; k < shared.size(); ++k) {
+        delete shared[k];
+    }
+    shared.clear();
+}
+
+/**
+ * Calculates the nearness of two sets given their maximal cliques.
+ * @param  cliques     [The maximal clique found in the union of the two objects]
+ * @param  num_objects [The total number of objects]
+ * @param  singletons  [Whether to include singleton cliques in the result]
+ * @return             [The nearness between the two objects]
+ */
+inline void nearness_mce(
+    const unsigned int num_objects,
+    const bool singletons,
+    IdSet &clique,
+    float &numerator,
+    int &denominator) {
+
+        unsigned int count = clique.count();
+
+        // ignore singletons unless set otherwise
+        if (singletons || count > 1) {
+
+            unsigned int x = 0;
+            unsigned int y = 0;
+
+            for (unsigned int i = 0; i < num_objects/2; ++i) {
+                if (clique[i]) ++x;
+            }
+            for (unsigned int i = num_objects/2; i < num_objects; ++i) {
+                if (clique[i]) ++y;
+            }
+
+            numerator += (std::min(x, y) / (float) std::max(x, y)) * count;
+            denominator += count;
+        }
+}
+
+/**
+ * Calculates the nearness of two objects from the maximal cliques of their
+ * combined neighbourhood graph.
+ * @param  graph      [The combined graph, the first object's vertices first]
+ * @param  singletons [Whether to include singleton cliques in the result]
+ * @return            [The nearness between the two objects]
+ */
+inline float graph_nearness(
+    std::vector<IdSet> &graph,
+    const bool singletons) {
+
+    float numerator = 0;
+    int denominator = 0;
+    clique_enumerate(graph,
+        boost::bind(nearness_mce,
+            graph.size(),
+            singletons,
+            _1,
+            boost::ref(numerator),
+            boost::ref(denominator)));
+
+    return numerator / denominator;
+}
+
+/**
+ * Calculates the nearness of two objects from maximal cliques already found.
+ * @param  cliques     [The maximal cliques of the combined graph]
+ * @param  num_objects [The number of vertices in the combined graph]
+ * @param  singletons  [Whether to include singleton cliques in the result]
+ * @return             [The nearness between the two objects]
+ */
+inline float cliques_nearness(
+    std::vector<IdSet> &cliques,
+    const unsigned int num_objects,
+    const bool singletons) {
+
+    float numerator = 0;
+    int denominator = 0;
+    for (unsigned int c = 0; c < cliques.size(); ++c) {
+        nearness_mce(num_objects, singletons, cliques[c], numerator, denominator);
+    }
+
+    return numerator / denominator;
+}
+
+/**
+ * The most maximal cliques any graph of n vertices can have, from Moon and
+ * Moser.
+ * @param  n [The number of vertices]
+ * @return   [The largest possible number of maximal cliques]
+ */
+inline double max_maximal_cliques(const unsigned int n) {
+    if (n < 2) return 1;
+
+    // 3^(n/3) when n is a multiple of 3, 4 * 3^((n - 4)/3) when one more and
+    // 2 * 3^((n - 2)/3) when two more
+    double count = n % 3 == 0 ? 1 : n % 3 == 1 ? 4 : 2;
+    for (unsigned int k = n % 3 == 1 ? 4 : n % 3; k < n; k += 3) {
+        count *= 3;
+    }
+    return count;
+}
+
+/**
+ * An upper bound of the mce nearness of a combined graph, found from the
+ * degrees of its vertices without enumerating any clique. The nearness sums
+ * the size of each clique scaled by its balance between the two halves of the
+ * graph, min(x, y) / max(x, y), over the sum of the sizes. A scaled size is at
+ * most twice the vertices of the clique in either half, so the numerator is
+ * at most twice the vertices of cliques that cross in the half with fewer. A
+ * vertex with no neighbour in the other half is only in cliques within its own
+ * half and is in at least one clique. A vertex with neighbours in the other
+ * half is in at most as many cliques as a graph of its neighbours can have.
+ * @param  graph      [The combined graph, split in half as by nearness_mce]
+ * @param  singletons [Whether singleton cliques are included in the result]
+ * @return            [A value the nearness can not exceed]
+ */
+inline float mce_upper_bound(
+    std::vector<IdSet> &graph,
+    const bool singletons) {
+
+    unsigned int half = graph.size() / 2;
+
+    // the vertices of cliques that may cross in each half, and of cliques
+    // that can not
+    double crossing[2] = {0, 0};
+    double within = 0;
+    for (unsigned int v = 0; v < graph.size(); ++v) {
+        unsigned int degree = graph[v].count();
+        unsigned int upper = (graph[v] >> half).count();
+        unsigned int side = v < half ? 0 : 1;
+        unsigned int other = side == 0 ? upper : degree - upper;
+
+        if (other > 0) {
+            crossing[side] += max_maximal_cliques(degree);
+        }
+        else if (singletons || degree > 0) {
+            within += 1;
+        }
+    }
+
+    double fewer = std::min(crossing[0], crossing[1]);
+    return 2 * fewer / (2 * fewer + within);
+}
+
+/**
+ * Calculates the mce nearness of two objects from their features and partial
+ * graphs.
+ * @param  features_a   [The features of the first object]
+ * @param  features_b   [The features of the second object]
+ * @param  graph_a      [The partial graph of the first object]
+ * @param  graph_b      [The partial graph of the second object]
+ * @param  index_b      [The spatial index of the second object, or NULL]
+ * @param  epsilon      [The epsilon value used to find the neighborhoods]
+ * @param  num_features [The number of features per object]
+ * @param  singletons   [Whether singletons should be included in the result]
+ * @param  min_nearness [A nearness less than this is given as 0, pairs whose
+ *                      upper bound is less are not enumerated]
+ * @return              [The nearness between the two objects]
+ */
+inline float pair_nearness_mce(
+    Object &features_a,
+    Object &features_b,
+    std::vector<IdSet> &graph_a,
+    std::vector<IdSet> &graph_b,
+    const ProjectionIndex *index_b,
+    const float epsilon,
+    const unsigned int num_features,
+    const bool singletons,
+    const float min_nearness = 0) {
+
+    // create the graph
+    std::vector<IdSet> graph;
+    bool meet;
+    if (index_b == NULL) {
+        meet = features_to_graph(features_a, features_b, graph_a, graph_b,
+            graph, epsilon, num_features);
+    }
+    else {
+        meet = features_to_graph(features_a, features_b, graph_a, graph_b, *index_b,
+            graph, epsilon, num_features);
+    }
+
+    // if the two graphs are disjoint the can have no relevant maximal
+    // cliques and thus we can assume the nearness is 0
+    if (!meet) return 0;
+
+    // likewise when too few objects meet to reach the threshold
+    if (min_nearness > 0 && mce_upper_bound(graph, singletons) < min_nearness) return 0;
+
+    float nearness = graph_nearness(graph, singletons);
+    return nearness < min_nearness ? 0 : nearness;
+}
+
+/**
+ * Adds the edges shorter than epsilon to a graph, starting from the first
+ * edge not yet added, and updates its maximal cliques with each edge.
+ * @param  edges       [The edges sorted from shortest to longest]
+ * @param  next        [The first edge not yet added, updated to the first
+ *                     edge not added by this call]
+ * @param  sqr_epsilon [The squared epsilon]
+ * @param  offset_a    [Added to the first vertex of each edge]
+ * @param  offset_b    [Added to the second vertex of each edge]
+ * @param  graph       [The graph to add edges to]
+ * @param  cliques     [The maximal cliques of the graph]
+ */
+inline void insert_edges(
+    const std::vector<Edge> &edges,
+    unsigned int &next,
+    const float sqr_epsilon,
+    const unsigned int offset_a,
+    const unsigned int offset_b,
+    std::vector<IdSet> &graph,
+    std::vector<IdSet> &cliques) {
+
+    for (; next < edges.size() && edges[next].sqr_distance < sqr_epsilon; ++next) {
+        clique_insert_edge(graph, cliques,
+            edges[next].a + offset_a, edges[next].b + offset_b);
+    }
+}
+
+/**
+ * How a row task skips pairs whose nearness is known without finding their
+ * cliques.
+ */
+struct Pruning {
+    // index of the objects that may meet, or NULL to compare every pair
+    const GridIndex *grid;
+
+    // a nearness less than this is given as 0, 0 to keep every pair
+    float min_nearness;
+
+    Pruning() : grid(NULL), min_nearness(0) {}
+};
+
+/**
+ * Task to calculate the nearness from one object to all later objects.
+ * @param i            [The outer set that will be compared]
+ * @param corpus       [The objects and their partial neighborhoods]
+ * @param results      [Where to send the completed row]
+ * @param epsilon      [The epsilon value used to find the neighborhoods]
+ * @param num_features [The number of features per object]
+ * @param singletons   [Whether singletons should be included in the results]
+ * @param pruning      [The pairs that are not compared]
+ * @param cache        [Results of an earlier run to look pairs up in, or NULL
+ *                     to compute every pair]
+ * @param progress     [The progress to report completed comparisons to]
+ */
+inline void nearness_task_mce(
+    const unsigned int i,
+    Corpus &corpus,
+    ResultSink &results,
+    const float epsilon,
+    const unsigned int num_features,
+    const bool singletons,
+    const Pruning &pruning,
+    const PairCache *cache,
+    Progress &progress) {
+
+    std::vector<Object> &objects = corpus.objects;
+    std::vector<std::vector<IdSet> > &partial_graphs = corpus.partial_graphs;
+    const GridIndex *grid = pruning.grid;
+
+    // only the objects after i, the nearness to i itself is always 0
+    Result tmp(objects.size() - i - 1);
+
+    std::vector<char> candidates;
+    if (grid != NULL) {
+        grid->candidates(i, candidates);
+    }
+
+    // compare to each object that hasn't been compared to yet
+    for (unsigned int j = i + 1; j < objects.size(); ++j) {
+
+        // the pair was computed by an earlier run
+        if (cache != NULL && cache->lookup(i, j, tmp[j - i - 1])) continue;
+
+        // objects that share no neighbouring grid cells are disjoint
+        if (grid != NULL && !candidates[j]) {
+            tmp[j - i - 1] = 0;
+            continue;
+        }
+
+        tmp[j - i - 1] = pair_nearness_mce(objects[i], objects[j],
+            partial_graphs[i], partial_graphs[j],
+            corpus.indices.empty() ? NULL : &corpus.indices[j],
+            epsilon, num_features, singletons, pruning.min_nearness);
+    }
+
+    // rows never overlap so only progress needs the lock
+    results.add_row(i, tmp);
+
+    progress.advance(objects.size() - i);
+}
+
+/**
+ * Task to calculate the nearness from one object to all later objects at
+ * each epsilon of a sweep. The distances between the objects are computed
+ * once at the largest epsilon, the graph at each epsilon is then grown from
+ * the graph at the last by adding the edges sorted by length. Objects that
+ * are disjoint at the largest epsilon are disjoint at every epsilon. Once the
+ * objects meet their maximal cliques are carried from one epsilon to the next
+ * as each edge is added rather than enumerated again.
+ * @param i            [The outer set that will be compared]
+ * @param corpus       [The objects and the sorted edges within them]
+ * @param results      [Where to send the completed row for each epsilon]
+ * @param epsilons     [The epsilons of the sweep in increasing order]
+ * @param num_features [The number of features per object]
+ * @param singletons   [Whether singletons should be included in the results]
+ * @param grid         [Index of the objects that may meet at the largest
+ *                     epsilon, or NULL to compare every pair]
+ * @param caches       [Results of an earlier run for each epsilon to look
+ *                     pairs up in, empty to compute every pair]
+ * @param progress     [The progress to report completed comparisons to]
+ */
+inline void nearness_task_mce_sweep(
+    const unsigned int i,
+    Corpus &corpus,
+    std::vector<ResultSink *> &results,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool singletons,
+    const GridIndex *grid,
+    const std::vector<PairCache *> &caches,
+    Progress &progress) {
+
+    std::vector<Object> &objects = corpus.objects;
+
+    // only the objects after i, the nearness to i itself is always 0
+    std::vector<Result> tmp(epsilons.size(), Result(objects.size() - i - 1));
+
+    std::vector<char> candidates;
+    if (grid != NULL) {
+        grid->candidates(i, candidates);
+    }
+
+    unsigned int num_objects_a = objects[i].size() / num_features;
+    std::vector<Edge> cross_edges;
+
+    for (unsigned int j = i + 1; j < objects.size(); ++j) {
+
+        // the pair was computed at every epsilon by an earlier run
+        bool cached = !caches.empty();
+        for (unsigned int k = 0; cached && k < caches.size(); ++k) {
+            cached = caches[k]->lookup(i, j, tmp[k][j - i - 1]);
+        }
+        if (cached) continue;
+
+        // objects that share no neighbouring grid cells are disjoint
+        if (grid != NULL && !candidates[j]) continue;
+
+        features_to_edges(objects[i], objects[j],
+            corpus.indices.empty() ? NULL : &corpus.indices[j],
+            cross_edges, epsilons.back(), num_features);
+
+        // disjoint at the largest epsilon so disjoint at all of them
+        if (cross_edges.empty()) continue;
+
+        unsigned int num_objects = num_objects_a + objects[j].size() / num_features;
+        #ifndef DYNAMIC_BITSET
+            assert(num_objects <= MAX_VERTICES);
+        #endif
+
+        std::vector<IdSet> graph(num_objects);
+        #ifdef DYNAMIC_BITSET
+            for (unsigned int v = 0; v < num_objects; ++v) {
+                graph[v].resize(num_objects);
+            }
+        #endif
+
+        unsigned int next_a = 0, next_b = 0, next_cross = 0;
+        std::vector<IdSet> cliques;
+        bool meet = false;
+        for (unsigned int k = 0; k < epsilons.size(); ++k) {
+            float sqr_epsilon = epsilons[k] * epsilons[k];
+
+            if (meet) {
+                insert_edges(corpus.edges[i], next_a, sqr_epsilon, 0, 0, graph, cliques);
+                insert_edges(corpus.edges[j], next_b, sqr_epsilon, num_objects_a, num_objects_a, graph, cliques);
+                insert_edges(cross_edges, next_cross, sqr_epsilon, 0, num_objects_a, graph, cliques);
+            }
+            else {
+                add_edges(corpus.edges[i], next_a, sqr_epsilon, 0, 0, graph);
+                add_edges(corpus.edges[j], next_b, sqr_epsilon, num_objects_a, num_objects_a, graph);
+
+                // the cliques are only needed from the first epsilon they meet
+                if (add_edges(cross_edges, next_cross, sqr_epsilon, 0, num_objects_a, graph) > 0) {
+                    meet = true;
+                    clique_enumerate(graph, cliques);
+                }
+            }
+
+            if (meet) {
+                tmp[k][j - i - 1] = cliques_nearness(cliques, num_objects, singletons);
+            }
+        }
+    }
+
+    // rows never overlap so only progress needs the lock
+    for (unsigned int k = 0; k < epsilons.size(); ++k) {
+        results[k]->add_row(i, tmp[k]);
+    }
+
+    progress.advance((objects.size() - i) * epsilons.size());
+}
+
+/**
+ * Task to calculate the nearness of a pair of unique objects with the later
+ * object first, at each epsilon. When sweeping the partial graphs are built
+ * for the pair at each epsilon as the corpus only keeps the sorted edges.
+ * @param p            [The pair to calculate]
+ * @param pairs        [The pairs, the later object of each first]
+ * @param corpus       [The objects, prepared by prepare_corpus]
+ * @param epsilons     [The epsilons of the run in increasing order]
+ * @param num_features [The number of features per object]
+ * @param singletons   [Whether singletons should be included in the results]
+ * @param min_nearness [A nearness less than this is given as 0]
+ * @param values       [The value of each pair at each epsilon]
+ */
+inline void reversed_pair_task(
+    const unsigned int p,
+    const std::vector<std::pair<unsigned int, unsigned int> > &pairs,
+    Corpus &corpus,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool singletons,
+    const float min_nearness,
+    std::vector<std::vector<float> > &values) {
+
+    unsigned int a = pairs[p].first;
+    unsigned int b = pairs[p].second;
+    const ProjectionIndex *index_b = corpus.indices.empty() ? NULL : &corpus.indices[b];
+
+    for (unsigned int k = 0; k < epsilons.size(); ++k) {
+        if (epsilons.size() == 1) {
+            values[k][p] = pair_nearness_mce(corpus.objects[a], corpus.objects[b],
+                corpus.partial_graphs[a], corpus.partial_graphs[b],
+                index_b, epsilons[k], num_features, singletons, min_nearness);
+        }
+        else {
+            std::vector<IdSet> graph_a, graph_b;
+            features_to_graph(corpus.objects[a], graph_a, epsilons[k], num_features);
+            features_to_graph(corpus.objects[b], graph_b, epsilons[k], num_features);
+            values[k][p] = pair_nearness_mce(corpus.objects[a], corpus.objects[b],
+                graph_a, graph_b,
+                index_b, epsilons[k], num_features, singletons, min_nearness);
+        }
+    }
+}
+
+/**
+ * Calculate the pairs of unique objects that copies read out of order need
+ * with the later object first. The mce measure splits the combined graph of a
+ * pair by the size of the first object, so the order of a pair of objects of
+ * different sizes changes its value.
+ * @param corpus       [The objects, prepared by prepare_corpus]
+ * @param duplicates   [The expanding sink of each epsilon]
+ * @param epsilons     [The epsilons of the run in increasing order]
+ * @param num_features [The number of features per object]
+ * @param singletons   [Whether singletons should be included in the results]
+ * @param min_nearness [A nearness less than this is given as 0]
+ * @param num_threads  [The number of threads to run with]
+ */
+inline void reverse_duplicate_pairs(
+    Corpus &corpus,
+    std::vector<DuplicateResults *> &duplicates,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool singletons,
+    const float min_nearness,
+    const unsigned int num_threads) {
+
+    if (duplicates.empty()) return;
+    assert(duplicates.size() == epsilons.size());
+
+    // every output has the same objects so needs the same pairs
+    std::vector<std::pair<unsigned int, unsigned int> > pairs = duplicates[0]->reversed_pairs();
+    if (pairs.empty()) return;
+    d_var(pairs.size());
+
+    std::vector<std::vector<float> > values(epsilons.size(), std::vector<float>(pairs.size()));
+    if (num_threads == 1) {
+        for (unsigned int p = 0; p < pairs.size(); ++p) {
+            reversed_pair_task(p, pairs, corpus, epsilons, num_features, singletons, min_nearness, values);
+        }
+    }
+    else {
+        boost::threadpool::pool threadpool(num_threads);
+        for (unsigned int p = 0; p < pairs.size(); ++p) {
+            threadpool.schedule(
+                boost::bind(reversed_pair_task,
+                    p, boost::cref(pairs),
+                    boost::ref(corpus), boost::cref(epsilons),
+                    num_features, singletons, min_nearness,
+                    boost::ref(values)));
+        }
+        threadpool.wait();
+    }
+
+    for (unsigned int k = 0; k < duplicates.size(); ++k) {
+        duplicates[k]->set_reversed(pairs, values[k]);
+    }
+}
+
+/**
+ * Calculate nearness and output results. When several epsilons are given the
+ * distances are computed once and reused for each epsilon, writing a separate
+ * output for each.
+ * @param corpus       [The objects, prepared by prepare_corpus]
+ * @param outputs      [The name of the output file for each epsilon]
+ * @param epsilons     [The epsilon values used to calculate neighborhoods in
+ *                     increasing order]
+ * @param num_features [The number of features per object]
+ * @param singletons   [Whether to include singletons in the results]
+ * @param num_threads  [The number of threads to run with, when set to 1 runs
+ *                     in serial]
+ * @param num_processes [The number of worker processes to run with, when
+ *                     greater than 1 used instead of threads]
+ * @param output_options [How results are stored and written]
+ * @param grid_dims    [The number of leading dimensions to build a grid index
+ *                     over to skip disjoint pairs, 0 to compare every pair]
+ * @param min_nearness [A nearness less than this is given as 0 and pairs that
+ *                     can not reach it are skipped, 0 to keep every pair]
+ * @param pair_cache   [The directory of results from earlier runs, empty to
+ *                     compute every pair]
+ * @param checkpoint   [Whether to checkpoint completed rows]
+ * @param resume       [Whether to resume from existing checkpoints]
+ * @param shard        [The rows to compute, written as partial results]
+ * @param server       [Hands rows to worker processes, or NULL to compute
+ *                     rows in this process]
+ */
+inline void run_mce(
+    Corpus &corpus,
+    std::vector<std::string> &outputs,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const bool singletons,
+    const unsigned int num_threads,
+    const unsigned int num_processes,
+    const OutputOptions &output_options,
+    const unsigned int grid_dims,
+    const float min_nearness,
+    const std::string &pair_cache,
+    const bool checkpoint,
+    const bool resume,
+    const Shard &shard,
+    WorkServer *server) {
+
+    assert(num_threads > 0);
+    assert(num_features > 0);
+    assert(!epsilons.empty() && epsilons.front() > 0);
+    assert(outputs.size() == epsilons.size());
+
+    // the largest epsilon, or the only one when not sweeping
+    const float epsilon = epsilons.back();
+    const bool sweep = epsilons.size() > 1;
+    assert(!sweep || min_nearness == 0);
+
+    std::vector<Object> &objects = corpus.objects;
+
+    // the rows to compute
+    unsigned int first = 0;
+    unsigned int last = objects.size();
+    unsigned int comparisons = (objects.size() + 1) * (objects.size() / 2);
+
+    std::vector<ResultSink *> results;
+    if (shard.enabled()) {
+        shard_rows(shard, estimate_row_costs(corpus, num_features, "mce"), first, last);
+        d_var(first);
+        d_var(last);
+        results = create_partial_results(objects.size(), first, last, "mce", epsilons, num_features, singletons);
+        comparisons = (unsigned int)((size_t)(last - first) * (2 * objects.size() - first - last + 1) / 2);
+    }
+    else {
+        results = create_results(outputs, output_options, corpus.num_read(), true);
+    }
+
+    // copies of an object have the same maximal cliques so are as near as
+    // possible, unless there are no objects to form cliques
+    std::vector<float> self_values(objects.size());
+    for (unsigned int i = 0; i < objects.size(); ++i) {
+        self_values[i] = objects[i].empty() ? 0 : 1;
+    }
+    std::vector<DuplicateResults *> duplicates = create_duplicate_results(corpus, self_values, results);
+
+    std::vector<PairCache *> caches = create_pair_caches(
+        pair_cache, "mce", corpus, epsilons, num_features, singletons, results);
+    const PairCache *cache = caches.empty() ? NULL : caches[0];
+
+    std::vector<Checkpoint *> checkpoints = create_checkpoints(checkpoint, resume,
+        outputs, "mce", corpus, epsilons, num_features, singletons, results);
+
+    GridIndex *grid = NULL;
+    if (grid_dims > 0) {
+        d("Build Grid Index");
+        grid = new GridIndex(objects, epsilon, num_features, grid_dims);
+        d_var(grid->size());
+    }
+
+    Pruning pruning;
+    pruning.grid = grid;
+    pruning.min_nearness = min_nearness;
+
+    // progress
+    Progress progress(comparisons * epsilons.size());
+
+    // if workers compute the rows
+    if (server != NULL) {
+        d("Serve Work");
+        server->run(objects.size(), outputs.size(), first, last, completed_rows(checkpoints, first, last),
+            boost::bind(collect_remote_row,
+                _1, _2,
+                boost::ref(results), boost::ref(checkpoints),
+                objects.size(), boost::ref(progress)));
+    }
+    // if in serial mode
+    else if (num_threads == 1 && num_processes <= 1) {
+        d("Serial Mode");
+        for (unsigned int i = first; i < last; ++i) {
+            if (restore_row(checkpoints, i)) {
+                progress.advance((objects.size() - i) * epsilons.size());
+            }
+            else if (sweep) {
+                nearness_task_mce_sweep(
+                    i,
+                    corpus, results,
+                    epsilons, num_features, singletons,
+                    grid, caches, progress);
+            }
+            else {
+                nearness_task_mce(
+                    i,
+                    corpus, *results[0],
+                    epsilon, num_features, singletons,
+                    pruning, cache, progress);
+            }
+        }
+    }
+    else if (num_processes > 1) {
+        d("Process Mode");
+        SharedMemory progress_count(sizeof(unsigned int));
+        progress.share(reinterpret_cast<unsigned int *>(progress_count.get()));
+
+        // workers send rows to shared results, this process passes them on
+        std::vector<SharedResults *> shared = create_shared_results(outputs.size(), objects.size(), first, last);
+        std::vector<ResultSink *> worker_results(shared.begin(), shared.end());
+
+        boost::function<void (unsigned int)> task;
+        if (sweep) {
+            task = boost::bind(nearness_task_mce_sweep,
+                _1,
+                boost::ref(corpus), boost::ref(worker_results),
+                boost::cref(epsilons), num_features, singletons,
+                grid, boost::cref(caches), boost::ref(progress));
+        }
+        else {
+            task = boost::bind(nearness_task_mce,
+                _1,
+                boost::ref(corpus), boost::ref(*worker_results[0]),
+                epsilon, num_features, singletons,
+                boost::cref(pruning), cache, boost::ref(progress));
+        }
+
+        run_processes(num_processes, first, last, completed_rows(checkpoints, first, last), task,
+            boost::bind(collect_row,
+                _1,
+                boost::ref(shared), boost::ref(results), boost::ref(checkpoints),
+                objects.size(), boost::ref(progress)));
+
+        free_shared_results(shared);
+    }
+    else {
+        d("Parallel Mode");
+        // create a threadpool with a thread for each core
+        boost::threadpool::pool threadpool(num_threads);
+
+        // find cliques, rows are restored in order with the tasks so a
+        // streamed output is never left waiting on a row not yet scheduled
+        for (unsigned int i = first; i < last; ++i) {
+            if (restore_row(checkpoints, i)) {
+                progress.advance((objects.size() - i) * epsilons.size());
+            }
+            else if (sweep) {
+                threadpool.schedule(
+                    boost::bind(nearness_task_mce_sweep,
+                        i,
+                        boost::ref(corpus), boost::ref(results),
+                        boost::cref(epsilons), num_features, singletons,
+                        grid, boost::cref(caches), boost::ref(progress)));
+            }
+            else {
+                threadpool.schedule(
+                    boost::bind(nearness_task_mce,
+                        i,
+                        boost::ref(corpus), boost::ref(*results[0]),
+                        epsilon, num_features, singletons,
+                        boost::cref(pruning), cache, boost::ref(progress)));
+            }
+        }
+
+        d("All tasks scheduled");
+
+        // wait for tasks to complete
+        threadpool.wait();
+    }
+
+    delete grid;
+
+    finish_checkpoints(checkpoints, results);
+    finish_pair_caches(caches, results);
+    reverse_duplicate_pairs(corpus, duplicates, epsilons, num_features, singletons,
+        min_nearness, num_processes > 1 ? num_processes : num_threads);
+    finish_duplicate_results(duplicates, results);
+
+    // output results
+    d("Output");
+    if (shard.enabled()) {
+        finish_partial_results(outputs, results);
+    }
+    else {
+        finish_results(outputs, results, output_options, num_threads);
+    }
+    remove_checkpoints(checkpoints);
+}
+
+/**
+ * Calculates the sgmd distance between two objects, the cost of the cheapest
+ * matching of the degrees of their partial graphs.
+ * @param  sizes_a   [The degree of each vertex of the first object]
+ * @param  sizes_b   [The degree of each vertex of the second object]
+ * @param  hungarian [The problem to solve the matching with, reused between
+ *                   pairs]
+ * @return           [The distance between the two objects]
+ */
+inline float pair_distance_sgmd(
+    const std::vector<int> &sizes_a,
+    const std::vector<int> &sizes_b,
+    hungarian_problem_t *hungarian) {
+
+    // an empty graph is matched entirely with padding which costs nothing
+    if (sizes_a.empty() || sizes_b.empty()) {
+        return 0;
+    }
+
+    // d("Calculate Distance Matrix"); 
+    // hungarian expects an array of row pointers
+    std::vector<std::vector<int> > distance_matrix(sizes_a.size());
+    std::vector<int*> ptrs(distance_matrix.size());
+    for (unsigned int k = 0; k < distance_matrix.size(); ++k) {
+        distance_matrix[k].resize(sizes_b.size());
+        for (unsigned int l = 0; l < distance_matrix[k].size(); ++l) {
+            distance_matrix[k][l] = std::abs(sizes_a[k] - sizes_b[l]);
+        }
+        ptrs[k] = &distance_matrix[k].front();
+    }
+
+    // d("Hungarian Algorithm");
+
+    // setup
+    hungarian_init(hungarian, &ptrs.front(), sizes_a.size(), sizes_b.size(), 
+        HUNGARIAN_MODE_MINIMIZE_COST);
+    hungarian_solve(hungarian);
+
+    // Sum the assignment cost, the problem is padded to be square so
+    // ignore assignments to the padding
+    float cost = 0;
+    for (unsigned int k = 0; k < distance_matrix.size(); ++k) {
+        for (unsigned int l = 0; l < distance_matrix[k].size(); ++l) {
+            if (hungarian->assignment[k][l]) {
+                cost += distance_matrix[k][l];
+            }
+        }
+    }
+
+    // without this we get a large memory leak
+    hungarian_free(hungarian);
+
+    return cost;
+}
+
+/**
+ * Calculates the sgmd distance between two objects unless their degrees show
+ * it must be greater than a threshold.
+ * @param  sizes_a      [The degree of each vertex of the first object]
+ * @param  sizes_b      [The degree of each vertex of the second object]
+ * @param  sorted_a     [The sorted degrees of the first object, or NULL to
+ *                      keep every distance]
+ * @param  sorted_b     [The sorted degrees of the second object]
+ * @param  max_distance [A distance greater than this is given as infinity]
+ * @param  hungarian    [The problem to solve the matching with]
+ * @return              [The distance between the two objects]
+ */
+inline float pair_distance_sgmd(
+    const std::vector<int> &sizes_a,
+    const std::vector<int> &sizes_b,
+    const std::vector<int> *sorted_a,
+    const std::vector<int> *sorted_b,
+    const float max_distance,
+    hungarian_problem_t *hungarian) {
+
+    const float far = std::numeric_limits<float>::infinity();
+    if (sorted_a != NULL && sgmd_lower_bound(*sorted_a, *sorted_b) > max_distance) return far;
+
+    float distance = pair_distance_sgmd(sizes_a, sizes_b, hungarian);
+    return distance > max_distance ? far : distance;
+}
+
+/**
+ * Task to calculate the nearness from one object to all later objects.
+ * @param i            [The outer set that will be compared]
+ * @param subset_sizes [The degree of each vertex of each partial graph]
+ * @param results      [Where to send the completed row]
+ * @param sorted_sizes [The sorted degrees of each partial graph, or NULL to
+ *                     keep every distance]
+ * @param max_distance [A distance greater than this is given as infinity and
+ *                     pairs whose lower bound is greater are not matched]
+ * @param cache        [Results of an earlier run to look pairs up in, or NULL
+ *                     to compute every pair]
+ * @param progress     [The progress to report completed comparisons to]
+ */
+inline void nearness_task_sgmd(
+    const unsigned int i,
+    std::vector<std::vector<int> > &subset_sizes,
+    ResultSink &results,
+    const std::vector<std::vector<int> > *sorted_sizes,
+    const float max_distance,
+    const PairCache *cache,
+    Progress &progress) {
+
+    // only the objects after i, the nearness to i itself is always 0
+    Result tmp(subset_sizes.size() - i - 1);
+
+    hungarian_problem_t* hungarian = new hungarian_problem_t;
+
+    for (unsigned int j = i+1; j < subset_sizes.size(); ++j) {
+
+        // the pair was computed by an earlier run
+        if (cache != NULL && cache->lookup(i, j, tmp[j - i - 1])) continue;
+
+        if (sorted_sizes == NULL) {
+            tmp[j - i - 1] = pair_distance_sgmd(subset_sizes[i], subset_sizes[j], hungarian);
+        }
+        else {
+            tmp[j - i - 1] = pair_distance_sgmd(subset_sizes[i], subset_sizes[j],
+                &(*sorted_sizes)[i], &(*sorted_sizes)[j], max_distance, hungarian);
+        }
+    }
+        
+    // free memory
+    delete hungarian;
+
+    // rows never overlap so only progress needs the lock
+    results.add_row(i, tmp);
+
+    progress.advance(subset_sizes.size() - i);
+}
+
+/**
+ * The sgmd distance between two objects of a corpus, matched with the lower
+ * index first as when computing rows.
+ * @param  i            [The first object]
+ * @param  j            [The second object]
+ * @param  subset_sizes [The degree of each vertex of each partial graph]
+ * @param  index        [The sorted degrees of each partial graph]
+ * @param  max_distance [A distance greater than this is given as infinity]
+ * @param  hungarian    [The problem to solve the matching with]
+ * @return              [The distance between the two objects]
+ */
+inline float index_distance(
+    const unsigned int i,
+    const unsigned int j,
+    const std::vector<std::vector<int> > &subset_sizes,
+    const DegreeIndex &index,
+    const float max_distance,
+    hungarian_problem_t *hungarian) {
+
+    unsigned int a = std::min(i, j);
+    unsigned int b = std::max(i, j);
+    if (max_distance < std::numeric_limits<float>::infinity()) {
+        return pair_distance_sgmd(subset_sizes[a], subset_sizes[b],
+            &index.sorted(a), &index.sorted(b), max_distance, hungarian);
+    }
+    return pair_distance_sgmd(subset_sizes[a], subset_sizes[b], hungarian);
+}
+
+/**
+ * Task to find the nearest objects to one object from the index, matching
+ * only the objects whose lower bound could be among them.
+ * @param i            [The object to find the nearest objects to]
+ * @param index        [The sorted degrees of each partial graph]
+ * @param subset_sizes [The degree of each vertex of each partial graph]
+ * @param max_distance [A distance greater than this is given as infinity]
+ * @param results      [Where to send the nearest objects]
+ * @param k            [The number of nearest objects to find]
+ * @param progress     [The progress to report completed comparisons to]
+ */
+inline void index_task_sgmd(
+    const unsigned int i,
+    DegreeIndex &index,
+    const std::vector<std::vector<int> > &subset_sizes,
+    const float max_distance,
+    TopKResults &results,
+    const unsigned int k,
+    Progress &progress) {
+
+    hungarian_problem_t hungarian;
+    std::vector<Neighbour> nearest;
+    index.nearest(index.sorted(i), k, i,
+        boost::bind(index_distance,
+            i, _1,
+            boost::cref(subset_sizes), boost::cref(index), max_distance, &hungarian),
+        nearest);
+    results.add_nearest(i, nearest);
+
+    progress.advance(subset_sizes.size() - i);
+}
+
+/**
+ * Calculate nearness and output results. When several epsilons are given the
+ * distances within each object are computed once and reused for each epsilon,
+ * writing a separate output for each. When only the nearest objects to each
+ * object are kept they are found from a DegreeIndex instead of every row.
+ * @param corpus       [The objects, prepared by prepare_corpus]
+ * @param outputs      [The name of the output file for each epsilon]
+ * @param epsilons     [The epsilon values used to calculate neighborhoods in
+ *                     increasing order]
+ * @param num_features [The number of features per object]
+ * @param num_threads  [The number of threads to run with, when set to 1 runs
+ *                     in serial]
+ * @param num_processes [The number of worker processes to run with, when
+ *                     greater than 1 used instead of threads]
+ * @param output_options [How results are stored and written]
+ * @param max_distance [A distance greater than this is given as infinity and
+ *                     pairs that must be further are skipped, infinity to
+ *                     keep every pair]
+ * @param pair_cache   [The directory of results from earlier runs, empty to
+ *                     compute every pair]
+ * @param checkpoint   [Whether to checkpoint completed rows]
+ * @param resume       [Whether to resume from existing checkpoints]
+ * @param shard        [The rows to compute, written as partial results]
+ * @param server       [Hands rows to worker processes, or NULL to compute
+ *                     rows in this process]
+ */
+inline void run_sgmd(
+    Corpus &corpus,
+    std::vector<std::string> &outputs,
+    const std::vector<float> &epsilons,
+    const unsigned int num_features,
+    const unsigned int num_threads,
+    const unsigned int num_processes,
+    const OutputOptions &output_options,
+    const float max_distance,
+    const std::string &pair_cache,
+    const bool checkpoint,
+    const bool resume,
+    const Shard &shard,
+    WorkServer *server) {
+
+    assert(num_threads > 0);
+    assert(num_features > 0);
+    assert(!epsilons.empty() && epsilons.front() > 0);
+    assert(outputs.size() == epsilons.size());
+
+    std::vector<Object> &objects = corpus.objects;
+
+    // the rows to compute
+    unsigned int first = 0;
+    unsigned int last = objects.size();
+    unsigned int comparisons = (objects.size() + 1) * (objects.size() / 2);
+
+    std::vector<ResultSink *> results;
+    if (shard.enabled()) {
+        shard_rows(shard, estimate_row_costs(corpus, num_features, "sgmd"), first, last);
+        d_var(first);
+        d_var(last);
+        results = create_partial_results(objects.size(), first, last, "sgmd", epsilons, num_features, false);
+        comparisons = (unsigned int)((size_t)(last - first) * (2 * objects.size() - first - last + 1) / 2);
+    }
+    else {
+        results = create_results(outputs, output_options, corpus.num_read(), false);
+    }
+
+    // copies of an object have the same degrees so match at no cost
+    std::vector<DuplicateResults *> duplicates = create_duplicate_results(
+        corpus, std::vector<float>(objects.size(), 0), results);
+
+    std::vector<PairCache *> caches = create_pair_caches(
+        pair_cache, "sgmd", corpus, epsilons, num_features, false, results);
+
+    std::vector<Checkpoint *> checkpoints = create_checkpoints(checkpoint, resume,
+        outputs, "sgmd", corpus, epsilons, num_features, false, results);
+
+    // the subset sizes at each epsilon
+    std::vector<std::vector<std::vector<int> > > subset_sizes(epsilons.size());
+
+    if (epsilons.size() > 1) {
+        d("Count Subsets Size");
+        for (unsigned int k = 0; k < epsilons.size(); ++k) {
+            count_subset_sizes(corpus, epsilons[k], num_features, subset_sizes[k]);
+        }
+    }
+    else {
+        subset_sizes[0] = corpus.degrees;
+    }
+
+    // the summaries bounding each distance, only needed with a threshold
+    bool bounded = max_distance < std::numeric_limits<float>::infinity();
+    std::vector<std::vector<std::vector<int> > > sorted_sizes(epsilons.size());
+    for (unsigned int k = 0; bounded && k < epsilons.size(); ++k) {
+        sort_subset_sizes(subset_sizes[k], sorted_sizes[k]);
+    }
+
+    // progress
+    Progress progress(comparisons * epsilons.size());
+
+    // the nearest objects are found directly when nothing needs whole rows
+    bool indexed = output_options.top_k > 0 && !shard.enabled() && num_processes <= 1
+        && duplicates.empty() && caches.empty() && checkpoints.empty();
+
+    // if workers compute the rows, every epsilon at once
+    if (server != NULL) {
+        d("Serve Work");
+        server->run(objects.size(), outputs.size(), first, last, completed_rows(checkpoints, first, last),
+            boost::bind(collect_remote_row,
+                _1, _2,
+                boost::ref(results), boost::ref(checkpoints),
+                objects.size(), boost::ref(progress)));
+    }
+    else if (indexed) {
+        d("Index Mode");
+        for (unsigned int k = 0; k < epsilons.size(); ++k) {
+            DegreeIndex index(subset_sizes[k]);
+            TopKResults &top_k = *static_cast<TopKResults *>(results[k]);
+
+            boost::threadpool::pool threadpool(num_threads);
+            for (unsigned int i = 0; i < objects.size(); ++i) {
+                if (num_threads == 1) {
+                    index_task_sgmd(i, index, subset_sizes[k], max_distance, top_k, output_options.top_k, progress);
+                    continue;
+                }
+                threadpool.schedule(
+                    boost::bind(index_task_sgmd,
+                        i,
+                        boost::ref(index), boost::cref(subset_sizes[k]), max_distance,
+                        boost::ref(top_k), output_options.top_k, boost::ref(progress)));
+            }
+            threadpool.wait();
+            d_var(index.num_evaluated());
+        }
+    }
+    // if in serial mode
+    else if (num_threads == 1 && num_processes <= 1) {
+        d("Serial Mode");
+        for (unsigned int k = 0; k < epsilons.size(); ++k) {
+            for (unsigned int i = first; i < last; ++i) {
+                if (!checkpoints.empty() && checkpoints[k]->completed(i)) {
+                    checkpoints[k]->restore(i);
+                    progress.advance(objects.size() - i);
+                    continue;
+                }
+                nearness_task_sgmd(
+                    i,
+                    subset_sizes[k], *results[k],
+                    bounded ? &sorted_sizes[k] : NULL, max_distance,
+                    caches.empty() ? NULL : caches[k],
+                    progress);
+            }
+        }
+    }
+    else if (num_processes > 1) {
+        d("Process Mode");
+        SharedMemory progress_count(sizeof(unsigned int));
+        progress.share(reinterpret_cast<unsigned int *>(progress_count.get()));
+
+        // each epsilon is run by its own workers, which send rows to shared
+        // results for this process to pass on
+        for (unsigned int k = 0; k < epsilons.size(); ++k) {
+            std::vector<SharedResults *> shared = create_shared_results(1, objects.size(), first, last);
+            std::vector<ResultSink *> sinks(1, results[k]);
+            std::vector<Checkpoint *> checkpoint_k;
+            if (!checkpoints.empty()) checkpoint_k.push_back(checkpoints[k]);
+
+            run_processes(num_processes, first, last, completed_rows(checkpoint_k, first, last),
+                boost::bind(nearness_task_sgmd,
+                    _1,
+                    boost::ref(subset_sizes[k]), boost::ref(*shared[0]),
+                    bounded ? &sorted_sizes[k] : NULL, max_distance,
+                    caches.empty() ? NULL : caches[k],
+                    boost::ref(progress)),
+                boost::bind(collect_row,
+                    _1,
+                    boost::ref(shared), boost::ref(sinks), boost::ref(checkpoint_k),
+                    objects.size(), boost::ref(progress)));
+
+            free_shared_results(shared);
+        }
+    }
+    else {
+        d("Parallel Mode");
+        // create a threadpool with a thread for each core
+        boost::threadpool::pool threadpool(num_threads);
+
+        // find cliques
+        for (unsigned int k = 0; k < epsilons.size(); ++k) {
+            for (unsigned int i = first; i < last; ++i) {
+                if (!checkpoints.empty() && checkpoints[k]->completed(i)) {
+                    checkpoints[k]->restore(i);
+                    progress.advance(objects.size() - i);
+                    continue;
+                }
+                threadpool.schedule(
+                    boost::bind(nearness_task_sgmd,
+                        i,
+                        boost::ref(subset_sizes[k]), boost::ref(*results[k]),
+                        bounded ? &sorted_sizes[k] : NULL, max_distance,
+                        caches.empty() ? NULL : caches[k],
+                        boost::ref(progress)));
+            }
+        }
+
+        d("All tasks scheduled");
+
+        // wait for tasks to complete
+        threadpool.wait();
+    }
+
+    finish_checkpoints(checkpoints, results);
+    finish_pair_caches(caches, results);
+    finish_duplicate_results(duplicates, results);
+
+    // output results
+    d("Output");
+    if (shard.enabled()) {
+        finish_partial_results(outputs, results);
+    }
+    else {
+        finish_results(outputs, results, output_options, num_threads);
+    }
+    remove_checkpoints(checkpoints);
+}
+
+/**
+ * Build the neighbourhood graph within one object and the degree of each of
+ * its vertices.
+ * @param features     [The features of the object]
+ * @param epsilon      [The epsilon used to find the neighbourhood]
+ * @param num_features [The number of features per object]
+ * @param graph        [The graph to write to]
+ * @param degrees      [The degrees to write to]
+ */
+inline void object_graph(
+    Object &features,
+    const float epsilon,
+    const unsigned int num_features,
+    std::vector<IdSet> &graph,
+    std::vector<int> &degrees) {
+
+    features_to_graph(features, graph, epsilon, num_features);
+    degrees.resize(graph.size());
+    for (unsigned int v = 0; v < graph.size(); ++v) {
+        degrees[v] = graph[v].count();
+    }
+}
+
+/**
+ * How queries against a resident corpus are answered.
+ */
+struct QuerySettings {
+    // the name of the measure
+    std::string measure;
+
+    // the epsilon used to find neighbourhoods
+    float epsilon;
+
+    // the number of features per object
+    unsigned int num_features;
+
+    // whether singletons are included in the results
+    bool singletons;
+
+    // the number of threads each query is computed with
+    unsigned int num_threads;
+
+    // the pairs kept by run_rectangle, an mce nearness less than min_nearness
+    // is given as 0 and an sgmd distance greater than max_distance as infinity
+    float min_nearness;
+    float max_distance;
+
+    QuerySettings() :
+        epsilon(0), num_features(0), singletons(false), num_threads(1),
+        min_nearness(0), max_distance(std::numeric_limits<float>::infinity()) {}
+};
+
+/**
+ * Task comparing a query to objects of the corpus until none are left.
+ * @param next           [The next object to compare, shared between tasks]
+ * @param features       [The features of the query]
+ * @param graph          [The partial graph of the query]
+ * @param degrees        [The degree of each vertex of the query's graph]
+ * @param corpus         [The objects, prepared by prepare_corpus]
+ * @param settings       [How the query is answered]
+ * @param values         [The value of each object to write to]
+ */
+inline void query_task(
+    volatile unsigned int *next,
+    Object &features,
+    std::vector<IdSet> &graph,
+    const std::vector<int> &degrees,
+    Corpus &corpus,
+    const QuerySettings &settings,
+    std::vector<float> &values) {
+
+    hungarian_problem_t hungarian;
+    for (unsigned int j = __sync_fetch_and_add(next, 1); j < corpus.size();
+         j = __sync_fetch_and_add(next, 1)) {
+        if (settings.measure == "sgmd") {
+            values[j] = pair_distance_sgmd(degrees, corpus.degrees[j], &hungarian);
+        }
+        else {
+            values[j] = pair_nearness_mce(features, corpus.objects[j],
+                graph, corpus.partial_graphs[j],
+                corpus.indices.empty() ? NULL : &corpus.indices[j],
+                settings.epsilon, settings.num_features, settings.singletons);
+        }
+    }
+}
+
+/**
+ * The sgmd distance from a query to an object of the corpus, the query
+ * matched first.
+ * @param  j         [The object of the corpus]
+ * @param  degrees   [The degree of each vertex of the query's graph]
+ * @param  corpus    [The objects, prepared by prepare_corpus]
+ * @param  hungarian [The problem to solve the matching with]
+ * @return           [The distance between the query and the object]
+ */
+inline float query_distance(
+    const unsigned int j,
+    const std::vector<int> &degrees,
+    const Corpus &corpus,
+    hungarian_problem_t *hungarian) {
+
+    return pair_distance_sgmd(degrees, corpus.degrees[j], hungarian);
+}
+
+/**
+ * Orders entries from largest to smallest value, then by index.
+ */
+inline bool entry_larger(const QueryEntry &a, const QueryEntry &b) {
+    return a.value > b.value || (a.value == b.value && a.index < b.index);
+}
+
+/**
+ * Orders entries from smallest to largest value, then by index.
+ */
+inline bool entry_smaller(const QueryEntry &a, const QueryEntry &b) {
+    return a.value < b.value || (a.value == b.value && a.index < b.index);
+}
+
+/**
+ * Find the nearness of a query image to every image of the corpus. The
+ * objects are compared on several threads. The query is placed first in the
+ * combined graph, as if it came before every image of the corpus.
+ * @param  features [The features of the query]
+ * @param  top_k    [The number of nearest images to return, 0 for every image
+ *                  in the order read]
+ * @param  answer   [Set to the nearness to each image returned]
+ * @param  error    [Set to why the query could not be answered]
+ * @param  corpus   [The objects, prepared by prepare_corpus]
+ * @param  settings [How the query is answered]
+ * @param  index    [The sorted degrees of the corpus, when given the top k of
+ *                  sgmd are found from it rather than every image]
+ * @return          [False if the query could not be answered]
+ */
+inline bool answer_query(
+    std::vector<float> &features,
+    const unsigned int top_k,
+    std::vector<QueryEntry> &answer,
+    std::string &error,
+    Corpus &corpus,
+    const QuerySettings &settings,
+    DegreeIndex *index = NULL) {
+
+    if (features.size() % settings.num_features != 0) {
+        error = "the number of feature values is not a multiple of the number of features";
+        return false;
+    }
+
+    #ifndef DYNAMIC_BITSET
+        size_t largest = 0;
+        for (unsigned int j = 0; j < corpus.size(); ++j) {
+            largest = std::max(largest, corpus.objects[j].size());
+        }
+        if ((features.size() + largest) / settings.num_features > MAX_VERTICES) {
+            error = "the query has too many objects";
+            return false;
+        }
+    #endif
+
+    std::vector<IdSet> graph;
+    std::vector<int> degrees;
+    object_graph(features, settings.epsilon, settings.num_features, graph, degrees);
+
+    // copies of an object would each need an entry, so every image is compared
+    if (index != NULL && settings.measure == "sgmd" && top_k > 0
+        && top_k < corpus.size() && corpus.representatives.empty()) {
+        std::vector<int> sorted(degrees);
+        std::sort(sorted.begin(), sorted.end());
+
+        hungarian_problem_t hungarian;
+        std::vector<Neighbour> nearest;
+        index->nearest(sorted, top_k, index->size(),
+            boost::bind(query_distance,
+                _1, boost::cref(degrees), boost::cref(corpus), &hungarian),
+            nearest);
+
+        answer.resize(nearest.size());
+        for (unsigned int r = 0; r < answer.size(); ++r) {
+            answer[r].index = nearest[r].j;
+            answer[r].value = nearest[r].value;
+        }
+        return true;
+    }
+
+    std::vector<float> values(corpus.size());
+    unsigned int next = 0;
+    boost::thread_group threads;
+    for (unsigned int t = 1; t < settings.num_threads; ++t) {
+        threads.create_thread(boost::bind(query_task,
+            &next, boost::ref(features), boost::ref(graph), boost::cref(degrees),
+            boost::ref(corpus), boost::cref(settings), boost::ref(values)));
+    }
+    query_task(&next, features, graph, degrees, corpus, settings, values);
+    threads.join_all();
+
+    // copies of an object share the value of the copy compared
+    answer.resize(corpus.num_read());
+    for (unsigned int r = 0; r < answer.size(); ++r) {
+        answer[r].index = r;
+        answer[r].value = values[corpus.representatives.empty() ? r : corpus.representatives[r]];
+    }
+
+    if (top_k > 0 && top_k < answer.size()) {
+        std::partial_sort(answer.begin(), answer.begin() + top_k, answer.end(),
+            settings.measure == "sgmd" ? entry_smaller : entry_larger);
+        answer.resize(top_k);
+    }
+    return true;
+}
+
+// The number of queries and of references compared by each rectangle task
+const unsigned int RECTANGLE_TILE = 16;
+
+/**
+ * A block of the rectangle computed by one task, the queries
+ * [query_first, query_last) against the references
+ * [reference_first, reference_last).
+ */
+struct Tile {
+    unsigned int query_first;
+    unsigned int query_last;
+    unsigned int reference_first;
+    unsigned int reference_last;
+};
+
+/**
+ * Task to calculate the nearness of every pair of a tile. Each reference is
+ * compared to every query of the tile in turn, so its graph and index are
+ * reused while still in cache, and the queries of a tile are few enough to
+ * stay in cache for every reference.
+ * @param tile       [The pairs to compare]
+ * @param queries    [The query objects, prepared by prepare_corpus]
+ * @param references [The reference objects, prepared by prepare_corpus]
+ * @param sorted_queries    [The sorted degrees of each query, or NULL to
+ *                          keep every sgmd distance]
+ * @param sorted_references [The sorted degrees of each reference]
+ * @param results    [The rectangle to write each value to]
+ * @param settings   [The measure and how it is computed]
+ * @param progress   [The progress to report completed comparisons to]
+ */
+inline void rectangle_task(
+    const Tile tile,
+    Corpus &queries,
+    Corpus &references,
+    const std::vector<std::vector<int> > *sorted_queries,
+    const std::vector<std::vector<int> > *sorted_references,
+    RectangleResults &results,
+    const QuerySettings &settings,
+    Progress &progress) {
+
+    hungarian_problem_t hungarian;
+    for (unsigned int r = tile.reference_first; r < tile.reference_last; ++r) {
+        for (unsigned int q = tile.query_first; q < tile.query_last; ++q) {
+            if (settings.measure == "sgmd") {
+                results.set(q, r, pair_distance_sgmd(queries.degrees[q], references.degrees[r],
+                    sorted_queries == NULL ? NULL : &(*sorted_queries)[q],
+                    sorted_references == NULL ? NULL : &(*sorted_references)[r],
+                    settings.max_distance, &hungarian));
+            }
+            else {
+                results.set(q, r, pair_nearness_mce(queries.objects[q], references.objects[r],
+                    queries.partial_graphs[q], references.partial_graphs[r],
+                    references.indices.empty() ? NULL : &references.indices[r],
+                    settings.epsilon, settings.num_features, settings.singletons,
+                    settings.min_nearness));
+            }
+        }
+    }
+
+    // tiles never overlap so only progress needs the lock
+    progress.advance((tile.query_last - tile.query_first) * (tile.reference_last - tile.reference_first));
+}
+
+/**
+ * Calculate the nearness from every query object to every reference object
+ * and output the rectangle, rather than the triangle of both sets together.
+ * Pairs within either set are never compared. The rectangle is split into
+ * tiles scheduled on a threadpool, each query placed first in the combined
+ * graph as when answering a query.
+ * @param queries        [The query objects, prepared by prepare_corpus]
+ * @param references     [The reference objects, prepared by prepare_corpus]
+ * @param output         [The name of the output file]
+ * @param settings       [The measure and how it is computed]
+ * @param output_options [How results are written]
+ */
+inline void run_rectangle(
+    Corpus &queries,
+    Corpus &references,
+    std::string &output,
+    const QuerySettings &settings,
+    const OutputOptions &output_options) {
+
+    assert(settings.num_threads > 0);
+    assert(settings.num_features > 0);
+
+    RectangleResults results(queries.size(), references.size());
+    Progress progress(queries.size() * references.size());
+
+    std::vector<Tile> tiles;
+    for (unsigned int q = 0; q < queries.size(); q += RECTANGLE_TILE) {
+        for (unsigned int r = 0; r < references.size(); r += RECTANGLE_TILE) {
+            Tile tile;
+            tile.query_first = q;
+            tile.query_last = std::min(queries.size(), q + RECTANGLE_TILE);
+            tile.reference_first = r;
+            tile.reference_last = std::min(references.size(), r + RECTANGLE_TILE);
+            tiles.push_back(tile);
+        }
+    }
+    d_var(tiles.size());
+
+    // the summaries bounding each sgmd distance, only needed with a threshold
+    std::vector<std::vector<int> > sorted_queries;
+    std::vector<std::vector<int> > sorted_references;
+    bool bounded = settings.measure == "sgmd"
+        && settings.max_distance < std::numeric_limits<float>::infinity();
+    if (bounded) {
+        sort_subset_sizes(queries.degrees, sorted_queries);
+        sort_subset_sizes(references.degrees, sorted_references);
+    }
+
+    if (settings.num_threads == 1) {
+        d("Serial Mode");
+        for (unsigned int t = 0; t < tiles.size(); ++t) {
+            rectangle_task(tiles[t], queries, references,
+                bounded ? &sorted_queries : NULL, bounded ? &sorted_references : NULL,
+                results, settings, progress);
+        }
+    }
+    else {
+        d("Parallel Mode");
+        boost::threadpool::pool threadpool(settings.num_threads);
+        for (unsigned int t = 0; t < tiles.size(); ++t) {
+            threadpool.schedule(
+                boost::bind(rectangle_task,
+                    tiles[t],
+                    boost::ref(queries), boost::ref(references),
+                    bounded ? &sorted_queries : NULL, bounded ? &sorted_references : NULL,
+                    boost::ref(results), boost::cref(settings), boost::ref(progress)));
+        }
+        threadpool.wait();
+    }
+
+    d("Output");
+    output_results(output, results, output_options.format,
+        settings.num_threads, output_options.compress_level);
+}
+
+// The number of rows of the band computed by each band task
+const unsigned int BAND_ROWS = 16;
+
+/**
+ * Task to calculate the nearness of the pairs of rows [first, last) of a
+ * band, each object placed first in the combined graph with every later
+ * object within the band, as when computing the whole triangle. Consecutive
+ * rows compare mostly the same objects so these stay in cache.
+ * @param first        [The first row]
+ * @param last         [One past the last row]
+ * @param corpus       [The objects, prepared by prepare_corpus]
+ * @param sorted_sizes [The sorted degrees of each object, or NULL to keep
+ *                     every sgmd distance]
+ * @param results      [The band to write each value to]
+ * @param settings     [The measure and how it is computed]
+ * @param progress     [The progress to report completed comparisons to]
+ */
+inline void band_task(
+    const unsigned int first,
+    const unsigned int last,
+    Corpus &corpus,
+    const std::vector<std::vector<int> > *sorted_sizes,
+    BandResults &results,
+    const QuerySettings &settings,
+    Progress &progress) {
+
+    hungarian_problem_t hungarian;
+    size_t count = 0;
+    for (unsigned int i = first; i < last; ++i) {
+        unsigned int end = i + results.row_size(i);
+        for (unsigned int j = i + 1; j <= end; ++j) {
+            if (settings.measure == "sgmd") {
+                results.set(i, j, pair_distance_sgmd(corpus.degrees[i], corpus.degrees[j],
+                    sorted_sizes == NULL ? NULL : &(*sorted_sizes)[i],
+                    sorted_sizes == NULL ? NULL : &(*sorted_sizes)[j],
+                    settings.max_distance, &hungarian));
+            }
+            else {
+                results.set(i, j, pair_nearness_mce(corpus.objects[i], corpus.objects[j],
+                    corpus.partial_graphs[i], corpus.partial_graphs[j],
+                    corpus.indices.empty() ? NULL : &corpus.indices[j],
+                    settings.epsilon, settings.num_features, settings.singletons,
+                    settings.min_nearness));
+            }
+        }
+        count += end - i;
+    }
+
+    // blocks never overlap so only progress needs the lock
+    progress.advance(count);
+}
+
+/**
+ * Calculate the nearness between every pair of objects at most width apart
+ * in the order read and output the band, rather than the whole triangle, so
+ * a sequence costs n * width pairs instead of n^2. The values of the pairs
+ * computed are those of the triangle. Rows are split into blocks scheduled on
+ * a threadpool, every block costing about the same.
+ * @param corpus         [The objects, prepared by prepare_corpus]
+ * @param output         [The name of the output file]
+ * @param settings       [The measure and how it is computed]
+ * @param output_options [How results are written]
+ * @param width          [The furthest apart two objects of a pair can be]
+ */
+inline void run_band(
+    Corpus &corpus,
+    std::string &output,
+    const QuerySettings &settings,
+    const OutputOptions &output_options,
+    const unsigned int width) {
+
+    assert(settings.num_threads > 0);
+    assert(settings.num_features > 0);
+    assert(width > 0);
+
+    BandResults results(corpus.size(), width);
+    Progress progress(results.pairs());
+
+    // the summaries bounding each sgmd distance, only needed with a threshold
+    std::vector<std::vector<int> > sorted_sizes;
+    bool bounded = settings.measure == "sgmd"
+        && settings.max_distance < std::numeric_limits<float>::infinity();
+    if (bounded) {
+        sort_subset_sizes(corpus.degrees, sorted_sizes);
+    }
+
+    if (settings.num_threads == 1) {
+        d("Serial Mode");
+        for (unsigned int i = 0; i < corpus.size(); i += BAND_ROWS) {
+            band_task(i, std::min(corpus.size(), i + BAND_ROWS), corpus,
+                bounded ? &sorted_sizes : NULL, results, settings, progress);
+        }
+    }
+    else {
+        d("Parallel Mode");
+        boost::threadpool::pool threadpool(settings.num_threads);
+        for (unsigned int i = 0; i < corpus.size(); i += BAND_ROWS) {
+            threadpool.schedule(
+                boost::bind(band_task,
+                    i, std::min(corpus.size(), i + BAND_ROWS),
+                    boost::ref(corpus), bounded ? &sorted_sizes : NULL,
+                    boost::ref(results), boost::cref(settings), boost::ref(progress)));
+        }
+        threadpool.wait();
+    }
+
+    d("Output");
+    output_results(output, results, output_options.format,
+        settings.num_threads, output_options.compress_level);
+}
+
+/**
+ * How NearnessEngine::write computes and stores a run, beyond the settings of
+ * the engine.
+ */
+struct WriteOptions {
+    // how results are stored and written
+    OutputOptions output;
+
+    // the number of worker processes, used instead of threads when greater
+    // than 1
+    unsigned int num_processes;
+
+    // the number of leading dimensions of the grid index of mce, 0 for none
+    unsigned int grid_dims;
+
+    // the directory of results from earlier runs, empty to compute every pair
+    std::string pair_cache;
+
+    // whether to checkpoint completed rows and resume existing checkpoints
+    bool checkpoint;
+    bool resume;
+
+    // the rows to compute, written as partial results
+    Shard shard;
+
+    // hands rows to worker processes, or NULL to compute rows in this process
+    WorkServer *server;
+
+    WriteOptions() :
+        num_processes(1), grid_dims(0), checkpoint(false), resume(false), server(NULL) {}
+};
+
+/**
+ * Computes nearness between objects held in memory, for programs that embed
+ * nearness rather than running the command line tool and parsing its output.
+ * Objects are added or read, then prepared once, after which any number of
+ * single pairs, whole runs or queries can be computed. Completed rows are sent
+ * to a sink given by the caller, or written to files as the command line tool
+ * writes them, which is built on this class.
+ *
+ * Pairs, runs and queries can be computed from several threads at once, the
+ * first of them to need the corpus prepared prepares it while the others
+ * wait. Adding or reading objects and changing settings must not happen
+ * while anything else is being computed, and requires preparing again.
+ * Objects are numbered from 0 in the order they are added or read.
+ */
+class NearnessEngine {
+public:
+
+    /**
+     * @param num_features [The number of features per object]
+     * @param epsilon      [The epsilon used to find neighbourhoods]
+     * @param measure      [The measure, 'mce' or 'sgmd']
+     */
+    NearnessEngine(
+        const unsigned int num_features,
+        const float epsilon,
+        const std::string &measure = "mce") :
+        epsilons(1, epsilon),
+        spatial_index(false),
+        deduplicate(false),
+        cache(NULL),
+        prepared(false),
+        index(NULL) {
+
+        settings.measure = measure;
+        settings.epsilon = epsilon;
+        settings.num_features = num_features;
+    }
+
+    ~NearnessEngine() {
+        delete index;
+    }
+
+    /**
+     * The measure, 'mce' or 'sgmd'. Both are computed from the same prepared
+     * corpus.
+     */
+    void set_measure(const std::string &measure) {
+        settings.measure = measure;
+    }
+
+    /**
+     * Sweep several epsilons, only written by write with an output for each,
+     * taking effect when next prepared.
+     * @param epsilons [The epsilons in increasing order]
+     */
+    void set_epsilons(const std::vector<float> &epsilons) {
+        this->epsilons = epsilons;
+        settings.epsilon = epsilons.empty() ? 0 : epsilons.front();
+        prepared = false;
+    }
+
+    /**
+     * Whether to include singleton cliques in mce results.
+     */
+    void set_singletons(const bool singletons) {
+        settings.singletons = singletons;
+    }
+
+    /**
+     * The number of threads runs and queries are computed with.
+     */
+    void set_threads(const unsigned int num_threads) {
+        settings.num_threads = std::max(num_threads, 1u);
+    }
+
+    /**
+     * Whether to index the objects within each object, taking effect when
+     * next prepared.
+     */
+    void set_spatial_index(const bool spatial_index) {
+        this->spatial_index = spatial_index;
+        prepared = false;
+    }
+
+    /**
+     * Whether to only compare one copy of identical objects, taking effect
+     * when next prepared.
+     */
+    void set_deduplicate(const bool deduplicate) {
+        this->deduplicate = deduplicate;
+        prepared = false;
+    }
+
+    /**
+     * Load and store the partial graph of each object in a cache, taking
+     * effect when next prepared.
+     * @param cache [The cache, or NULL to not cache, kept by the caller]
+     */
+    void set_graph_cache(const GraphCache *cache) {
+        this->cache = cache;
+        prepared = false;
+    }
+
+    /**
+     * The pairs kept by write and the writes of bands and rectangles. An mce
+     * nearness less than min_nearness is given as 0 and an sgmd distance
+     * greater than max_distance as infinity.
+     */
+    void set_min_nearness(const float min_nearness) {
+        settings.min_nearness = min_nearness;
+    }
+
+    void set_max_distance(const float max_distance) {
+        settings.max_distance = max_distance;
+    }
+
+    /**
+     * Add an object to the corpus.
+     * @param  features [The feature values of the object]
+     * @param  error    [Set to why the object could not be added]
+     * @return          [False if the object could not be added]
+     */
+    bool add(const Object &features, std::string &error) {
+        if (!valid(error) || !check_object(features, error)) return false;
+        unprepare();
+        corpus.objects.push_back(features);
+        return true;
+    }
+
+    /**
+     * Read objects from files and directories of files, as the command line
+     * tool reads them. Nothing is added if any input could not be read.
+     * @param  input [The input files and directories]
+     * @param  error [Set to why the input could not be read]
+     * @return       [False if the input could not be read]
+     */
+    bool read(const std::vector<std::string> &input, std::string &error) {
+        if (!valid(error)) return false;
+        d("Read Objects");
+        std::vector<Object> objects;
+        if (!read_objects(input, objects, error)) return false;
+        for (unsigned int o = 0; o < objects.size(); ++o) {
+            if (objects[o].size() % settings.num_features != 0) {
+                std::ostringstream message;
+                message << "object " << corpus.objects.size() + o << " has " << objects[o].size()
+                        << " values, not a multiple of " << settings.num_features << " features";
+                error = message.str();
+                return false;
+            }
+        }
+        d_var(objects.size());
+        unprepare();
+        corpus.objects.insert(corpus.objects.end(), objects.begin(), objects.end());
+        return true;
+    }
+
+    /**
+     * Build the neighbourhoods within each object. Called by the other
+     * methods when needed, calling it first keeps that time out of the first
+     * pair or query.
+     * @param  error [Set to why the corpus could not be prepared]
+     * @return       [False if the settings are not valid]
+     */
+    bool prepare(std::string &error) {
+        if (!valid(error)) return false;
+        boost::mutex::scoped_lock lock(prepare_mutex);
+        if (!prepared) {
+            prepare_objects(corpus, epsilons, settings.num_features, spatial_index, cache, deduplicate);
+            delete index;
+            index = NULL;
+            prepared = true;
+        }
+        return true;
+    }
+
+    /**
+     * The number of objects added or read.
+     */
+    unsigned int size() const {
+        return prepared ? corpus.num_read() : corpus.objects.size();
+    }
+
+    /**
+     * The nearness between two objects of the corpus, the same value a run
+     * gives for the pair.
+     * @param  i     [The first object]
+     * @param  j     [The second object]
+     * @param  value [Set to the nearness, or distance for sgmd]
+     * @param  error [Set to why the pair could not be computed]
+     * @return       [False if the pair could not be computed]
+     */
+    bool pair(
+        const unsigned int i,
+        const unsigned int j,
+        float &value,
+        std::string &error) {
+
+        if (!prepare(error) || !single(error)) return false;
+        if (i >= size() || j >= size()) {
+            error = "object out of range";
+            return false;
+        }
+
+        // as in a run the object read earlier goes first, for a copy read
+        // out of order that can be the later of the two unique objects
+        unsigned int first = std::min(i, j);
+        unsigned int second = std::max(i, j);
+        unsigned int a = corpus.representatives.empty() ? first : corpus.representatives[first];
+        unsigned int b = corpus.representatives.empty() ? second : corpus.representatives[second];
+
+        if (settings.measure == "sgmd") {
+            hungarian_problem_t hungarian;
+            value = a == b ? 0
+                : pair_distance_sgmd(corpus.degrees[a], corpus.degrees[b], &hungarian);
+        }
+        else if (a == b) {
+            value = corpus.objects[a].empty() ? 0 : 1;
+        }
+        else {
+            value = pair_nearness_mce(corpus.objects[a], corpus.objects[b],
+                corpus.partial_graphs[a], corpus.partial_graphs[b],
+                corpus.indices.empty() ? NULL : &corpus.indices[b],
+                settings.epsilon, settings.num_features, settings.singletons);
+        }
+        return true;
+    }
+
+    /**
+     * The nearness between two objects outside the corpus.
+     * @param  features_a [The feature values of the first object]
+     * @param  features_b [The feature values of the second object]
+     * @param  value      [Set to the nearness, or distance for sgmd]
+     * @param  error      [Set to why the pair could not be computed]
+     * @return            [False if the pair could not be computed]
+     */
+    bool nearness(
+        const Object &features_a,
+        const Object &features_b,
+        float &value,
+        std::string &error) const {
+
+        if (!valid(error)
+            || !check_object(features_a, error)
+            || !check_object(features_b, error)) {
+            return false;
+        }
+
+        Object a(features_a);
+        Object b(features_b);
+        std::vector<IdSet> graph_a, graph_b;
+        std::vector<int> degrees_a, degrees_b;
+        object_graph(a, settings.epsilon, settings.num_features, graph_a, degrees_a);
+        object_graph(b, settings.epsilon, settings.num_features, graph_b, degrees_b);
+
+        if (settings.measure == "sgmd") {
+            hungarian_problem_t hungarian;
+            value = pair_distance_sgmd(degrees_a, degrees_b, &hungarian);
+        }
+        else {
+            value = pair_nearness_mce(a, b, graph_a, graph_b, NULL,
+                settings.epsilon, settings.num_features, settings.singletons);
+        }
+        return true;
+    }
+
+    /**
+     * Compute every pair of the corpus, sending each row to a sink as it is
+     * completed. Rows of copies of an object are sent once every row is
+     * complete when deduplicating.
+     * @param  results [The sink to send rows to, must allow rows to be added
+     *                  concurrently when computing with several threads]
+     * @param  error   [Set to why the corpus could not be computed]
+     * @return         [False if the corpus could not be computed]
+     */
+    bool run(ResultSink &results, std::string &error) {
+        if (!prepare(error) || !single(error)) return false;
+
+        std::vector<ResultSink *> sinks(1, &results);
+        std::vector<float> self_values(corpus.size(), 0);
+        for (unsigned int i = 0; settings.measure == "mce" && i < corpus.size(); ++i) {
+            self_values[i] = corpus.objects[i].empty() ? 0 : 1;
+        }
+        std::vector<DuplicateResults *> duplicates = create_duplicate_results(corpus, self_values, sinks);
+
+        Progress progress(0);
+        boost::threadpool::pool threadpool(settings.num_threads);
+        for (unsigned int i = 0; i < corpus.size(); ++i) {
+            if (settings.measure == "sgmd") {
+                threadpool.schedule(
+                    boost::bind(nearness_task_sgmd,
+                        i,
+                        boost::ref(corpus.degrees), boost::ref(*sinks[0]),
+                        (const std::vector<std::vector<int> > *)NULL, settings.max_distance,
+                        (const PairCache *)NULL, boost::ref(progress)));
+            }
+            else {
+                threadpool.schedule(
+                    boost::bind(nearness_task_mce,
+                        i,
+                        boost::ref(corpus), boost::ref(*sinks[0]),
+                        settings.epsilon, settings.num_features, settings.singletons,
+                        Pruning(), (const PairCache *)NULL, boost::ref(progress)));
+            }
+        }
+        threadpool.wait();
+
+        if (settings.measure == "mce") {
+            reverse_duplicate_pairs(corpus, duplicates, std::vector<float>(1, settings.epsilon),
+                settings.num_features, settings.singletons, 0, settings.num_threads);
+        }
+        finish_duplicate_results(duplicates, sinks);
+        return true;
+    }
+
+    /**
+     * Find the nearness of an object outside the corpus to every object of
+     * the corpus.
+     * @param  features [The feature values of the object]
+     * @param  top_k    [The number of nearest objects to return, 0 for every
+     *                  object in the order added]
+     * @param  answer   [Set to the nearness to each object returned]
+     * @param  error    [Set to why the query could not be answered]
+     * @return          [False if the query could not be answered]
+     */
+    bool query(
+        const Object &features,
+        const unsigned int top_k,
+        std::vector<QueryEntry> &answer,
+        std::string &error) {
+
+        if (!prepare(error) || !single(error) || !check_object(features, error)) return false;
+
+        // the nearest images by sgmd are found without comparing every image
+        if (settings.measure == "sgmd") {
+            boost::mutex::scoped_lock lock(prepare_mutex);
+            if (index == NULL) index = new DegreeIndex(corpus.degrees);
+        }
+
+        Object copy(features);
+        return answer_query(copy, top_k, answer, error, corpus, settings, index);
+    }
+
+    /**
+     * Compute every pair of the corpus at each epsilon and write them as the
+     * command line tool does, with all the ways it can compute and store a
+     * run.
+     * @param  outputs [The name of the output file of each epsilon]
+     * @param  options [How the run is computed and stored]
+     * @param  error   [Set to why the corpus could not be computed]
+     * @return         [False if the corpus could not be computed]
+     */
+    bool write(
+        std::vector<std::string> &outputs,
+        const WriteOptions &options,
+        std::string &error) {
+
+        if (!prepare(error)) return false;
+        if (outputs.size() != epsilons.size()) {
+            error = "an output is needed for each epsilon";
+            return false;
+        }
+
+        if (settings.measure == "mce") {
+            run_mce(corpus, outputs, epsilons, settings.num_features, settings.singletons,
+                settings.num_threads, options.num_processes, options.output, options.grid_dims,
+                settings.min_nearness, options.pair_cache, options.checkpoint, options.resume,
+                options.shard, options.server);
+        }
+        else {
+            run_sgmd(corpus, outputs, epsilons, settings.num_features,
+                settings.num_threads, options.num_processes, options.output,
+                settings.max_distance, options.pair_cache, options.checkpoint, options.resume,
+                options.shard, options.server);
+        }
+        return true;
+    }
+
+    /**
+     * Compute and write only the pairs of objects at most a width apart in
+     * the order added.
+     * @param  output  [The name of the output file]
+     * @param  options [How results are stored and written]
+     * @param  width   [How far apart the objects of a pair can be]
+     * @param  error   [Set to why the band could not be computed]
+     * @return         [False if the band could not be computed]
+     */
+    bool write_band(
+        std::string &output,
+        const OutputOptions &options,
+        const unsigned int width,
+        std::string &error) {
+
+        if (!prepare(error) || !single(error)) return false;
+        run_band(corpus, output, settings, options, width);
+        return true;
+    }
+
+    /**
+     * Compute and write only the pairs of an object of this engine, the
+     * queries, and one of another, the references.
+     * @param  references [The engine holding the references]
+     * @param  output     [The name of the output file]
+     * @param  options    [How results are stored and written]
+     * @param  error      [Set to why the rectangle could not be computed]
+     * @return            [False if the rectangle could not be computed]
+     */
+    bool write_rectangle(
+        NearnessEngine &references,
+        std::string &output,
+        const OutputOptions &options,
+        std::string &error) {
+
+        if (!prepare(error) || !single(error)
+            || !references.prepare(error) || !references.single(error)) {
+            return false;
+        }
+        run_rectangle(corpus, references.corpus, output, settings, options);
+        return true;
+    }
+
+    /**
+     * The corpus, prepared when the settings are valid.
+     */
+    Corpus &objects() {
+        std::string error;
+        prepare(error);
+        return corpus;
+    }
+
+private:
+
+    /**
+     * Whether the settings given to the constructor can be computed with.
+     * @param  error [Set to why they can not]
+     * @return       [False if they can not]
+     */
+    bool valid(std::string &error) const {
+        if (settings.num_features == 0) {
+            error = "number of features must be positive";
+            return false;
+        }
+        if (epsilons.empty() || !(epsilons.front() > 0)) {
+            error = "epsilon must be positive";
+            return false;
+        }
+        if (settings.measure != "mce" && settings.measure != "sgmd") {
+            error = "unknown measure '" + settings.measure + "'";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Whether a single epsilon is computed, rather than a sweep which can only
+     * be written.
+     * @param  error [Set to why not]
+     * @return       [False if not]
+     */
+    bool single(std::string &error) const {
+        if (epsilons.size() != 1) {
+            error = "a sweep of several epsilons can only be written";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Whether an object has a whole number of features.
+     * @param  features [The feature values of the object]
+     * @param  error    [Set to why it does not]
+     * @return          [False if it does not]
+     */
+    bool check_object(const Object &features, std::string &error) const {
+        if (features.size() % settings.num_features != 0) {
+            error = "object size is not a multiple of the number of features";
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Restore the objects as added before new objects are added.
+     */
+    void unprepare() {
+        if (prepared && !corpus.representatives.empty()) {
+            std::vector<Object> all(corpus.representatives.size());
+            for (unsigned int r = 0; r < all.size(); ++r) {
+                all[r] = corpus.objects[corpus.representatives[r]];
+            }
+            corpus.objects.swap(all);
+            corpus.representatives.clear();
+        }
+        prepared = false;
+    }
+
+    QuerySettings settings;
+    std::vector<float> epsilons;
+    bool spatial_index;
+    bool deduplicate;
+    const GraphCache *cache;
+    bool prepared;
+    Corpus corpus;
+
+    // the sorted degrees of the corpus when the measure is sgmd
+    DegreeIndex *index;
+
+    // held while preparing so only one caller prepares the corpus
+    boost::mutex prepare_mutex;
+};
+
+} // namespace nearness
+
+// the debug and timing macros are only for the library itself
+#undef d
+#undef d_var
+#undef d_clique_var
+#undef create_timing
+#undef start_timing
+#undef stop_timing
+#undef get_timing
+#undef report_timing
+
+#endif
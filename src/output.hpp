@@ -0,0 +1,1062 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_OUTPUT
+#define NEARNESS_OUTPUT
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include "boost/threadpool.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <cfloat>
+#include <stdint.h>
+#include <assert.h>
+#include <zlib.h>
+
+#include "results.hpp"
+#include "topk.hpp"
+#include "cluster.hpp"
+
+namespace nearness {
+
+/**
+ * The formats results can be written in.
+ * text   - lines of i \t j \t value
+ * exact  - text with each value written with the fewest digits that read back
+ *          as exactly the same float, rather than to 6 significant digits
+ * binary - a BinaryHeader followed by the packed upper triangle as floats
+ *
+ * Either can be written sparse, leaving out every pair with a nearness of 0.
+ * Sparse text gives each remaining pair once as i < j. Sparse binary gives
+ * each row as a uint32 count followed by that many (uint32 j, float value)
+ * entries.
+ *
+ * Top k results are written with the same layout as sparse rows, except each
+ * row holds the k nearest objects to i in both directions, nearest first.
+ *
+ * Either can also be compressed, in which case the file is a series of
+ * gzip members, one per block, which together decompress as one gzip stream.
+ *
+ * A shard of a run is always written as binary partial rows, a PartialHeader
+ * followed by its dense rows, to be merged into one of the above.
+ *
+ * Queries against references are written as a rectangle rather than a
+ * triangle. Text gives every pair as q \t r \t value, binary is a
+ * RectangleHeader followed by the row of each query in full.
+ *
+ * A band of a sequence is written like the triangle restricted to the pairs
+ * at most its width apart. Text gives each of these pairs in both orders,
+ * binary is a BandHeader followed by row i as the values of i + 1 ...
+ * min(i + width, n - 1).
+ *
+ * Clusters are written in place of the nearness. Components give a line of
+ * i \t label for each object, or as binary a uint32 label for each. Single
+ * linkage gives a line of a \t b \t value \t size for each merge, or as
+ * binary a uint32 count followed by each as a ClusterMerge.
+ */
+enum OutputFormat {
+    OUTPUT_TEXT,
+    OUTPUT_EXACT_TEXT,
+    OUTPUT_BINARY
+};
+
+// Identifies binary result files
+const char BINARY_MAGIC[4] = {'N', 'R', 'N', 'S'};
+const uint32_t BINARY_VERSION = 1;
+
+// The layouts of values following a binary header
+const uint32_t LAYOUT_TRIANGLE = 0;
+const uint32_t LAYOUT_SPARSE_ROWS = 1;
+const uint32_t LAYOUT_TOP_K = 2;
+const uint32_t LAYOUT_PARTIAL_ROWS = 3;
+const uint32_t LAYOUT_RECTANGLE = 4;
+const uint32_t LAYOUT_BAND = 5;
+const uint32_t LAYOUT_LABELS = 6;
+const uint32_t LAYOUT_DENDROGRAM = 7;
+
+/**
+ * Header written at the start of binary result files.
+ */
+struct BinaryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_objects;
+    uint32_t layout;
+};
+
+/**
+ * Follows the BinaryHeader of a rectangle, whose num_objects is the number of
+ * queries.
+ */
+struct RectangleHeader {
+    uint32_t num_references;
+    uint32_t reserved;
+};
+
+/**
+ * Follows the BinaryHeader of a band, giving how far apart the objects of a
+ * pair can be.
+ */
+struct BandHeader {
+    uint32_t width;
+    uint32_t reserved;
+};
+
+/**
+ * Parse the name of an output format.
+ * @param  name   [Either 'text', 'exact' or 'binary']
+ * @param  format [The format to write to]
+ * @return        [False if the name is not a format]
+ */
+inline bool parse_output_format(const std::string &name, OutputFormat &format) {
+    if (name == "text") {
+        format = OUTPUT_TEXT;
+    }
+    else if (name == "exact") {
+        format = OUTPUT_EXACT_TEXT;
+    }
+    else if (name == "binary") {
+        format = OUTPUT_BINARY;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * The mode to open an output file with. Binary and compressed files must not
+ * have their line endings translated.
+ */
+inline std::ios_base::openmode output_mode(
+    const OutputFormat format,
+    const int compress_level = 0) {
+
+    std::ios_base::openmode mode = std::ofstream::trunc;
+    if (format == OUTPUT_BINARY || compress_level > 0) mode |= std::ofstream::binary;
+    return mode;
+}
+
+/**
+ * Format an unsigned integer as text.
+ * @param  p     [Where to write the digits]
+ * @param  value [The value to format]
+ * @return       [The end of the written digits]
+ */
+inline char *format_uint(char *p, unsigned int value) {
+    char digits[16];
+    int count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    while (count > 0) *p++ = digits[--count];
+    return p;
+}
+
+/**
+ * Format a float as text. Text is written to 6 significant digits as an
+ * iostream writes it, exact text with the fewest digits that read back as
+ * exactly the same float. Zero and small integers, which make up most values,
+ * skip printf.
+ * @param  p      [Where to write the text, must have room for 32 characters]
+ * @param  value  [The value to format]
+ * @param  format [Either text or exact text]
+ * @return        [The end of the written text]
+ */
+inline char *format_float(char *p, const float value, const OutputFormat format) {
+    if (value == 0) {
+        *p++ = '0';
+        return p;
+    }
+
+    // nan and infinity can not be round tripped
+    if (value != value || std::fabs(value) > FLT_MAX) {
+        return p + std::sprintf(p, "%g", value);
+    }
+
+    // integers of up to 6 digits are written in full by both
+    if (std::fabs(value) < 1e6f && value == (float)(int)value) {
+        if (value < 0) *p++ = '-';
+        return format_uint(p, (unsigned int)std::fabs(value));
+    }
+
+    if (format != OUTPUT_EXACT_TEXT) {
+        return p + std::sprintf(p, "%g", value);
+    }
+
+    // most values either need few digits or all 9, so start in the middle and
+    // search towards whichever end the value is
+    char buffer[32];
+    int precision = 6;
+    int length = std::sprintf(buffer, "%.*g", precision, value);
+    if (strtof(buffer, NULL) == value) {
+        char shorter[32];
+        while (precision > 1) {
+            int shorter_length = std::sprintf(shorter, "%.*g", precision - 1, value);
+            if (strtof(shorter, NULL) != value) break;
+            std::memcpy(buffer, shorter, shorter_length);
+            length = shorter_length;
+            --precision;
+        }
+    }
+    else {
+        while (precision < 9) {
+            ++precision;
+            length = std::sprintf(buffer, "%.*g", precision, value);
+            if (strtof(buffer, NULL) == value) break;
+        }
+    }
+
+    std::memcpy(p, buffer, length);
+    return p + length;
+}
+
+/**
+ * Append one line of text output.
+ * @param buffer [The buffer to append to]
+ * @param format [Either text or exact text]
+ * @param i      [The first object]
+ * @param j      [The second object]
+ * @param value  [The nearness between the objects]
+ */
+inline void format_line(
+    std::string &buffer,
+    const OutputFormat format,
+    const unsigned int i,
+    const unsigned int j,
+    const float value) {
+
+    char line[64];
+    char *p = format_uint(line, i);
+    *p++ = '\t';
+    p = format_uint(p, j);
+    *p++ = '\t';
+    p = format_float(p, value, format);
+    *p++ = '\n';
+    buffer.append(line, p - line);
+}
+
+/**
+ * Append the header of a binary result file.
+ * @param buffer      [The buffer to append to]
+ * @param num_objects [The number of objects]
+ * @param layout      [The layout of the values following the header]
+ */
+inline void format_binary_header(
+    std::string &buffer,
+    const unsigned int num_objects,
+    const uint32_t layout) {
+
+    BinaryHeader header;
+    std::memcpy(header.magic, BINARY_MAGIC, sizeof header.magic);
+    header.version = BINARY_VERSION;
+    header.num_objects = num_objects;
+    header.layout = layout;
+    buffer.append((const char *)&header, sizeof header);
+}
+
+/**
+ * Append the non-zero entries of one row of the upper triangle.
+ * @param buffer  [The buffer to append to]
+ * @param format  [The format to write in]
+ * @param i       [The row]
+ * @param entries [The non-zero entries of the row ordered by j]
+ */
+inline void format_sparse_row(
+    std::string &buffer,
+    const OutputFormat format,
+    const unsigned int i,
+    const std::vector<SparseEntry> &entries) {
+
+    if (format == OUTPUT_BINARY) {
+        uint32_t count = entries.size();
+        buffer.append((const char *)&count, sizeof count);
+        for (unsigned int l = 0; l < entries.size(); ++l) {
+            buffer.append((const char *)&entries[l].j, sizeof entries[l].j);
+            buffer.append((const char *)&entries[l].value, sizeof entries[l].value);
+        }
+    }
+    else {
+        for (unsigned int l = 0; l < entries.size(); ++l) {
+            format_line(buffer, format, i, entries[l].j, entries[l].value);
+        }
+    }
+}
+
+/**
+ * Append one row of the upper triangle. Text rows give each pair once as
+ * i \t j \t value, binary rows are the raw floats.
+ * @param buffer [The buffer to append to]
+ * @param format [The format to write in]
+ * @param i      [The row]
+ * @param row    [The nearness from i to objects i + 1 ... n - 1]
+ * @param sparse [Whether to leave out pairs with a nearness of 0]
+ */
+inline void format_row(
+    std::string &buffer,
+    const OutputFormat format,
+    const unsigned int i,
+    const Result &row,
+    const bool sparse = false) {
+
+    if (sparse) {
+        std::vector<SparseEntry> entries;
+        for (unsigned int l = 0; l < row.size(); ++l) {
+            if (row[l] != 0) entries.push_back(SparseEntry(i + 1 + l, row[l]));
+        }
+        format_sparse_row(buffer, format, i, entries);
+    }
+    else if (format == OUTPUT_BINARY) {
+        if (!row.empty()) {
+            buffer.append((const char *)&row.front(), row.size() * sizeof(float));
+        }
+    }
+    else {
+        for (unsigned int l = 0; l < row.size(); ++l) {
+            format_line(buffer, format, i, i + 1 + l, row[l]);
+        }
+    }
+}
+
+/**
+ * Append rows [first, last) of a dense triangle.
+ * @param buffer  [The buffer to append to]
+ * @param results [The nearness values to write]
+ * @param format  [The format to write in]
+ * @param first   [The first row]
+ * @param last    [One past the last row]
+ */
+inline void format_dense_rows(
+    std::string &buffer,
+    TriangleResults &results,
+    const OutputFormat format,
+    const unsigned int first,
+    const unsigned int last) {
+
+    for (unsigned int i = first; i < last; ++i) {
+        if (format == OUTPUT_BINARY) {
+            Result row(results.size() - i - 1);
+            for (unsigned int l = 0; l < row.size(); ++l) {
+                row[l] = results.get(i, i + 1 + l);
+            }
+            format_row(buffer, format, i, row);
+        }
+        else {
+            // every pair in both orders, the triangle is symmetric so
+            // [i][j] == [j][i]
+            for (unsigned int j = 0; j < results.size(); ++j) {
+                format_line(buffer, format, i, j, results.get(i, j));
+            }
+        }
+    }
+}
+
+/**
+ * Append rows [first, last) of a sparse triangle.
+ * @param buffer  [The buffer to append to]
+ * @param results [The nearness values to write]
+ * @param format  [The format to write in]
+ * @param first   [The first row]
+ * @param last    [One past the last row]
+ */
+inline void format_sparse_rows(
+    std::string &buffer,
+    SparseResults &results,
+    const OutputFormat format,
+    const unsigned int first,
+    const unsigned int last) {
+
+    for (unsigned int i = first; i < last; ++i) {
+        format_sparse_row(buffer, format, i, results.row(i));
+    }
+}
+
+/**
+ * Append rows [first, last) of the nearest objects to each object.
+ * @param buffer  [The buffer to append to]
+ * @param results [The nearest objects to write]
+ * @param format  [The format to write in]
+ * @param first   [The first row]
+ * @param last    [One past the last row]
+ */
+inline void format_top_k_rows(
+    std::string &buffer,
+    TopKResults &results,
+    const OutputFormat format,
+    const unsigned int first,
+    const unsigned int last) {
+
+    for (unsigned int i = first; i < last; ++i) {
+        const std::vector<Neighbour> &nearest = results.row(i);
+        std::vector<SparseEntry> entries;
+        for (unsigned int l = 0; l < nearest.size(); ++l) {
+            entries.push_back(SparseEntry(nearest[l].j, nearest[l].value));
+        }
+        format_sparse_row(buffer, format, i, entries);
+    }
+}
+
+/**
+ * Append rows [first, last) of a rectangle, each the values of one query.
+ * @param buffer  [The buffer to append to]
+ * @param results [The nearness values to write]
+ * @param format  [The format to write in]
+ * @param first   [The first query]
+ * @param last    [One past the last query]
+ */
+inline void format_rectangle_rows(
+    std::string &buffer,
+    RectangleResults &results,
+    const OutputFormat format,
+    const unsigned int first,
+    const unsigned int last) {
+
+    for (unsigned int q = first; q < last; ++q) {
+        const float *row = results.row(q);
+        if (format == OUTPUT_BINARY) {
+            if (results.references() > 0) {
+                buffer.append((const char *)row, results.references() * sizeof(float));
+            }
+        }
+        else {
+            for (unsigned int r = 0; r < results.references(); ++r) {
+                format_line(buffer, format, q, r, row[r]);
+            }
+        }
+    }
+}
+
+/**
+ * Append rows [first, last) of a band.
+ * @param buffer  [The buffer to append to]
+ * @param results [The nearness values to write]
+ * @param format  [The format to write in]
+ * @param first   [The first row]
+ * @param last    [One past the last row]
+ */
+inline void format_band_rows(
+    std::string &buffer,
+    BandResults &results,
+    const OutputFormat format,
+    const unsigned int first,
+    const unsigned int last) {
+
+    unsigned int width = results.band_width();
+    for (unsigned int i = first; i < last; ++i) {
+        if (format == OUTPUT_BINARY) {
+            if (results.row_size(i) > 0) {
+                buffer.append((const char *)results.row(i), results.row_size(i) * sizeof(float));
+            }
+        }
+        else {
+            // every pair within the band in both orders
+            unsigned int j = i > width ? i - width : 0;
+            for (; j <= i + results.row_size(i); ++j) {
+                format_line(buffer, format, i, j, results.get(i, j));
+            }
+        }
+    }
+}
+
+// The rough number of bytes formatted by each task when writing in parallel
+const size_t FORMAT_BLOCK_BYTES = 1 << 22;
+
+typedef boost::function<void(std::string &, unsigned int, unsigned int)> RowFormatter;
+
+/**
+ * Compress a block as a complete gzip member and append it to a buffer.
+ * Members written one after another decompress as a single gzip stream, so
+ * blocks can be compressed independently on different threads.
+ * @param in    [The bytes to compress]
+ * @param out   [The buffer to append the gzip member to]
+ * @param level [The zlib compression level in [1, 9]]
+ */
+inline void compress_block(
+    const std::string &in,
+    std::string &out,
+    const int level) {
+
+    // an empty member would only add a header
+    if (in.empty()) return;
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof stream);
+
+    // 16 added to the window bits selects a gzip wrapper
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        std::cerr << "error: Could not initialize compression" << std::endl;
+        assert(false);
+    }
+
+    size_t start = out.size();
+    out.resize(start + deflateBound(&stream, in.size()) + 32);
+
+    stream.next_in = (Bytef *)in.data();
+    stream.avail_in = in.size();
+    stream.next_out = (Bytef *)&out[start];
+    stream.avail_out = out.size() - start;
+
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+        std::cerr << "error: Could not compress output" << std::endl;
+        assert(false);
+    }
+
+    out.resize(start + stream.total_out);
+    deflateEnd(&stream);
+}
+
+/**
+ * Format rows [first, last) then compress them as one block.
+ * @param format_rows [Appends rows [first, last) to a buffer]
+ * @param level       [The zlib compression level]
+ * @param buffer      [The buffer to append the compressed block to]
+ * @param first       [The first row]
+ * @param last        [One past the last row]
+ */
+inline void format_compressed(
+    RowFormatter format_rows,
+    const int level,
+    std::string &buffer,
+    const unsigned int first,
+    const unsigned int last) {
+
+    std::string plain;
+    format_rows(plain, first, last);
+    compress_block(plain, buffer, level);
+}
+
+/**
+ * Write a block, compressing it first if requested.
+ * @param out            [The stream to write to]
+ * @param block          [The bytes to write]
+ * @param compress_level [The zlib compression level, 0 to not compress]
+ */
+inline void write_block(
+    std::ostream &out,
+    const std::string &block,
+    const int compress_level) {
+
+    if (compress_level > 0) {
+        std::string compressed;
+        compress_block(block, compressed, compress_level);
+        out.write(compressed.data(), compressed.size());
+    }
+    else {
+        out.write(block.data(), block.size());
+    }
+}
+
+/**
+ * Schedule formatting the next block of rows into each buffer.
+ * @param  threadpool  [The threadpool to format on]
+ * @param  buffers     [The buffers to format into, one block each]
+ * @param  row         [The first row to format]
+ * @param  num_rows    [The number of rows to write]
+ * @param  block_rows  [The number of rows per block]
+ * @param  format_rows [Appends rows [first, last) to a buffer]
+ * @return             [The first row not scheduled]
+ */
+inline unsigned int schedule_blocks(
+    boost::threadpool::pool &threadpool,
+    std::vector<std::string> &buffers,
+    unsigned int row,
+    const unsigned int num_rows,
+    const unsigned int block_rows,
+    RowFormatter &format_rows) {
+
+    for (unsigned int b = 0; b < buffers.size(); ++b) {
+        buffers[b].clear();
+        if (row >= num_rows) continue;
+        unsigned int last = std::min(num_rows, row + block_rows);
+        threadpool.schedule(boost::bind(format_rows, boost::ref(buffers[b]), row, last));
+        row = last;
+    }
+    return row;
+}
+
+/**
+ * Formats rows into blocks on a threadpool and writes the blocks in order
+ * with one large write each. The next batch of blocks is formatted while the
+ * previous batch is written.
+ * @param out          [The stream to write to]
+ * @param num_rows     [The number of rows to write]
+ * @param row_bytes    [The rough number of bytes in each row]
+ * @param format_rows  [Appends rows [first, last) to a buffer]
+ * @param num_threads  [The number of threads to format with]
+ */
+inline void output_parallel(
+    std::ostream &out,
+    const unsigned int num_rows,
+    const size_t row_bytes,
+    RowFormatter format_rows,
+    const unsigned int num_threads) {
+
+    unsigned int block_rows = std::max<size_t>(1, FORMAT_BLOCK_BYTES / std::max<size_t>(1, row_bytes));
+
+    if (num_threads <= 1) {
+        std::string buffer;
+        for (unsigned int first = 0; first < num_rows; first += block_rows) {
+            buffer.clear();
+            format_rows(buffer, first, std::min(num_rows, first + block_rows));
+            out.write(buffer.data(), buffer.size());
+        }
+        return;
+    }
+
+    boost::threadpool::pool threadpool(num_threads);
+    std::vector<std::string> current(num_threads);
+    std::vector<std::string> next(num_threads);
+
+    unsigned int row = schedule_blocks(threadpool, current, 0, num_rows, block_rows, format_rows);
+    threadpool.wait();
+
+    while (true) {
+        bool more = row < num_rows;
+        if (more) {
+            row = schedule_blocks(threadpool, next, row, num_rows, block_rows, format_rows);
+        }
+
+        for (unsigned int b = 0; b < current.size(); ++b) {
+            out.write(current[b].data(), current[b].size());
+        }
+
+        if (!more) break;
+        threadpool.wait();
+        current.swap(next);
+    }
+}
+
+/**
+ * Writes nearness values to the given file. Text is written in the form
+ * i \t j \t value for every pair in both orders, binary as the packed upper
+ * triangle.
+ * @param out            [The path to the write to]
+ * @param results        [The nearness values to write]
+ * @param format         [The format to write in]
+ * @param num_threads    [The number of threads to format with]
+ * @param compress_level [The zlib compression level, 0 to not compress]
+ */
+inline void output_results(
+    std::string &out,
+    TriangleResults &results,
+    const OutputFormat format = OUTPUT_TEXT,
+    const unsigned int num_threads = 1,
+    const int compress_level = 0) {
+
+    std::ofstream out_file(out.c_str(), output_mode(format, compress_level));
+
+    std::string header;
+    if (format == OUTPUT_BINARY) {
+        format_binary_header(header, results.size(), LAYOUT_TRIANGLE);
+    }
+    write_block(out_file, header, compress_level);
+
+    RowFormatter format_rows = boost::bind(format_dense_rows,
+        _1, boost::ref(results), format, _2, _3);
+    if (compress_level > 0) {
+        format_rows = boost::bind(format_compressed, format_rows, compress_level, _1, _2, _3);
+    }
+
+    // roughly 16 characters per text line
+    size_t row_bytes = (size_t)results.size() * (format == OUTPUT_BINARY ? sizeof(float) : 16);
+    output_parallel(out_file, results.size(), row_bytes, format_rows, num_threads);
+
+    out_file.close();
+}
+
+/**
+ * Writes the non-zero nearness values to the given file.
+ * @param out            [The path to the write to]
+ * @param results        [The nearness values to write]
+ * @param format         [The format to write in]
+ * @param num_threads    [The number of threads to format with]
+ * @param compress_level [The zlib compression level, 0 to not compress]
+ */
+inline void output_results(
+    std::string &out,
+    SparseResults &results,
+    const OutputFormat format = OUTPUT_TEXT,
+    const unsigned int num_threads = 1,
+    const int compress_level = 0) {
+
+    std::ofstream out_file(out.c_str(), output_mode(format, compress_level));
+
+    std::string header;
+    if (format == OUTPUT_BINARY) {
+        format_binary_header(header, results.size(), LAYOUT_SPARSE_ROWS);
+    }
+    write_block(out_file, header, compress_level);
+
+    RowFormatter format_rows = boost::bind(format_sparse_rows,
+        _1, boost::ref(results), format, _2, _3);
+    if (compress_level > 0) {
+        format_rows = boost::bind(format_compressed, format_rows, compress_level, _1, _2, _3);
+    }
+
+    size_t row_bytes = results.size() > 0
+        ? 1 + results.non_zero() * 24 / results.size() : 1;
+    output_parallel(out_file, results.size(), row_bytes, format_rows, num_threads);
+
+    out_file.close();
+}
+
+/**
+ * Writes the nearest objects to each object to the given file.
+ * @param out            [The path to the write to]
+ * @param results        [The nearest objects to write, already merged]
+ * @param format         [The format to write in]
+ * @param num_threads    [The number of threads to format with]
+ * @param compress_level [The zlib compression level, 0 to not compress]
+ */
+inline void output_results(
+    std::string &out,
+    TopKResults &results,
+    const OutputFormat format = OUTPUT_TEXT,
+    const unsigned int num_threads = 1,
+    const int compress_level = 0) {
+
+    std::ofstream out_file(out.c_str(), output_mode(format, compress_level));
+
+    std::string header;
+    if (format == OUTPUT_BINARY) {
+        format_binary_header(header, results.size(), LAYOUT_TOP_K);
+    }
+    write_block(out_file, header, compress_level);
+
+    RowFormatter format_rows = boost::bind(format_top_k_rows,
+        _1, boost::ref(results), format, _2, _3);
+    if (compress_level > 0) {
+        format_rows = boost::bind(format_compressed, format_rows, compress_level, _1, _2, _3);
+    }
+
+    size_t row_bytes = results.size() > 0 ? 1 + results.row(0).size() * 24 : 1;
+    output_parallel(out_file, results.size(), row_bytes, format_rows, num_threads);
+
+    out_file.close();
+}
+
+/**
+ * Writes the nearness from each query to each reference to the given file.
+ * @param out            [The path to the write to]
+ * @param results        [The nearness values to write]
+ * @param format         [The format to write in]
+ * @param num_threads    [The number of threads to format with]
+ * @param compress_level [The zlib compression level, 0 to not compress]
+ */
+inline void output_results(
+    std::string &out,
+    RectangleResults &results,
+    const OutputFormat format = OUTPUT_TEXT,
+    const unsigned int num_threads = 1,
+    const int compress_level = 0) {
+
+    std::ofstream out_file(out.c_str(), output_mode(format, compress_level));
+
+    std::string header;
+    if (format == OUTPUT_BINARY) {
+        format_binary_header(header, results.queries(), LAYOUT_RECTANGLE);
+        RectangleHeader rectangle;
+        rectangle.num_references = results.references();
+        rectangle.reserved = 0;
+        header.append((const char *)&rectangle, sizeof rectangle);
+    }
+    write_block(out_file, header, compress_level);
+
+    RowFormatter format_rows = boost::bind(format_rectangle_rows,
+        _1, boost::ref(results), format, _2, _3);
+    if (compress_level > 0) {
+        format_rows = boost::bind(format_compressed, format_rows, compress_level, _1, _2, _3);
+    }
+
+    // roughly 16 characters per text line
+    size_t row_bytes = (size_t)results.references() * (format == OUTPUT_BINARY ? sizeof(float) : 16);
+    output_parallel(out_file, results.queries(), row_bytes, format_rows, num_threads);
+
+    out_file.close();
+}
+
+/**
+ * Writes the nearness between the objects of a band to the given file.
+ * @param out            [The path to the write to]
+ * @param results        [The nearness values to write]
+ * @param format         [The format to write in]
+ * @param num_threads    [The number of threads to format with]
+ * @param compress_level [The zlib compression level, 0 to not compress]
+ */
+inline void output_results(
+    std::string &out,
+    BandResults &results,
+    const OutputFormat format = OUTPUT_TEXT,
+    const unsigned int num_threads = 1,
+    const int compress_level = 0) {
+
+    std::ofstream out_file(out.c_str(), output_mode(format, compress_level));
+
+    std::string header;
+    if (format == OUTPUT_BINARY) {
+        format_binary_header(header, results.size(), LAYOUT_BAND);
+        BandHeader band;
+        band.width = results.band_width();
+        band.reserved = 0;
+        header.append((const char *)&band, sizeof band);
+    }
+    write_block(out_file, header, compress_level);
+
+    RowFormatter format_rows = boost::bind(format_band_rows,
+        _1, boost::ref(results), format, _2, _3);
+    if (compress_level > 0) {
+        format_rows = boost::bind(format_compressed, format_rows, compress_level, _1, _2, _3);
+    }
+
+    // roughly 16 characters per text line, each pair written twice
+    size_t row_bytes = (size_t)results.band_width() * (format == OUTPUT_BINARY ? sizeof(float) : 32);
+    output_parallel(out_file, results.size(), row_bytes, format_rows, num_threads);
+
+    out_file.close();
+}
+
+/**
+ * Writes the clusters of the objects to the given file, the label of each
+ * object or the merges of the dendrogram.
+ * @param out            [The path to the write to]
+ * @param results        [The clusters to write, every row added]
+ * @param format         [The format to write in]
+ * @param compress_level [The zlib compression level, 0 to not compress]
+ */
+inline void output_results(
+    std::string &out,
+    ClusterResults &results,
+    const OutputFormat format = OUTPUT_TEXT,
+    const int compress_level = 0) {
+
+    std::ofstream out_file(out.c_str(), output_mode(format, compress_level));
+
+    std::string buffer;
+    char line[64];
+    if (results.cluster_method() == CLUSTER_COMPONENTS) {
+        std::vector<uint32_t> labels = results.labels();
+        if (format == OUTPUT_BINARY) {
+            format_binary_header(buffer, results.size(), LAYOUT_LABELS);
+            if (!labels.empty()) {
+                buffer.append((const char *)&labels.front(), labels.size() * sizeof(uint32_t));
+            }
+        }
+        else {
+            for (unsigned int i = 0; i < labels.size(); ++i) {
+                char *p = format_uint(line, i);
+                *p++ = '\t';
+                p = format_uint(p, labels[i]);
+                *p++ = '\n';
+                buffer.append(line, p - line);
+            }
+        }
+    }
+    else {
+        std::vector<ClusterMerge> merges = results.merges();
+        if (format == OUTPUT_BINARY) {
+            format_binary_header(buffer, results.size(), LAYOUT_DENDROGRAM);
+            uint32_t count = merges.size();
+            buffer.append((const char *)&count, sizeof count);
+            if (!merges.empty()) {
+                buffer.append((const char *)&merges.front(), merges.size() * sizeof(ClusterMerge));
+            }
+        }
+        else {
+            for (unsigned int k = 0; k < merges.size(); ++k) {
+                char *p = format_uint(line, merges[k].a);
+                *p++ = '\t';
+                p = format_uint(p, merges[k].b);
+                *p++ = '\t';
+                p = format_float(p, merges[k].value, format);
+                *p++ = '\t';
+                p = format_uint(p, merges[k].size);
+                *p++ = '\n';
+                buffer.append(line, p - line);
+            }
+        }
+    }
+    write_block(out_file, buffer, compress_level);
+
+    out_file.close();
+}
+
+/**
+ * Writes rows to a file as tasks complete them instead of holding every
+ * result in memory. Completed rows are handed to a dedicated writer thread
+ * which writes them in row order, so only the upper triangle is written and
+ * whatever rows were written survive if the run is killed.
+ *
+ * Rows are formatted by the task that completed them, so this happens in
+ * parallel and the writer thread only has to write. If compressing, the
+ * writer gathers rows into blocks of FORMAT_BLOCK_BYTES and writes each as a
+ * gzip member, as the other outputs do, so a partial file still decompresses
+ * to every row before the last whole block. At most capacity rows are
+ * buffered, tasks adding later rows
+ * block until the writer catches up. The next row to be written is always
+ * accepted so tasks scheduled in row order can not deadlock.
+ */
+class StreamingWriter : public ResultSink {
+public:
+
+    /**
+     * @param out         [The path to write to]
+     * @param format      [The format to write in]
+     * @param num_objects [The number of objects, and so rows, to expect]
+     * @param capacity    [The maximum number of rows to buffer]
+     * @param sparse      [Whether to leave out pairs with a nearness of 0]
+     * @param compress_level [The zlib compression level, 0 to not compress]
+     */
+    StreamingWriter(
+        const std::string &out,
+        const OutputFormat format,
+        const unsigned int num_objects,
+        const unsigned int capacity,
+        const bool sparse = false,
+        const int compress_level = 0) :
+        out_file(out.c_str(), output_mode(format, compress_level)),
+        format(format),
+        sparse(sparse),
+        compress_level(compress_level),
+        num_objects(num_objects),
+        capacity(capacity > 0 ? capacity : 1),
+        next(0) {
+
+        if (format == OUTPUT_BINARY) {
+            std::string header;
+            format_binary_header(header, num_objects,
+                sparse ? LAYOUT_SPARSE_ROWS : LAYOUT_TRIANGLE);
+            write_block(out_file, header, compress_level);
+        }
+        out_file.flush();
+
+        writer = boost::thread(boost::bind(&StreamingWriter::run, this));
+    }
+
+    ~StreamingWriter() {
+        finish();
+    }
+
+    void add_row(const unsigned int i, const Result &row) {
+        std::string buffer;
+        format_row(buffer, format, i, row, sparse);
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (i != next && pending.size() >= capacity) {
+            not_full.wait(lock);
+        }
+        pending[i].swap(buffer);
+        ready.notify_one();
+    }
+
+    /**
+     * Wait for every row to be written then close the file. Must only be
+     * called once every row has been added.
+     */
+    void finish() {
+        if (writer.joinable()) {
+            writer.join();
+            out_file.close();
+        }
+    }
+
+private:
+
+    /**
+     * Writer thread, writes rows in order as they become available and
+     * flushes whenever it runs out of work. Compressed rows are held until
+     * they fill a block.
+     */
+    void run() {
+        bool dirty = false;
+        std::string block;
+        boost::unique_lock<boost::mutex> lock(mutex);
+
+        while (next < num_objects) {
+            if (pending.empty() || pending.begin()->first != next) {
+                if (dirty) {
+                    lock.unlock();
+                    out_file.flush();
+                    dirty = false;
+                    lock.lock();
+                }
+                else {
+                    ready.wait(lock);
+                }
+                continue;
+            }
+
+            std::string buffer;
+            buffer.swap(pending.begin()->second);
+            pending.erase(pending.begin());
+            ++next;
+            not_full.notify_all();
+
+            lock.unlock();
+            if (compress_level == 0) {
+                out_file.write(buffer.data(), buffer.size());
+                dirty = true;
+            }
+            else {
+                block.append(buffer);
+                if (block.size() >= FORMAT_BLOCK_BYTES) {
+                    write_block(out_file, block, compress_level);
+                    block.clear();
+                    dirty = true;
+                }
+            }
+            lock.lock();
+        }
+
+        lock.unlock();
+        write_block(out_file, block, compress_level);
+        out_file.flush();
+    }
+
+    std::ofstream out_file;
+    OutputFormat format;
+    bool sparse;
+    int compress_level;
+    unsigned int num_objects;
+    unsigned int capacity;
+
+    // the next row to write
+    unsigned int next;
+
+    // rows that have been completed and formatted but not written
+    std::map<unsigned int, std::string> pending;
+
+    boost::mutex mutex;
+    boost::condition_variable ready;
+    boost::condition_variable not_full;
+    boost::thread writer;
+};
+
+} // namespace nearness
+
+#endif
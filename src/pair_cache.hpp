@@ -0,0 +1,242 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_PAIR_CACHE
+#define NEARNESS_PAIR_CACHE
+
+#include <boost/filesystem.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+#include "results.hpp"
+#include "graph_cache.hpp"
+
+namespace nearness {
+
+/**
+ * Header of a stored set of pair results. It is followed by the content hash
+ * of each object as a uint64_t, then the packed triangle of values in the
+ * order of TriangleResults. Each value was computed with the lower of its
+ * two objects first.
+ */
+struct PairCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t num_objects;
+    uint32_t reserved;
+};
+
+/**
+ * Persistent results of a measure keyed by the content hash of each object,
+ * so a run over a corpus that has had objects added, removed or changed only
+ * compares the pairs involving new content. The results of the last run with
+ * the same parameters are loaded, every pair of objects that both appear in
+ * them is looked up instead of computed, and the results of this run replace
+ * them once it completes.
+ *
+ * mce splits the combined graph of a pair in half, so when two objects differ
+ * in size the value depends on which is first. A stored mce pair is only
+ * used when its objects are in the same order as they were stored in.
+ *
+ * Rows pass through to the sink that writes the output, a copy of each is
+ * kept to be stored.
+ */
+class PairCache : public ResultSink {
+public:
+
+    static const uint32_t VERSION = 1;
+
+    /**
+     * @param directory  [The directory to keep results in, created if missing]
+     * @param parameters [Everything the values depend on besides the objects,
+     *                   such as the measure and epsilon]
+     * @param hashes     [The content hash of each object]
+     * @param symmetric  [Whether the value of a pair is the same in either
+     *                   order, as for sgmd]
+     * @param results    [The sink to pass rows on to, not owned]
+     */
+    PairCache(
+        const std::string &directory,
+        const std::string &parameters,
+        const std::vector<uint64_t> &hashes,
+        const bool symmetric,
+        ResultSink *results) :
+        symmetric(symmetric),
+        hashes(hashes),
+        previous(hashes.size(), -1),
+        stored(0),
+        current(hashes.size()),
+        results(results) {
+
+        boost::filesystem::create_directories(directory);
+
+        char name[32];
+        std::sprintf(name, "%016llx.pairs",
+            (unsigned long long)fnv1a(parameters.data(), parameters.size()));
+        file = (boost::filesystem::path(directory) / name).string();
+
+        load();
+    }
+
+    /**
+     * The stored nearness between objects i and j, if both were in the last
+     * run in the same order unless the measure is symmetric. Two copies of
+     * the same content share one stored object, the stored triangle has no
+     * value for the pair so it is computed.
+     * @param  i     [The first object, less than j]
+     * @param  j     [The second object]
+     * @param  value [Set to the stored nearness]
+     * @return       [False if the pair must be computed]
+     */
+    bool lookup(const unsigned int i, const unsigned int j, float &value) const {
+        if (previous[i] < 0 || previous[j] < 0 || previous[i] == previous[j]) return false;
+        if (!symmetric && previous[i] > previous[j]) return false;
+        value = stored.get(previous[i], previous[j]);
+        return true;
+    }
+
+    /**
+     * The number of objects found in the last run.
+     */
+    unsigned int known() const {
+        return hashes.size() - std::count(previous.begin(), previous.end(), -1);
+    }
+
+    void add_row(const unsigned int i, const Result &row) {
+        current.set_row(i, row);
+        results->add_row(i, row);
+    }
+
+    /**
+     * The sink rows are passed on to.
+     */
+    ResultSink *sink() const {
+        return results;
+    }
+
+    /**
+     * Replace the stored results with those of this run, once every row has
+     * been added. Written to a temporary file first so an interrupted save
+     * keeps the last results.
+     */
+    void save() const {
+        PairCacheHeader header;
+        std::memcpy(header.magic, "NRNP", 4);
+        header.version = VERSION;
+        header.num_objects = hashes.size();
+        header.reserved = 0;
+
+        std::string tmp = file + ".tmp";
+        {
+            std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&header), sizeof header);
+            if (!hashes.empty()) {
+                out.write(reinterpret_cast<const char *>(&hashes.front()),
+                    hashes.size() * sizeof(uint64_t));
+            }
+
+            Result row;
+            for (unsigned int i = 0; i < hashes.size(); ++i) {
+                row.resize(hashes.size() - i - 1);
+                for (unsigned int j = i + 1; j < hashes.size(); ++j) {
+                    row[j - i - 1] = current.get(i, j);
+                }
+                if (!row.empty()) {
+                    out.write(reinterpret_cast<const char *>(&row.front()),
+                        row.size() * sizeof(float));
+                }
+            }
+            if (!out) {
+                std::cerr << "warning: could not write pair cache '" << tmp << "'" << std::endl;
+                return;
+            }
+        }
+
+        boost::system::error_code error;
+        boost::filesystem::rename(tmp, file, error);
+        if (error) {
+            std::cerr << "warning: could not write pair cache '" << file << "'" << std::endl;
+        }
+    }
+
+private:
+
+    /**
+     * Load the results of the last run and match its objects to the current
+     * objects by content. A missing or malformed store is the same as an
+     * empty one.
+     */
+    void load() {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        if (!in) return;
+
+        PairCacheHeader header;
+        in.read(reinterpret_cast<char *>(&header), sizeof header);
+        if (!in || std::memcmp(header.magic, "NRNP", 4) != 0 || header.version != VERSION) {
+            return;
+        }
+
+        unsigned int n = header.num_objects;
+        std::vector<uint64_t> stored_hashes(n);
+        if (n > 0) {
+            in.read(reinterpret_cast<char *>(&stored_hashes.front()), n * sizeof(uint64_t));
+        }
+
+        TriangleResults values(n);
+        Result row;
+        for (unsigned int i = 0; i + 1 < n && in; ++i) {
+            row.resize(n - i - 1);
+            in.read(reinterpret_cast<char *>(&row.front()), row.size() * sizeof(float));
+            values.set_row(i, row);
+        }
+        if (!in) return;
+
+        boost::unordered_map<uint64_t, int> index;
+        for (unsigned int p = 0; p < n; ++p) {
+            index.insert(std::make_pair(stored_hashes[p], (int)p));
+        }
+        for (unsigned int i = 0; i < hashes.size(); ++i) {
+            boost::unordered_map<uint64_t, int>::const_iterator it = index.find(hashes[i]);
+            if (it != index.end()) previous[i] = it->second;
+        }
+
+        stored = values;
+    }
+
+    std::string file;
+    bool symmetric;
+
+    // the content hash of each current object
+    std::vector<uint64_t> hashes;
+
+    // the index of each current object in the stored results, -1 if new
+    std::vector<int> previous;
+
+    TriangleResults stored;
+    TriangleResults current;
+
+    ResultSink *results;
+};
+
+} // namespace nearness
+
+#endif
@@ -0,0 +1,299 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_QUERY_SERVER
+#define NEARNESS_QUERY_SERVER
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+
+#include "work_server.hpp"
+
+namespace nearness {
+
+/**
+ * The messages between a query server and its clients, framed as the
+ * messages of a WorkServer. A client sends any number of queries on one
+ * connection and receives an answer or an error for each in order.
+ */
+enum QueryMessageType {
+    // client to server, a QueryHeader followed by the features of the image
+    MESSAGE_QUERY = 16,
+    // server to client, the number of entries then each as a QueryEntry
+    MESSAGE_ANSWER = 17,
+    // server to client, why the query could not be answered
+    MESSAGE_QUERY_ERROR = 18
+};
+
+/**
+ * Precedes the features of a query.
+ */
+struct QueryHeader {
+    // when greater than 0 only this many nearest images are returned
+    uint32_t top_k;
+    uint32_t reserved;
+};
+
+/**
+ * The nearness of a query to one image of the corpus.
+ */
+struct QueryEntry {
+    uint32_t index;
+    float value;
+};
+
+/**
+ * Answers a query with the entries of each image, or sets error.
+ */
+typedef boost::function<bool (
+    std::vector<float> &features,
+    const unsigned int top_k,
+    std::vector<QueryEntry> &answer,
+    std::string &error)> QueryHandler;
+
+// Microseconds to wait before accepting again when out of descriptors
+const unsigned int ACCEPT_BACKOFF_US = 100000;
+
+/**
+ * Answers queries against a corpus held in memory over a Unix domain socket.
+ * Each connection is served by its own thread, so queries from several
+ * clients run at once.
+ */
+class QueryServer {
+public:
+
+    /**
+     * @param path [The path of the socket to listen on]
+     */
+    QueryServer(const std::string &path) : path(path), listener(-1) {
+        #ifndef _WIN32
+            signal(SIGPIPE, SIG_IGN);
+
+            sockaddr_un address;
+            if (!socket_address(path, address)) {
+                std::cerr << "error: socket path '" << path << "' is too long" << std::endl;
+                return;
+            }
+            unlink(path.c_str());
+            listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listener < 0
+                || bind(listener, (sockaddr *)&address, sizeof address) != 0
+                || listen(listener, 64) != 0) {
+                std::cerr << "error: could not listen on '" << path << "'" << std::endl;
+                if (listener >= 0) close(listener);
+                listener = -1;
+            }
+        #else
+            std::cerr << "error: serving queries is not supported on this platform" << std::endl;
+        #endif
+    }
+
+    ~QueryServer() {
+        #ifndef _WIN32
+            if (listener >= 0) {
+                close(listener);
+                unlink(path.c_str());
+            }
+        #endif
+    }
+
+    /**
+     * Whether the socket is open for clients.
+     */
+    bool listening() const {
+        return listener >= 0;
+    }
+
+    /**
+     * Accept clients and answer their queries until the process is stopped.
+     * When out of descriptors or memory, accepting waits a moment before
+     * trying again rather than spinning.
+     * @param handler [Answers each query, called from several threads]
+     * @return        [Only if the socket can no longer accept clients, clients
+     *                already accepted are still being answered]
+     */
+    void serve(const QueryHandler &handler) {
+        #ifndef _WIN32
+            while (true) {
+                int fd = accept(listener, NULL, NULL);
+                if (fd >= 0) {
+                    boost::thread(boost::bind(&QueryServer::serve_client, fd, handler)).detach();
+                }
+                else if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    usleep(ACCEPT_BACKOFF_US);
+                }
+                else if (errno != EINTR && errno != ECONNABORTED) {
+                    std::cerr << "error: could not accept clients: " << std::strerror(errno) << std::endl;
+                    return;
+                }
+            }
+        #endif
+    }
+
+private:
+
+    /**
+     * Answer the queries of one client until it disconnects.
+     */
+    static void serve_client(const int fd, const QueryHandler handler) {
+        #ifndef _WIN32
+            uint32_t type;
+            std::string payload;
+            std::vector<float> features;
+            std::vector<QueryEntry> answer;
+            std::string error;
+
+            while (receive_message(fd, type, payload) && type == MESSAGE_QUERY) {
+                QueryHeader header;
+                if (payload.size() < sizeof header
+                    || (payload.size() - sizeof header) % sizeof(float) != 0) {
+                    break;
+                }
+                std::memcpy(&header, payload.data(), sizeof header);
+                features.resize((payload.size() - sizeof header) / sizeof(float));
+                if (!features.empty()) {
+                    std::memcpy(&features.front(), payload.data() + sizeof header,
+                        features.size() * sizeof(float));
+                }
+
+                answer.clear();
+                error.clear();
+                bool sent;
+                if (handler(features, header.top_k, answer, error)) {
+                    uint32_t count = answer.size();
+                    std::string reply((const char *)&count, sizeof count);
+                    if (!answer.empty()) {
+                        reply.append((const char *)&answer.front(), answer.size() * sizeof(QueryEntry));
+                    }
+                    sent = send_message(fd, MESSAGE_ANSWER, reply);
+                }
+                else {
+                    sent = send_message(fd, MESSAGE_QUERY_ERROR, error);
+                }
+                if (!sent) break;
+            }
+            close(fd);
+        #endif
+    }
+
+    std::string path;
+    int listener;
+};
+
+/**
+ * The client end of a connection to a QueryServer.
+ */
+class QueryClient {
+public:
+
+    /**
+     * @param path [The path of the socket the server listens on]
+     */
+    QueryClient(const std::string &path) : fd(-1) {
+        #ifndef _WIN32
+            signal(SIGPIPE, SIG_IGN);
+
+            sockaddr_un address;
+            if (!socket_address(path, address)) return;
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && connect(fd, (sockaddr *)&address, sizeof address) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        #endif
+    }
+
+    ~QueryClient() {
+        #ifndef _WIN32
+            if (fd >= 0) close(fd);
+        #endif
+    }
+
+    bool connected() const {
+        return fd >= 0;
+    }
+
+    /**
+     * Find the nearness of an image to the corpus of the server.
+     * @param  features [The features of the image]
+     * @param  top_k    [The number of nearest images to return, 0 for all]
+     * @param  answer   [Set to the nearness to each image returned]
+     * @param  error    [Set to why the query failed]
+     * @return          [False if the query failed]
+     */
+    bool query(
+        const std::vector<float> &features,
+        const unsigned int top_k,
+        std::vector<QueryEntry> &answer,
+        std::string &error) {
+
+        #ifndef _WIN32
+            QueryHeader header;
+            header.top_k = top_k;
+            header.reserved = 0;
+            std::string payload((const char *)&header, sizeof header);
+            if (!features.empty()) {
+                payload.append((const char *)&features.front(), features.size() * sizeof(float));
+            }
+
+            uint32_t type;
+            std::string reply;
+            if (!send_message(fd, MESSAGE_QUERY, payload) || !receive_message(fd, type, reply)) {
+                error = "lost the server";
+                return false;
+            }
+            if (type == MESSAGE_QUERY_ERROR) {
+                error = reply;
+                return false;
+            }
+
+            uint32_t count;
+            if (type != MESSAGE_ANSWER || reply.size() < sizeof count) {
+                error = "malformed answer";
+                return false;
+            }
+            std::memcpy(&count, reply.data(), sizeof count);
+            if (reply.size() != sizeof count + count * sizeof(QueryEntry)) {
+                error = "malformed answer";
+                return false;
+            }
+            answer.resize(count);
+            if (count > 0) {
+                std::memcpy(&answer.front(), reply.data() + sizeof count, count * sizeof(QueryEntry));
+            }
+            return true;
+        #else
+            error = "not supported on this platform";
+            return false;
+        #endif
+    }
+
+private:
+    int fd;
+};
+
+} // namespace nearness
+
+#endif
@@ -21,6 +21,8 @@
 #include "boost/bind.hpp"
 #include "maximal_clique_basic_includes.hpp"
 
+namespace nearness {
+
 /**
  * Find the candidate with the greatest neighbourhoods in candidates.
  * @param  cands [The candidates to pick from]
@@ -28,7 +30,7 @@
  * @return       [The vertex id of the candidate with the most neighbours within
  *               cands]
  */
-int greatest_cand(IdSet &cands, std::vector<IdSet> &graph) {
+inline int greatest_cand(IdSet &cands, std::vector<IdSet> &graph) {
     int fixp = NONE;
     int num_neighbours = -1;
 
@@ -52,7 +54,7 @@ int greatest_cand(IdSet &cands, std::vector<IdSet> &graph) {
  * @param  graph [The graph]
  * @return       [The next vertex id to move to]
  */
-int remaining_v(IdSet &cands, const int fixp, std::vector<IdSet> &graph) {
+inline int remaining_v(IdSet &cands, const int fixp, std::vector<IdSet> &graph) {
     int cur_v = NONE;
 
     if (cands.any()) { // hack to skip loop if there are no more cands
@@ -67,7 +69,7 @@ int remaining_v(IdSet &cands, const int fixp, std::vector<IdSet> &graph) {
     return cur_v;
 }
 
-void clique_enumerate(
+inline void clique_enumerate(
     IdSet &clique,
     IdSet &cands,
     IdSet &nots,
@@ -97,7 +99,7 @@ void clique_enumerate(
 }
 
 
-void record_results(std::vector<IdSet> &results, IdSet clique) {
+inline void record_results(std::vector<IdSet> &results, IdSet clique) {
     results.push_back(clique);
 }
 
@@ -106,7 +108,7 @@ void record_results(std::vector<IdSet> &results, IdSet clique) {
  * @param graph   [The graph]
  * @param results [The vector to write the maximal cliques to]
  */
-void clique_enumerate(
+inline void clique_enumerate(
     std::vector<IdSet> &graph,
     boost::function<void(IdSet)> const &callback) {
 
@@ -134,13 +136,63 @@ void clique_enumerate(
  * @param graph   [The graph]
  * @param results [The vector to write the maximal cliques to]
  */
-void clique_enumerate(
+inline void clique_enumerate(
     std::vector<IdSet> &graph,
     std::vector<IdSet> &results) {
 
     clique_enumerate(graph, boost::bind(record_results, boost::ref(results), _1));
 }
 
+/**
+ * Update the maximal cliques of a graph as an edge is added to it, instead of
+ * enumerating every clique again. Every new maximal clique holds both u and v,
+ * so they are the maximal cliques of the common neighbourhood of u and v
+ * extended by the edge. An old clique stops being maximal only when it holds
+ * one end of the edge and every other vertex is adjacent to the other end.
+ * @param graph   [The graph, the edge is added to it]
+ * @param cliques [The maximal cliques before the edge, updated to those after]
+ * @param u       [One end of the edge]
+ * @param v       [The other end of the edge]
+ */
+inline void clique_insert_edge(
+    std::vector<IdSet> &graph,
+    std::vector<IdSet> &cliques,
+    const unsigned int u,
+    const unsigned int v) {
+
+    if (u == v || graph[u][v]) return;
+    graph[u].set(v);
+    graph[v].set(u);
+
+    // remove the cliques the edge extends, order does not matter
+    for (unsigned int c = 0; c < cliques.size();) {
+        IdSet &clique = cliques[c];
+        if (clique[u] != clique[v]) {
+            unsigned int other = clique[u] ? v : u;
+            if ((clique & ~graph[other]).none()) {
+                clique = cliques.back();
+                cliques.pop_back();
+                continue;
+            }
+        }
+        ++c;
+    }
+
+    #ifdef DYNAMIC_BITSET
+        IdSet clique(graph.size()), nots(graph.size());
+    #else
+        IdSet clique, nots;
+    #endif
+    clique.set(u);
+    clique.set(v);
+
+    IdSet cands = graph[u] & graph[v];
+    cands.reset(u);
+    cands.reset(v);
+
+    clique_enumerate(clique, cands, nots, graph, boost::bind(record_results, boost::ref(cliques), _1));
+}
+
 /**
  * State used by the iterative function.
  */
@@ -158,7 +210,7 @@ struct State {
  * @param graph   [The graph]
  * @param results [The vector to write the maximal cliques to]
  */
-void clique_enumerate_iterative(
+inline void clique_enumerate_iterative(
     std::vector<IdSet> &graph,
     std::vector<IdSet> &results) {
 
@@ -197,4 +249,6 @@ void clique_enumerate_iterative(
     }
 }
 
+} // namespace nearness
+
 #endif
\ No newline at end of file
@@ -0,0 +1,571 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_RESULTS
+#define NEARNESS_RESULTS
+
+#include <vector>
+#include <map>
+#include <utility>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <assert.h>
+#include <stdint.h>
+
+namespace nearness {
+
+// A row of nearness values from object i to objects i + 1 ... n - 1
+typedef std::vector<float> Result;
+
+/**
+ * Converts a float to an IEEE 754 half precision float, rounding to nearest
+ * even.
+ * @param  value [The float to convert]
+ * @return       [The bits of the half precision float]
+ */
+inline uint16_t float_to_half(float value) {
+    uint32_t f;
+    std::memcpy(&f, &value, sizeof f);
+
+    uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t exponent = (f >> 23) & 0xff;
+    uint32_t mantissa = f & 0x7fffff;
+
+    // infinity and nan
+    if (exponent == 0xff) {
+        return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+    }
+
+    int e = (int)exponent - 127 + 15;
+
+    // too large, round to infinity
+    if (e >= 0x1f) {
+        return sign | 0x7c00;
+    }
+
+    // too small for a normal half, create a subnormal or round to zero
+    if (e <= 0) {
+        if (e < -10) return sign;
+        mantissa |= 0x800000;
+        unsigned int shift = 14 - e;
+        uint32_t h = mantissa >> shift;
+        uint32_t rem = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (h & 1))) ++h;
+        return sign | h;
+    }
+
+    // a carry out of the mantissa correctly bumps the exponent
+    uint32_t h = sign | (e << 10) | (mantissa >> 13);
+    uint32_t rem = mantissa & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) ++h;
+    return h;
+}
+
+/**
+ * Converts an IEEE 754 half precision float to a float.
+ * @param  h [The bits of the half precision float]
+ * @return   [The float value]
+ */
+inline float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    // zero and subnormals
+    if (exponent == 0) {
+        float value = std::ldexp((float)mantissa, -24);
+        return sign ? -value : value;
+    }
+
+    uint32_t f;
+    if (exponent == 0x1f) {
+        f = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+        f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &f, sizeof value);
+    return value;
+}
+
+/**
+ * Receives rows of nearness values as tasks complete them. Implementations
+ * must allow different rows to be added concurrently.
+ */
+class ResultSink {
+public:
+    virtual ~ResultSink() {}
+
+    /**
+     * @param i   [The row]
+     * @param row [The nearness from i to objects i + 1 ... n - 1]
+     */
+    virtual void add_row(const unsigned int i, const Result &row) = 0;
+};
+
+/**
+ * Packed upper triangular matrix of the nearness between every pair of
+ * objects. Only the pairs i < j are stored, in row order, giving
+ * n(n - 1)/2 values in a single buffer. [i][j] == [j][i] and [i][i] == 0.
+ * Values can optionally be stored in half precision to halve memory again.
+ */
+class TriangleResults : public ResultSink {
+public:
+
+    /**
+     * @param n    [The number of objects]
+     * @param half [Whether to store values as half precision floats]
+     */
+    TriangleResults(const unsigned int n, const bool half = false) :
+        n(n), half(half) {
+
+        if (half) {
+            half_values.resize(pairs(n));
+        }
+        else {
+            values.resize(pairs(n));
+        }
+    }
+
+    /**
+     * The number of pairs in the triangle of n objects.
+     */
+    static size_t pairs(const unsigned int n) {
+        return (size_t)n * (n - (n > 0)) / 2;
+    }
+
+    /**
+     * The offset of the pair i < j within the packed buffer.
+     * @param  i [The row, must be less than j]
+     * @param  j [The column]
+     * @param  n [The number of objects]
+     * @return   [The offset of the pair]
+     */
+    static size_t index(
+        const unsigned int i,
+        const unsigned int j,
+        const unsigned int n) {
+
+        assert(i < j && j < n);
+        return (size_t)i * (2 * (size_t)n - i - 1) / 2 + (j - i - 1);
+    }
+
+    /**
+     * The nearness between objects i and j in either order.
+     */
+    float get(unsigned int i, unsigned int j) const {
+        if (i == j) return 0;
+        if (i > j) std::swap(i, j);
+        size_t k = index(i, j, n);
+        return half ? half_to_float(half_values[k]) : values[k];
+    }
+
+    /**
+     * Set the nearness between objects i and j in either order.
+     */
+    void set(unsigned int i, unsigned int j, const float value) {
+        if (i == j) return;
+        if (i > j) std::swap(i, j);
+        size_t k = index(i, j, n);
+        if (half) {
+            half_values[k] = float_to_half(value);
+        }
+        else {
+            values[k] = value;
+        }
+    }
+
+    /**
+     * Copy a computed row into the triangle. Rows never overlap so they can be
+     * set concurrently from different threads.
+     * @param i   [The row]
+     * @param row [The nearness from i to objects i + 1 ... n - 1]
+     */
+    void set_row(const unsigned int i, const Result &row) {
+        assert(row.size() == n - i - 1);
+        if (row.empty()) return;
+
+        size_t k = index(i, i + 1, n);
+        if (half) {
+            for (size_t l = 0; l < row.size(); ++l) {
+                half_values[k + l] = float_to_half(row[l]);
+            }
+        }
+        else {
+            std::memcpy(&values[k], &row.front(), row.size() * sizeof(float));
+        }
+    }
+
+    void add_row(const unsigned int i, const Result &row) {
+        set_row(i, row);
+    }
+
+    /**
+     * The number of objects.
+     */
+    unsigned int size() const {
+        return n;
+    }
+
+private:
+    unsigned int n;
+    bool half;
+    std::vector<float> values;
+    std::vector<uint16_t> half_values;
+};
+
+/**
+ * Dense matrix of the nearness from each query object to each reference
+ * object, in query order. Unlike a triangle the two sets are different
+ * objects so there is no symmetry to exploit, every value is stored.
+ */
+class RectangleResults {
+public:
+
+    /**
+     * @param num_queries    [The number of query objects]
+     * @param num_references [The number of reference objects]
+     */
+    RectangleResults(
+        const unsigned int num_queries,
+        const unsigned int num_references) :
+        num_queries(num_queries),
+        num_references(num_references),
+        values((size_t)num_queries * num_references) {}
+
+    /**
+     * The nearness from query q to reference r.
+     */
+    float get(const unsigned int q, const unsigned int r) const {
+        return values[(size_t)q * num_references + r];
+    }
+
+    /**
+     * Set the nearness from query q to reference r. Different pairs can be
+     * set concurrently from different threads.
+     */
+    void set(const unsigned int q, const unsigned int r, const float value) {
+        values[(size_t)q * num_references + r] = value;
+    }
+
+    /**
+     * The values of query q to every reference in order.
+     */
+    const float *row(const unsigned int q) const {
+        return &values[(size_t)q * num_references];
+    }
+
+    /**
+     * The number of query objects.
+     */
+    unsigned int queries() const {
+        return num_queries;
+    }
+
+    /**
+     * The number of reference objects.
+     */
+    unsigned int references() const {
+        return num_references;
+    }
+
+private:
+    unsigned int num_queries;
+    unsigned int num_references;
+    std::vector<float> values;
+};
+
+/**
+ * The nearness between every pair of objects at most width apart in the
+ * order read, for sequences such as the frames of a video where only nearby
+ * objects are compared. Row i holds the pairs i < j <= i + width, so memory
+ * is n * width rather than n^2. [i][j] == [j][i] and [i][i] == 0.
+ */
+class BandResults {
+public:
+
+    /**
+     * @param n     [The number of objects]
+     * @param width [The furthest apart two objects of a pair can be]
+     */
+    BandResults(const unsigned int n, const unsigned int width) :
+        n(n),
+        width(width),
+        values((size_t)n * width) {}
+
+    /**
+     * Whether the pair of objects i and j is within the band.
+     */
+    bool contains(const unsigned int i, const unsigned int j) const {
+        return (i < j ? j - i : i - j) <= width;
+    }
+
+    /**
+     * The nearness between objects i and j in either order, which must be
+     * within the band.
+     */
+    float get(unsigned int i, unsigned int j) const {
+        if (i == j) return 0;
+        if (i > j) std::swap(i, j);
+        assert(j - i <= width && j < n);
+        return values[(size_t)i * width + (j - i - 1)];
+    }
+
+    /**
+     * Set the nearness between objects i and j in either order. Different
+     * pairs can be set concurrently from different threads.
+     */
+    void set(unsigned int i, unsigned int j, const float value) {
+        if (i == j) return;
+        if (i > j) std::swap(i, j);
+        assert(j - i <= width && j < n);
+        values[(size_t)i * width + (j - i - 1)] = value;
+    }
+
+    /**
+     * The values of row i, the pairs i + 1 ... i + row_size(i).
+     */
+    const float *row(const unsigned int i) const {
+        return &values[(size_t)i * width];
+    }
+
+    /**
+     * The number of pairs in row i, fewer than width at the end.
+     */
+    unsigned int row_size(const unsigned int i) const {
+        return std::min(width, n - i - 1);
+    }
+
+    /**
+     * The number of pairs in the band.
+     */
+    size_t pairs() const {
+        size_t count = 0;
+        for (unsigned int i = 0; i < n; ++i) {
+            count += row_size(i);
+        }
+        return count;
+    }
+
+    /**
+     * The furthest apart two objects of a pair can be.
+     */
+    unsigned int band_width() const {
+        return width;
+    }
+
+    /**
+     * The number of objects.
+     */
+    unsigned int size() const {
+        return n;
+    }
+
+private:
+    unsigned int n;
+    unsigned int width;
+    std::vector<float> values;
+};
+
+/**
+ * A non-zero nearness value within a row of SparseResults.
+ */
+struct SparseEntry {
+    uint32_t j;
+    float value;
+
+    SparseEntry(const uint32_t j, const float value) : j(j), value(value) {}
+};
+
+/**
+ * Upper triangle holding only the pairs with a non-zero nearness, so memory
+ * scales with the number of pairs that meet instead of n^2. Each row keeps
+ * its entries ordered by j.
+ */
+class SparseResults : public ResultSink {
+public:
+
+    /**
+     * @param n [The number of objects]
+     */
+    SparseResults(const unsigned int n) : rows(n) {}
+
+    void add_row(const unsigned int i, const Result &row) {
+        std::vector<SparseEntry> entries;
+        for (unsigned int l = 0; l < row.size(); ++l) {
+            if (row[l] != 0) entries.push_back(SparseEntry(i + 1 + l, row[l]));
+        }
+        // rows never overlap so can be set concurrently
+        rows[i].swap(entries);
+    }
+
+    /**
+     * The non-zero entries of row i, pairs i < j only.
+     */
+    const std::vector<SparseEntry> &row(const unsigned int i) const {
+        return rows[i];
+    }
+
+    /**
+     * The number of non-zero pairs.
+     */
+    size_t non_zero() const {
+        size_t count = 0;
+        for (unsigned int i = 0; i < rows.size(); ++i) {
+            count += rows[i].size();
+        }
+        return count;
+    }
+
+    /**
+     * The number of objects.
+     */
+    unsigned int size() const {
+        return rows.size();
+    }
+
+private:
+    std::vector<std::vector<SparseEntry> > rows;
+};
+
+/**
+ * Collects the rows of the unique objects of a corpus that has duplicates,
+ * then expands them to a row for every object once all are complete. The
+ * nearness between two copies of the same object is given directly rather
+ * than computed, every other pair takes the value of the pair of their unique
+ * objects.
+ *
+ * Unique objects are numbered in the order their first copy was read, and
+ * each of their pairs is computed with the lower first. A copy read before
+ * an object whose unique object is numbered after its own needs that pair
+ * the other way round, which matters for a measure whose value depends on
+ * the order of a pair. Those pairs are given by reversed_pairs and their
+ * values set with set_reversed before expanding.
+ */
+class DuplicateResults : public ResultSink {
+public:
+
+    /**
+     * @param representatives [The unique object of each object]
+     * @param self_values     [The nearness of each unique object to a copy of
+     *                        itself]
+     * @param results         [The sink to expand rows to, not owned]
+     */
+    DuplicateResults(
+        const std::vector<unsigned int> &representatives,
+        const std::vector<float> &self_values,
+        ResultSink *results) :
+        representatives(representatives),
+        self_values(self_values),
+        unique(self_values.size()),
+        results(results) {}
+
+    void add_row(const unsigned int i, const Result &row) {
+        unique.set_row(i, row);
+    }
+
+    /**
+     * The pairs of unique objects (a, b) with a > b that some object needs
+     * with a first. A copy of b read after the first copy of every unique
+     * object up to m needs the pairs of b with each of b + 1 ... m.
+     */
+    std::vector<std::pair<unsigned int, unsigned int> > reversed_pairs() const {
+        // the last unique object needed with each unique object second
+        std::vector<unsigned int> needed(self_values.size(), 0);
+        unsigned int seen = 0;
+        for (unsigned int j = 0; j < representatives.size(); ++j) {
+            unsigned int b = representatives[j];
+            if (b < seen) needed[b] = std::max(needed[b], seen);
+            seen = std::max(seen, b);
+        }
+
+        std::vector<std::pair<unsigned int, unsigned int> > pairs;
+        for (unsigned int b = 0; b < needed.size(); ++b) {
+            for (unsigned int a = b + 1; a <= needed[b]; ++a) {
+                pairs.push_back(std::make_pair(a, b));
+            }
+        }
+        return pairs;
+    }
+
+    /**
+     * Set the values of the pairs given by reversed_pairs.
+     * @param pairs  [The pairs, the first object of each first]
+     * @param values [The value of each pair]
+     */
+    void set_reversed(
+        const std::vector<std::pair<unsigned int, unsigned int> > &pairs,
+        const std::vector<float> &values) {
+
+        for (unsigned int p = 0; p < pairs.size(); ++p) {
+            reversed[pairs[p]] = values[p];
+        }
+    }
+
+    /**
+     * Send a row for every object to the sink, once every row of the unique
+     * objects has been added.
+     */
+    void expand() {
+        unsigned int n = representatives.size();
+        Result row;
+        for (unsigned int i = 0; i < n; ++i) {
+            unsigned int a = representatives[i];
+            row.resize(n - i - 1);
+            for (unsigned int j = i + 1; j < n; ++j) {
+                unsigned int b = representatives[j];
+                row[j - i - 1] = a == b ? self_values[a] : value(a, b);
+            }
+            results->add_row(i, row);
+        }
+    }
+
+    /**
+     * The sink rows are expanded to.
+     */
+    ResultSink *sink() const {
+        return results;
+    }
+
+private:
+
+    /**
+     * The value of unique objects a and b with a first, reversed if it was
+     * set and computed with b first otherwise.
+     */
+    float value(const unsigned int a, const unsigned int b) const {
+        if (a > b && !reversed.empty()) {
+            std::map<std::pair<unsigned int, unsigned int>, float>::const_iterator it =
+                reversed.find(std::make_pair(a, b));
+            if (it != reversed.end()) return it->second;
+        }
+        return unique.get(a, b);
+    }
+
+    std::vector<unsigned int> representatives;
+    std::vector<float> self_values;
+    TriangleResults unique;
+    std::map<std::pair<unsigned int, unsigned int>, float> reversed;
+    ResultSink *results;
+};
+
+} // namespace nearness
+
+#endif
@@ -0,0 +1,299 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_SHARD
+#define NEARNESS_SHARD
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <assert.h>
+
+#include "results.hpp"
+#include "output.hpp"
+
+namespace nearness {
+
+/**
+ * Follows the BinaryHeader of a partial result file, giving the rows it holds
+ * as [first, last) and the settings of the run, so only shards of the same
+ * run are merged.
+ */
+struct PartialHeader {
+    uint32_t first;
+    uint32_t last;
+    uint32_t larger_is_nearer;
+    uint32_t num_features;
+    float epsilon;
+    uint32_t singletons;
+    char measure[8];
+};
+
+/**
+ * The header of a partial result file of a run.
+ * @param  first        [The first row of the shard]
+ * @param  last         [One past the last row of the shard]
+ * @param  measure      [The name of the measure]
+ * @param  epsilon      [The epsilon of the output]
+ * @param  num_features [The number of features per object]
+ * @param  singletons   [Whether singletons are included in the results]
+ * @return              [The header]
+ */
+inline PartialHeader partial_header(
+    const unsigned int first,
+    const unsigned int last,
+    const std::string &measure,
+    const float epsilon,
+    const unsigned int num_features,
+    const bool singletons) {
+
+    PartialHeader partial;
+    std::memset(&partial, 0, sizeof partial);
+    partial.first = first;
+    partial.last = last;
+    partial.larger_is_nearer = measure == "mce";
+    partial.num_features = num_features;
+    partial.epsilon = epsilon;
+    partial.singletons = singletons;
+    assert(measure.size() < sizeof partial.measure);
+    std::strncpy(partial.measure, measure.c_str(), sizeof partial.measure - 1);
+    return partial;
+}
+
+/**
+ * The rows of the triangle one process computes. Either the shard index of a
+ * number of shards balanced by cost, or an explicit range of rows.
+ */
+struct Shard {
+    // when count is greater than 0, this is shard index of count
+    unsigned int index;
+    unsigned int count;
+
+    // when last is greater than 0, the rows [first, last)
+    unsigned int first;
+    unsigned int last;
+
+    Shard() : index(0), count(0), first(0), last(0) {}
+
+    /**
+     * Whether only some rows are computed.
+     */
+    bool enabled() const {
+        return count > 0 || last > 0;
+    }
+};
+
+/**
+ * Parse a shard given as 'k/N' with k in [0, N).
+ * @param  text  [The text to parse]
+ * @param  shard [The shard to write to]
+ * @return       [False if the text is not a shard]
+ */
+inline bool parse_shard(const std::string &text, Shard &shard) {
+    char end;
+    if (std::sscanf(text.c_str(), "%u/%u%c", &shard.index, &shard.count, &end) != 2) return false;
+    return shard.index < shard.count;
+}
+
+/**
+ * Parse a range of rows given as 'a:b', the rows [a, b).
+ * @param  text  [The text to parse]
+ * @param  shard [The shard to write to]
+ * @return       [False if the text is not a range]
+ */
+inline bool parse_rows(const std::string &text, Shard &shard) {
+    char end;
+    if (std::sscanf(text.c_str(), "%u:%u%c", &shard.first, &shard.last, &end) != 2) return false;
+    return shard.first < shard.last;
+}
+
+/**
+ * The rows of a shard. Shards are contiguous so each holds whole rows in
+ * order, with the boundaries placed so each shard has close to the same
+ * estimated cost rather than the same number of rows, which would leave the
+ * first shards with most of the work.
+ * @param shard     [The shard]
+ * @param row_costs [The estimated cost of each row]
+ * @param first     [Set to the first row]
+ * @param last      [Set to one past the last row]
+ */
+inline void shard_rows(
+    const Shard &shard,
+    const std::vector<double> &row_costs,
+    unsigned int &first,
+    unsigned int &last) {
+
+    unsigned int n = row_costs.size();
+    if (shard.count == 0) {
+        first = std::min(shard.first, n);
+        last = std::min(shard.last, n);
+        return;
+    }
+
+    double total = 0;
+    for (unsigned int i = 0; i < n; ++i) {
+        total += row_costs[i];
+    }
+
+    // the first row whose preceding cost reaches each boundary
+    double start = total * shard.index / shard.count;
+    double end = total * (shard.index + 1) / shard.count;
+    double cost = 0;
+    first = n;
+    last = n;
+    for (unsigned int i = 0; i < n; ++i) {
+        if (first == n && cost >= start) first = i;
+        if (shard.index + 1 < shard.count && cost >= end) {
+            last = i;
+            break;
+        }
+        cost += row_costs[i];
+    }
+    if (first > last) first = last;
+}
+
+/**
+ * Holds the rows of one shard to be written as a partial result file.
+ */
+class PartialResults : public ResultSink {
+public:
+
+    /**
+     * @param n       [The number of objects]
+     * @param partial [The rows of the shard and the settings of the run,
+     *                created by partial_header]
+     */
+    PartialResults(
+        const unsigned int n,
+        const PartialHeader &partial) :
+        n(n),
+        partial(partial),
+        rows(partial.last - partial.first) {}
+
+    void add_row(const unsigned int i, const Result &row) {
+        assert(partial.first <= i && i < partial.last);
+        rows[i - partial.first] = row;
+    }
+
+    /**
+     * Write the rows to a partial result file.
+     * @param out [The path to write to]
+     */
+    void write(const std::string &out) const {
+        std::ofstream out_file(out.c_str(), std::ios::binary | std::ios::trunc);
+
+        std::string header;
+        format_binary_header(header, n, LAYOUT_PARTIAL_ROWS);
+
+        header.append((const char *)&partial, sizeof partial);
+        out_file.write(header.data(), header.size());
+
+        for (unsigned int i = partial.first; i < partial.last; ++i) {
+            const Result &row = rows[i - partial.first];
+            assert(row.size() == n - i - 1);
+            if (!row.empty()) {
+                out_file.write((const char *)&row.front(), row.size() * sizeof(float));
+            }
+        }
+
+        if (!out_file) {
+            std::cerr << "error: could not write '" << out << "'" << std::endl;
+        }
+    }
+
+private:
+    unsigned int n;
+    PartialHeader partial;
+    std::vector<Result> rows;
+};
+
+/**
+ * A partial result file being merged.
+ */
+struct PartialFile {
+    std::string path;
+    BinaryHeader header;
+    PartialHeader partial;
+
+    /**
+     * Read the headers of a partial result file.
+     * @return [False if the file is not a partial result file]
+     */
+    bool open(const std::string &file) {
+        path = file;
+        std::ifstream in(path.c_str(), std::ios::binary);
+        in.read((char *)&header, sizeof header);
+        in.read((char *)&partial, sizeof partial);
+        return in
+            && std::memcmp(header.magic, BINARY_MAGIC, sizeof header.magic) == 0
+            && header.version == BINARY_VERSION
+            && header.layout == LAYOUT_PARTIAL_ROWS
+            && partial.first <= partial.last
+            && partial.last <= header.num_objects
+            && std::memchr(partial.measure, '\0', sizeof partial.measure) != NULL;
+    }
+
+    /**
+     * Whether another partial file is from a run of the same objects with
+     * the same settings.
+     */
+    bool same_run(const PartialFile &other) const {
+        return header.num_objects == other.header.num_objects
+            && partial.larger_is_nearer == other.partial.larger_is_nearer
+            && partial.num_features == other.partial.num_features
+            && partial.epsilon == other.partial.epsilon
+            && partial.singletons == other.partial.singletons
+            && std::strcmp(partial.measure, other.partial.measure) == 0;
+    }
+
+    /**
+     * Pass every row of the file on to a sink in order.
+     * @return [False if the file is cut short]
+     */
+    bool read_rows(ResultSink &results) const {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        in.seekg(sizeof header + sizeof partial);
+
+        unsigned int n = header.num_objects;
+        Result row;
+        for (unsigned int i = partial.first; i < partial.last; ++i) {
+            row.resize(n - i - 1);
+            if (!row.empty()) {
+                in.read((char *)&row.front(), row.size() * sizeof(float));
+            }
+            if (!in) return false;
+            results.add_row(i, row);
+        }
+        return true;
+    }
+};
+
+/**
+ * Orders partial files by their rows, an empty shard before the shard that
+ * starts where it does.
+ */
+inline bool partial_before(const PartialFile &a, const PartialFile &b) {
+    if (a.partial.first != b.partial.first) return a.partial.first < b.partial.first;
+    return a.partial.last < b.partial.last;
+}
+
+} // namespace nearness
+
+#endif
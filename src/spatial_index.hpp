@@ -0,0 +1,144 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_SPATIAL_INDEX
+#define NEARNESS_SPATIAL_INDEX
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <assert.h>
+
+namespace nearness {
+
+/**
+ * The objects of one image sorted by their projection onto the feature with
+ * the greatest variance. Two objects closer than epsilon are closer than
+ * epsilon along every feature, so only objects whose projections are within
+ * epsilon need their full distance computed.
+ */
+class ProjectionIndex {
+public:
+
+    ProjectionIndex() : dim(0) {}
+
+    /**
+     * @param features     [The feature values of the image]
+     * @param num_features [The number of features per object]
+     */
+    ProjectionIndex(
+        const std::vector<float> &features,
+        const unsigned int num_features) :
+        dim(0) {
+
+        assert(features.size() % num_features == 0);
+        unsigned int num_objects = features.size() / num_features;
+
+        // project onto the feature with the greatest spread
+        double best = -1;
+        for (unsigned int d = 0; d < num_features; ++d) {
+            double sum = 0;
+            double sqr_sum = 0;
+            for (unsigned int o = 0; o < num_objects; ++o) {
+                double x = features[o * num_features + d];
+                sum += x;
+                sqr_sum += x * x;
+            }
+            double variance = num_objects > 0
+                ? sqr_sum / num_objects - (sum / num_objects) * (sum / num_objects) : 0;
+            if (variance > best) {
+                best = variance;
+                dim = d;
+            }
+        }
+
+        std::vector<std::pair<float, unsigned int> > sorted(num_objects);
+        for (unsigned int o = 0; o < num_objects; ++o) {
+            sorted[o] = std::make_pair(features[o * num_features + dim], o);
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        keys.resize(num_objects);
+        order.resize(num_objects);
+        for (unsigned int o = 0; o < num_objects; ++o) {
+            keys[o] = sorted[o].first;
+            order[o] = sorted[o].second;
+        }
+    }
+
+    /**
+     * The positions in sorted order of every object whose projection is
+     * within epsilon of value.
+     * @param value   [The projection to search around]
+     * @param epsilon [The maximum difference]
+     * @param first   [Set to the first position]
+     * @param last    [Set to one past the last position]
+     */
+    void range(
+        const float value,
+        const float epsilon,
+        unsigned int &first,
+        unsigned int &last) const {
+
+        // the same subtraction as the distance is used at the edges so no
+        // object can be missed to rounding
+        first = std::lower_bound(keys.begin(), keys.end(), value - epsilon) - keys.begin();
+        while (first > 0 && value - keys[first - 1] < epsilon) --first;
+        last = first;
+        while (last < keys.size() && keys[last] - value < epsilon) ++last;
+    }
+
+    /**
+     * The feature the objects are sorted by.
+     */
+    unsigned int dimension() const {
+        return dim;
+    }
+
+    /**
+     * The projection at a position in sorted order.
+     */
+    float key(const unsigned int p) const {
+        return keys[p];
+    }
+
+    /**
+     * The object at a position in sorted order.
+     */
+    unsigned int object(const unsigned int p) const {
+        return order[p];
+    }
+
+    /**
+     * The number of objects.
+     */
+    unsigned int size() const {
+        return keys.size();
+    }
+
+private:
+    unsigned int dim;
+
+    // the projections in ascending order
+    std::vector<float> keys;
+
+    // the object at each position in sorted order
+    std::vector<unsigned int> order;
+};
+
+} // namespace nearness
+
+#endif
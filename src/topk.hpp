@@ -0,0 +1,172 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_TOPK
+#define NEARNESS_TOPK
+
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+#include <algorithm>
+
+#include "results.hpp"
+
+namespace nearness {
+
+/**
+ * A candidate nearest object. Score is the value oriented so larger is always
+ * nearer, ties are broken by the lower index so results are deterministic.
+ */
+struct Neighbour {
+    uint32_t j;
+    float value;
+    float score;
+
+    Neighbour(const uint32_t j, const float value, const float score) :
+        j(j), value(value), score(score) {}
+};
+
+/**
+ * Orders neighbours from nearest to furthest. Used as the heap comparator
+ * this keeps the furthest neighbour at the top of the heap.
+ */
+inline bool nearer(const Neighbour &a, const Neighbour &b) {
+    if (a.score != b.score) return a.score > b.score;
+    return a.j < b.j;
+}
+
+/**
+ * Add a candidate to a heap of at most k neighbours.
+ * @param heap      [The heap, furthest neighbour first]
+ * @param k         [The maximum size of the heap]
+ * @param candidate [The candidate to add]
+ */
+inline void push_bounded(
+    std::vector<Neighbour> &heap,
+    const unsigned int k,
+    const Neighbour &candidate) {
+
+    if (heap.size() < k) {
+        heap.push_back(candidate);
+        std::push_heap(heap.begin(), heap.end(), nearer);
+    }
+    else if (nearer(candidate, heap.front())) {
+        std::pop_heap(heap.begin(), heap.end(), nearer);
+        heap.back() = candidate;
+        std::push_heap(heap.begin(), heap.end(), nearer);
+    }
+}
+
+/**
+ * Keeps only the k nearest objects to each object, using O(n * k) memory
+ * instead of the full triangle.
+ *
+ * Every thread adds rows to one shared set of per-object heaps. Since
+ * nearness is symmetric a row i updates the heap of i and the heap of every j
+ * in the row, so each heap is guarded by one of a fixed set of locks. The
+ * heap of i is built without a lock and merged in once per row.
+ */
+class TopKResults : public ResultSink {
+public:
+
+    /**
+     * @param n               [The number of objects]
+     * @param k               [The number of nearest objects to keep]
+     * @param larger_is_nearer [True if larger values are nearer, as with
+     *                         nearness, false if smaller values are, as with
+     *                         a distance]
+     */
+    TopKResults(
+        const unsigned int n,
+        const unsigned int k,
+        const bool larger_is_nearer) :
+        n(n),
+        k(k),
+        larger_is_nearer(larger_is_nearer),
+        nearest(n) {}
+
+    void add_row(const unsigned int i, const Result &row) {
+        std::vector<Neighbour> own;
+        for (unsigned int l = 0; l < row.size(); ++l) {
+            unsigned int j = i + 1 + l;
+            float score = larger_is_nearer ? row[l] : -row[l];
+            push_bounded(own, k, Neighbour(j, row[l], score));
+
+            boost::mutex::scoped_lock lock(lock_of(j));
+            push_bounded(nearest[j], k, Neighbour(i, row[l], score));
+        }
+        add_nearest(i, own);
+    }
+
+    /**
+     * Add neighbours of i found some other way than comparing a row, such as
+     * from an index. Unlike a row only the heap of i is updated.
+     * @param i          [The object]
+     * @param neighbours [Candidate nearest objects to i]
+     */
+    void add_nearest(const unsigned int i, const std::vector<Neighbour> &neighbours) {
+        boost::mutex::scoped_lock lock(lock_of(i));
+        for (unsigned int l = 0; l < neighbours.size(); ++l) {
+            push_bounded(nearest[i], k, neighbours[l]);
+        }
+    }
+
+    /**
+     * Order each heap from nearest to furthest. Must be called once every row
+     * has been added and before reading results.
+     */
+    void merge() {
+        for (unsigned int i = 0; i < n; ++i) {
+            std::sort(nearest[i].begin(), nearest[i].end(), nearer);
+        }
+    }
+
+    /**
+     * The nearest objects to i ordered from nearest to furthest.
+     */
+    const std::vector<Neighbour> &row(const unsigned int i) const {
+        return nearest[i];
+    }
+
+    /**
+     * The number of objects.
+     */
+    unsigned int size() const {
+        return n;
+    }
+
+private:
+
+    static const unsigned int NUM_LOCKS = 256;
+
+    /**
+     * The lock guarding the heap of i.
+     */
+    boost::mutex &lock_of(const unsigned int i) {
+        return locks[i % NUM_LOCKS];
+    }
+
+    unsigned int n;
+    unsigned int k;
+    bool larger_is_nearer;
+
+    std::vector<std::vector<Neighbour> > nearest;
+    boost::mutex locks[NUM_LOCKS];
+};
+
+} // namespace nearness
+
+#endif
@@ -0,0 +1,660 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_WORK_SERVER
+#define NEARNESS_WORK_SERVER
+
+#include <boost/function.hpp>
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+#include <assert.h>
+
+#ifndef _WIN32
+    #include <sys/types.h>
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <poll.h>
+    #include <signal.h>
+    #include <unistd.h>
+#endif
+
+#include "maximal_clique_basic_includes.hpp"
+#include "results.hpp"
+
+namespace nearness {
+
+/**
+ * The messages between a coordinator and its workers. The coordinator sends
+ * the configuration of the run once a worker connects, the worker prepares
+ * the same corpus and replies that it is ready, then repeatedly requests a
+ * row and sends back its result until the coordinator says it is finished.
+ */
+enum MessageType {
+    // coordinator to worker, the configuration of the run as key=value lines
+    MESSAGE_CONFIG = 1,
+    // worker to coordinator, the fingerprint of the prepared corpus
+    MESSAGE_READY = 2,
+    // worker to coordinator, asking for a row
+    MESSAGE_REQUEST = 3,
+    // coordinator to worker, the row to compute
+    MESSAGE_ROW = 4,
+    // worker to coordinator, the row, seconds taken and values of each output
+    MESSAGE_RESULT = 5,
+    // coordinator to worker, every row is complete
+    MESSAGE_FINISHED = 6
+};
+
+// The longest payload accepted, longer messages are treated as a broken
+// connection rather than allocated
+const uint32_t MAX_MESSAGE_LENGTH = 256 * 1024 * 1024;
+
+/**
+ * Precedes every message, followed by length bytes of payload.
+ */
+struct MessageHeader {
+    uint32_t type;
+    uint32_t length;
+};
+
+/**
+ * The header of a result, followed by the values of the row for each output.
+ */
+struct RowResultHeader {
+    uint32_t row;
+    float seconds;
+};
+
+/**
+ * Seconds from an arbitrary point, for timing rows.
+ */
+inline double monotonic_seconds() {
+    #ifdef _WIN32
+        return std::clock() / (double)CLOCKS_PER_SEC;
+    #else
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return now.tv_sec + now.tv_nsec * 1e-9;
+    #endif
+}
+
+/**
+ * Keeps the single row added to it, for a worker to send on.
+ */
+class CapturedRow : public ResultSink {
+public:
+    void add_row(const unsigned int, const Result &row) {
+        this->row = row;
+    }
+
+    Result row;
+};
+
+#ifndef _WIN32
+
+/**
+ * Write a whole message to a socket.
+ * @return [False if the other end has gone]
+ */
+inline bool send_message(const int fd, const uint32_t type, const std::string &payload) {
+    MessageHeader header;
+    header.type = type;
+    header.length = payload.size();
+
+    std::string buffer((const char *)&header, sizeof header);
+    buffer += payload;
+
+    size_t sent = 0;
+    while (sent < buffer.size()) {
+        ssize_t n = send(fd, buffer.data() + sent, buffer.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+/**
+ * Read exactly size bytes from a socket.
+ * @return [False if the other end has gone]
+ */
+inline bool receive_bytes(const int fd, char *data, const size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        ssize_t n = recv(fd, data + received, size - received, 0);
+        if (n <= 0) return false;
+        received += n;
+    }
+    return true;
+}
+
+/**
+ * Read a whole message from a socket.
+ * @return [False if the other end has gone or the message is too long]
+ */
+inline bool receive_message(const int fd, uint32_t &type, std::string &payload) {
+    MessageHeader header;
+    if (!receive_bytes(fd, (char *)&header, sizeof header)) return false;
+    if (header.length > MAX_MESSAGE_LENGTH) return false;
+    type = header.type;
+    payload.resize(header.length);
+    return header.length == 0 || receive_bytes(fd, &payload[0], header.length);
+}
+
+/**
+ * The address of a Unix domain socket.
+ * @return [False if the path is too long]
+ */
+inline bool socket_address(const std::string &path, sockaddr_un &address) {
+    std::memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof address.sun_path) return false;
+    std::strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+#endif
+
+/**
+ * Hands rows to worker processes connected over a Unix domain socket and
+ * collects their results. Rows are handed out as workers ask for them so
+ * faster workers take more. Once no row is left to hand out, a worker asking
+ * for more is given the row that has been out longest, so one slow row or
+ * worker does not hold up the end of the run, the first result to arrive is
+ * kept. The rows of a worker that disconnects are handed out again.
+ */
+class WorkServer {
+public:
+
+    /**
+     * @param path        [The path of the socket to listen on]
+     * @param config      [The configuration of the run sent to each worker]
+     * @param fingerprint [The fingerprint of the prepared corpus, workers
+     *                    with a different corpus are turned away]
+     */
+    WorkServer(
+        const std::string &path,
+        const std::string &config,
+        const uint64_t fingerprint) :
+        path(path),
+        config(config),
+        fingerprint(fingerprint),
+        listener(-1) {
+
+        #ifndef _WIN32
+            signal(SIGPIPE, SIG_IGN);
+
+            sockaddr_un address;
+            if (!socket_address(path, address)) {
+                std::cerr << "error: socket path '" << path << "' is too long" << std::endl;
+                return;
+            }
+            unlink(path.c_str());
+            listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listener < 0
+                || bind(listener, (sockaddr *)&address, sizeof address) != 0
+                || listen(listener, 64) != 0) {
+                std::cerr << "error: could not listen on '" << path << "'" << std::endl;
+                if (listener >= 0) close(listener);
+                listener = -1;
+            }
+        #else
+            std::cerr << "error: serving work is not supported on this platform" << std::endl;
+        #endif
+    }
+
+    ~WorkServer() {
+        #ifndef _WIN32
+            for (unsigned int w = 0; w < workers.size(); ++w) {
+                close(workers[w].fd);
+            }
+            if (listener >= 0) {
+                close(listener);
+                unlink(path.c_str());
+            }
+        #endif
+    }
+
+    /**
+     * Whether the socket is open for workers.
+     */
+    bool listening() const {
+        return listener >= 0;
+    }
+
+    /**
+     * Hand out the rows [first, last) until a result has arrived for every
+     * one, passing results on in order.
+     * @param num_objects [The number of objects]
+     * @param num_outputs [The number of outputs of each row]
+     * @param first       [The first row]
+     * @param last        [One past the last row]
+     * @param skip        [Whether each row is already known and must not be
+     *                    handed out, indexed from first]
+     * @param collect     [Passes on a row and its values for each output, or
+     *                    no values for a skipped row]
+     */
+    void run(
+        const unsigned int num_objects,
+        const unsigned int num_outputs,
+        const unsigned int first,
+        const unsigned int last,
+        const std::vector<bool> &skip,
+        const boost::function<void (unsigned int, std::vector<Result> &)> &collect) {
+
+        assert(skip.size() == last - first);
+        assert(listening());
+
+        this->num_objects = num_objects;
+        this->num_outputs = num_outputs;
+        this->first = first;
+        holders.assign(last - first, 0);
+        dispatched.assign(last - first, 0);
+        done.assign(last - first, false);
+        queue.clear();
+        completed.clear();
+
+        unsigned int remaining = 0;
+        for (unsigned int i = first; i < last; ++i) {
+            if (skip[i - first]) continue;
+            queue.push_back(i);
+            ++remaining;
+        }
+
+        pairs = 0;
+        seconds = 0;
+        slowest_row = first;
+        slowest_seconds = 0;
+        reassigned = 0;
+
+        unsigned int collected = first;
+        std::vector<Result> none;
+
+        #ifndef _WIN32
+        while (true) {
+            // pass on every row now known in order
+            for (; collected < last; ++collected) {
+                if (skip[collected - first]) {
+                    collect(collected, none);
+                    continue;
+                }
+                std::map<unsigned int, std::vector<Result> >::iterator it = completed.find(collected);
+                if (it == completed.end()) break;
+                collect(collected, it->second);
+                completed.erase(it);
+            }
+            if (remaining == 0) break;
+
+            std::vector<pollfd> fds(workers.size() + 1);
+            fds[0].fd = listener;
+            fds[0].events = POLLIN;
+            for (unsigned int w = 0; w < workers.size(); ++w) {
+                fds[w + 1].fd = workers[w].fd;
+                fds[w + 1].events = POLLIN;
+            }
+            if (poll(&fds.front(), fds.size(), -1) < 0) continue;
+
+            if (fds[0].revents & POLLIN) {
+                accept_worker();
+            }
+
+            // workers that have gone are removed once every message is read
+            std::vector<bool> gone(workers.size(), false);
+            for (unsigned int w = 0; w + 1 < fds.size(); ++w) {
+                if (fds[w + 1].revents == 0) continue;
+
+                uint32_t type;
+                std::string payload;
+                if (!receive_message(workers[w].fd, type, payload)) {
+                    gone[w] = true;
+                    continue;
+                }
+
+                if (type == MESSAGE_READY) {
+                    uint64_t worker_fingerprint = 0;
+                    if (payload.size() == sizeof worker_fingerprint) {
+                        std::memcpy(&worker_fingerprint, payload.data(), sizeof worker_fingerprint);
+                    }
+                    if (worker_fingerprint != fingerprint) {
+                        std::cerr << "warning: a worker prepared different objects, turning it away" << std::endl;
+                        gone[w] = true;
+                    }
+                    workers[w].ready = true;
+                }
+                else if (type == MESSAGE_REQUEST && workers[w].ready) {
+                    workers[w].waiting = true;
+                }
+                else if (type == MESSAGE_RESULT && workers[w].ready) {
+                    if (!add_result(w, payload)) {
+                        gone[w] = true;
+                    }
+                }
+                else {
+                    gone[w] = true;
+                }
+            }
+
+            // count results, a row sent to two workers is only counted once
+            remaining = 0;
+            for (unsigned int i = first; i < last; ++i) {
+                if (!skip[i - first] && !done[i - first]) ++remaining;
+            }
+
+            for (unsigned int w = workers.size(); w-- > 0;) {
+                if (gone[w]) remove_worker(w);
+            }
+
+            // rows may have been handed back, so try every waiting worker
+            for (unsigned int w = 0; w < workers.size() && remaining > 0; ++w) {
+                if (workers[w].waiting) assign(w);
+            }
+        }
+
+        for (unsigned int w = 0; w < workers.size(); ++w) {
+            send_message(workers[w].fd, MESSAGE_FINISHED, std::string());
+            close(workers[w].fd);
+        }
+        workers.clear();
+        #endif
+
+        d_var(pairs);
+        d_var(seconds / std::max(pairs, 1.0));
+        d_var(slowest_row);
+        d_var(slowest_seconds);
+        d_var(reassigned);
+    }
+
+private:
+
+    /**
+     * A connected worker.
+     */
+    struct Worker {
+        int fd;
+        // whether it has prepared the corpus
+        bool ready;
+        // whether it has asked for a row that has not been sent
+        bool waiting;
+        // the rows it holds
+        std::vector<unsigned int> rows;
+
+        Worker(const int fd) : fd(fd), ready(false), waiting(false) {}
+    };
+
+    #ifndef _WIN32
+
+    /**
+     * Accept a worker and send it the configuration of the run.
+     */
+    void accept_worker() {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) return;
+        if (!send_message(fd, MESSAGE_CONFIG, config)) {
+            close(fd);
+            return;
+        }
+        workers.push_back(Worker(fd));
+    }
+
+    /**
+     * Send worker w the next row, or the row out longest when none is left.
+     * The worker keeps waiting when every row out is already held twice.
+     */
+    void assign(const unsigned int w) {
+        Worker &worker = workers[w];
+
+        while (!queue.empty() && done[queue.front() - first]) queue.pop_front();
+
+        unsigned int row = 0;
+        if (!queue.empty()) {
+            row = queue.front();
+            queue.pop_front();
+        }
+        else {
+            // the straggler out longest that this worker does not hold
+            bool found = false;
+            for (unsigned int i = first; i < first + done.size(); ++i) {
+                unsigned int r = i - first;
+                if (done[r] || holders[r] != 1) continue;
+                if (std::find(worker.rows.begin(), worker.rows.end(), i) != worker.rows.end()) continue;
+                if (!found || dispatched[r] < dispatched[row - first]) {
+                    row = i;
+                    found = true;
+                }
+            }
+            if (!found) return;
+            ++reassigned;
+        }
+
+        uint32_t message = row;
+        if (!send_message(worker.fd, MESSAGE_ROW, std::string((const char *)&message, sizeof message))) {
+            queue.push_front(row);
+            return;
+        }
+        ++holders[row - first];
+        dispatched[row - first] = monotonic_seconds();
+        worker.rows.push_back(row);
+        worker.waiting = false;
+    }
+
+    /**
+     * Record the result of a row sent by worker w.
+     * @return [False if the result is malformed]
+     */
+    bool add_result(const unsigned int w, const std::string &payload) {
+        RowResultHeader header;
+        if (payload.size() < sizeof header) return false;
+        std::memcpy(&header, payload.data(), sizeof header);
+
+        unsigned int i = header.row;
+        if (i < first || i >= first + done.size()) return false;
+        size_t length = num_objects - i - 1;
+        if (payload.size() != sizeof header + num_outputs * length * sizeof(float)) return false;
+
+        std::vector<unsigned int> &rows = workers[w].rows;
+        std::vector<unsigned int>::iterator held = std::find(rows.begin(), rows.end(), i);
+        if (held == rows.end()) return false;
+        rows.erase(held);
+        --holders[i - first];
+
+        if (done[i - first]) return true;
+        done[i - first] = true;
+
+        std::vector<Result> &values = completed[i];
+        values.resize(num_outputs);
+        const float *data = (const float *)(payload.data() + sizeof header);
+        for (unsigned int k = 0; k < num_outputs; ++k) {
+            values[k].assign(data + k * length, data + (k + 1) * length);
+        }
+
+        pairs += length;
+        seconds += header.seconds;
+        if (header.seconds > slowest_seconds) {
+            slowest_seconds = header.seconds;
+            slowest_row = i;
+        }
+        return true;
+    }
+
+    /**
+     * Disconnect worker w, handing its rows out again.
+     */
+    void remove_worker(const unsigned int w) {
+        std::vector<unsigned int> &rows = workers[w].rows;
+        for (unsigned int r = 0; r < rows.size(); ++r) {
+            unsigned int i = rows[r];
+            --holders[i - first];
+            if (!done[i - first] && holders[i - first] == 0) {
+                queue.push_front(i);
+            }
+        }
+        close(workers[w].fd);
+        workers.erase(workers.begin() + w);
+    }
+
+    #endif
+
+    std::string path;
+    std::string config;
+    uint64_t fingerprint;
+    int listener;
+    std::vector<Worker> workers;
+
+    // the rows of the current run
+    unsigned int num_objects;
+    unsigned int num_outputs;
+    unsigned int first;
+    std::deque<unsigned int> queue;
+
+    // the number of workers holding each row, when it was last sent and
+    // whether its result has arrived, indexed from first
+    std::vector<unsigned int> holders;
+    std::vector<double> dispatched;
+    std::vector<bool> done;
+
+    // results waiting for earlier rows before being passed on
+    std::map<unsigned int, std::vector<Result> > completed;
+
+    // timings reported by workers
+    double pairs;
+    double seconds;
+    unsigned int slowest_row;
+    double slowest_seconds;
+    unsigned int reassigned;
+};
+
+/**
+ * The worker end of the connection to a WorkServer.
+ */
+class WorkClient {
+public:
+
+    /**
+     * @param path [The path of the socket the coordinator listens on]
+     */
+    WorkClient(const std::string &path) : fd(-1) {
+        #ifndef _WIN32
+            signal(SIGPIPE, SIG_IGN);
+
+            sockaddr_un address;
+            if (!socket_address(path, address)) return;
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd >= 0 && connect(fd, (sockaddr *)&address, sizeof address) != 0) {
+                close(fd);
+                fd = -1;
+            }
+        #endif
+    }
+
+    ~WorkClient() {
+        #ifndef _WIN32
+            if (fd >= 0) close(fd);
+        #endif
+    }
+
+    bool connected() const {
+        return fd >= 0;
+    }
+
+    /**
+     * Wait for the configuration of the run.
+     * @return [False if the coordinator has gone]
+     */
+    bool receive_config(std::string &config) {
+        #ifndef _WIN32
+            uint32_t type;
+            return receive_message(fd, type, config) && type == MESSAGE_CONFIG;
+        #else
+            return false;
+        #endif
+    }
+
+    /**
+     * Tell the coordinator the corpus is prepared.
+     * @return [False if the coordinator has gone]
+     */
+    bool ready(const uint64_t fingerprint) {
+        #ifndef _WIN32
+            return send_message(fd, MESSAGE_READY, std::string((const char *)&fingerprint, sizeof fingerprint));
+        #else
+            return false;
+        #endif
+    }
+
+    /**
+     * Ask for the next row.
+     * @param  i [Set to the row]
+     * @return   [False once every row is complete or the coordinator has gone]
+     */
+    bool next_row(unsigned int &i) {
+        #ifndef _WIN32
+            uint32_t type;
+            std::string payload;
+            if (!send_message(fd, MESSAGE_REQUEST, std::string())
+                || !receive_message(fd, type, payload)
+                || type != MESSAGE_ROW || payload.size() != sizeof(uint32_t)) {
+                return false;
+            }
+            uint32_t row;
+            std::memcpy(&row, payload.data(), sizeof row);
+            i = row;
+            return true;
+        #else
+            return false;
+        #endif
+    }
+
+    /**
+     * Send the values of a row for each output.
+     * @param  i       [The row]
+     * @param  seconds [The time taken to compute the row]
+     * @param  rows    [The values of the row for each output]
+     * @return         [False if the coordinator has gone]
+     */
+    bool send_result(
+        const unsigned int i,
+        const float seconds,
+        const std::vector<Result> &rows) {
+
+        #ifndef _WIN32
+            RowResultHeader header;
+            header.row = i;
+            header.seconds = seconds;
+            std::string payload((const char *)&header, sizeof header);
+            for (unsigned int k = 0; k < rows.size(); ++k) {
+                if (!rows[k].empty()) {
+                    payload.append((const char *)&rows[k].front(), rows[k].size() * sizeof(float));
+                }
+            }
+            return send_message(fd, MESSAGE_RESULT, payload);
+        #else
+            return false;
+        #endif
+    }
+
+private:
+    int fd;
+};
+
+} // namespace nearness
+
+#endif
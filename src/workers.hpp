@@ -0,0 +1,247 @@
+/*    This file is part of Maximal Clique Nearness.
+ *
+ *    Maximal Clique Nearness is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Maximal Clique Nearness is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with Maximal Clique Nearness.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NEARNESS_WORKERS
+#define NEARNESS_WORKERS
+
+#include <boost/function.hpp>
+
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <assert.h>
+
+#ifndef _WIN32
+    #include <sys/mman.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+#include "results.hpp"
+
+namespace nearness {
+
+/**
+ * Memory shared with forked worker processes. Without fork it is ordinary
+ * memory of this process.
+ */
+class SharedMemory {
+public:
+
+    /**
+     * @param size [The number of bytes, zero filled]
+     */
+    SharedMemory(const size_t size) : size(size), data(NULL) {
+        #ifdef _WIN32
+            data = new char[size]();
+        #else
+            void *mapped = mmap(NULL, std::max(size, (size_t)1), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (mapped == MAP_FAILED) {
+                std::cerr << "error: could not map " << size << " bytes of shared memory" << std::endl;
+                assert(false);
+            }
+            data = static_cast<char *>(mapped);
+        #endif
+    }
+
+    ~SharedMemory() {
+        #ifdef _WIN32
+            delete[] data;
+        #else
+            munmap(data, std::max(size, (size_t)1));
+        #endif
+    }
+
+    char *get() const {
+        return data;
+    }
+
+private:
+    SharedMemory(const SharedMemory &);
+    SharedMemory &operator=(const SharedMemory &);
+
+    size_t size;
+    char *data;
+};
+
+/**
+ * The rows [first, last) of one output held in shared memory, so rows added
+ * by a worker process can be passed on by the process that forked it.
+ */
+class SharedResults : public ResultSink {
+public:
+
+    /**
+     * @param n     [The number of objects]
+     * @param first [The first row]
+     * @param last  [One past the last row]
+     */
+    SharedResults(
+        const unsigned int n,
+        const unsigned int first,
+        const unsigned int last) :
+        n(n),
+        first(first),
+        last(last),
+        memory(offset(last) * sizeof(float)) {}
+
+    void add_row(const unsigned int i, const Result &row) {
+        assert(first <= i && i < last);
+        assert(row.size() == n - i - 1);
+        if (!row.empty()) {
+            std::memcpy(values() + offset(i), &row.front(), row.size() * sizeof(float));
+        }
+    }
+
+    /**
+     * Pass row i on to a sink.
+     * @param i       [The row, must have been added]
+     * @param results [The sink to add it to]
+     */
+    void forward(const unsigned int i, ResultSink &results) const {
+        const float *row = values() + offset(i);
+        results.add_row(i, Result(row, row + (n - i - 1)));
+    }
+
+private:
+
+    /**
+     * The index of the first value of row i.
+     */
+    size_t offset(const unsigned int i) const {
+        return ((size_t)(i - first) * (2 * n - first - i - 1)) / 2;
+    }
+
+    float *values() const {
+        return reinterpret_cast<float *>(memory.get());
+    }
+
+    unsigned int n;
+    unsigned int first;
+    unsigned int last;
+    SharedMemory memory;
+};
+
+/**
+ * Compute the rows [first, last) in forked worker processes. The objects and
+ * anything else built before forking are shared with every worker copy on
+ * write, since workers only read them no process makes a private copy. Rows
+ * are taken from a shared counter so workers stay busy until every row is
+ * taken, and each worker sets a flag once its row is complete.
+ *
+ * This process passes completed rows on in order while the workers run. A
+ * worker that crashes loses only the rows it held, which this process
+ * computes itself once the other workers finish. Without fork every row is
+ * computed in this process.
+ * @param num_processes [The number of worker processes]
+ * @param first         [The first row]
+ * @param last          [One past the last row]
+ * @param skip          [Whether each row is already known and must not be
+ *                      computed, indexed from first]
+ * @param task          [Computes a row, sending it to shared results]
+ * @param collect       [Passes a completed or skipped row on, called in
+ *                      order in this process]
+ */
+inline void run_processes(
+    const unsigned int num_processes,
+    const unsigned int first,
+    const unsigned int last,
+    const std::vector<bool> &skip,
+    const boost::function<void (unsigned int)> &task,
+    const boost::function<void (unsigned int)> &collect) {
+
+    assert(skip.size() == last - first);
+
+    // the next row to take then a completion flag for each row
+    SharedMemory memory(sizeof(uint32_t) + (last - first));
+    volatile uint32_t *next = reinterpret_cast<uint32_t *>(memory.get());
+    volatile char *done = memory.get() + sizeof(uint32_t);
+    *next = first;
+
+    unsigned int collected = first;
+
+    #ifndef _WIN32
+        std::cout << std::flush;
+        std::cerr << std::flush;
+
+        std::vector<pid_t> workers;
+        for (unsigned int p = 0; p < num_processes; ++p) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                for (unsigned int i = __sync_fetch_and_add(next, 1); i < last;
+                     i = __sync_fetch_and_add(next, 1)) {
+                    if (skip[i - first]) continue;
+                    task(i);
+                    __sync_synchronize();
+                    done[i - first] = 1;
+                }
+                _exit(0);
+            }
+            if (pid < 0) {
+                std::cerr << "warning: could not start worker process " << p << std::endl;
+                break;
+            }
+            workers.push_back(pid);
+        }
+
+        // pass rows on as they complete until every worker has exited, waiting
+        // only on the workers started here so other children are left alone
+        while (!workers.empty()) {
+            while (collected < last && (skip[collected - first] || done[collected - first])) {
+                __sync_synchronize();
+                collect(collected++);
+            }
+
+            bool block = collected >= last;
+            for (unsigned int w = 0; w < workers.size();) {
+                int status;
+                pid_t pid = waitpid(workers[w], &status, block ? 0 : WNOHANG);
+                if (pid == 0) {
+                    ++w;
+                    continue;
+                }
+                if (pid < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (pid > 0 && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+                    std::cerr << "warning: worker process " << pid
+                        << " failed, its rows are computed again" << std::endl;
+                }
+                workers.erase(workers.begin() + w);
+            }
+
+            if (!workers.empty() && !block) {
+                usleep(1000);
+            }
+        }
+    #endif
+
+    // any row left by a failed worker, or every row without workers
+    for (; collected < last; ++collected) {
+        if (!skip[collected - first] && !done[collected - first]) {
+            task(collected);
+        }
+        collect(collected);
+    }
+}
+
+} // namespace nearness
+
+#endif
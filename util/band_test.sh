@@ -0,0 +1,22 @@
+#!/bin/bash
+#
+# Checks that computing a band gives the pairs of a plain run at most the
+# width apart
+#
+# usage: BIN=bin/nearness util/band_test.sh data features epsilon [measure] [width]
+
+ARGS="[measure] [width]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+WIDTH="${5:-3}"
+
+run "$TMP/full" "$DATA"
+awk -v w="$WIDTH" '$1 - $2 <= w && $2 - $1 <= w' "$TMP/full" > "$TMP/expected"
+
+for threads in 1 4
+do
+    run "$TMP/band" --band "$WIDTH" --threads "$threads" "$DATA"
+    check "threads = $threads" "$(differ "$TMP/expected" "$TMP/band")"
+done
+
+finish
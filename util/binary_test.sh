@@ -0,0 +1,47 @@
+#!/bin/bash
+#
+# Checks that binary output holds the upper triangle of a plain run, whole
+# and streamed
+#
+# usage: BIN=bin/nearness util/binary_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+# the size of a BinaryHeader
+HEADER=16
+
+run "$TMP/full" "$DATA"
+OBJECTS=$(awk '$1 == 0' "$TMP/full" | wc -l)
+awk '$1 < $2' "$TMP/full" > "$TMP/expected"
+
+for mode in whole streamed
+do
+    if [ "$mode" == "streamed" ]
+    then
+        option="--stream=8"
+    else
+        option=""
+    fi
+    run "$TMP/binary" --output-format binary $option --threads 4 "$DATA"
+
+    header=`od -A n -t u4 -N "$HEADER" "$TMP/binary" | awk '{ print $2, $3, $4 }'`
+    od -A n -v -t f4 -w4 -j "$HEADER" "$TMP/binary" | awk '{ print $1 }' > "$TMP/values"
+
+    paste <(cut -f 1,2 "$TMP/expected") "$TMP/values" > "$TMP/pairs"
+
+    # text values have 6 significant digits
+    errors=`differ_within "$TMP/expected" "$TMP/pairs" 5e-6`
+    if [ $(wc -l < "$TMP/values") -ne $(wc -l < "$TMP/expected") ]
+    then
+        errors="$(wc -l < "$TMP/values") values, expected $(wc -l < "$TMP/expected")"$'\n'"$errors"
+    fi
+    if [ "$header" != "1 $OBJECTS 0" ]
+    then
+        errors="header: $header"$'\n'"$errors"
+    fi
+    check "$mode" "$errors"
+done
+
+finish
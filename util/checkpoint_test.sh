@@ -0,0 +1,44 @@
+#!/bin/bash
+#
+# Checks that a run killed part way and resumed from its checkpoint gives the
+# output of a plain run. The run is killed once its checkpoint holds a row,
+# so the data should take long enough to compute that it has rows left then.
+#
+# usage: BIN=bin/nearness util/checkpoint_test.sh data features epsilon
+
+ARGS=""
+. "$(dirname "$0")/test_common.sh"
+
+run "$TMP/full" "$DATA"
+
+for threads in 1 4
+do
+    rm -f "$TMP"/resumed*
+    # not through run, so the pid is that of the run itself
+    "$BIN" -f "$FEATURES" -e "$EPSILON" -o "$TMP/resumed" --checkpoint --threads "$threads" "$DATA" > /dev/null 2>&1 &
+    pid=$!
+    while kill -0 "$pid" 2> /dev/null && [ ! -s "$TMP/resumed.checkpoint" ]
+    do
+        sleep 0.01
+    done
+    kill -9 "$pid" 2> /dev/null
+    wait "$pid" 2> /dev/null
+
+    if [ -f "$TMP/resumed" ] || [ ! -s "$TMP/resumed.checkpoint" ]
+    then
+        check "threads = $threads" "the run completed before it was killed, use more data"
+        continue
+    fi
+
+    run "$TMP/resumed" --resume --threads "$threads" "$DATA"
+
+    errors=`differ "$TMP/full" "$TMP/resumed"`
+    leftover=`ls "$TMP" | grep '^resumed.'`
+    if [ -n "$leftover" ]
+    then
+        errors="$errors"$'\n'"checkpoint not removed: $leftover"
+    fi
+    check "threads = $threads" "$errors"
+done
+
+finish
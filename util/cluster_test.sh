@@ -0,0 +1,92 @@
+#!/bin/bash
+#
+# Checks that clustering as rows complete gives the clusters of the pairs of
+# a plain run: the connected components, and the single linkage dendrogram
+# found by Kruskal from the nearest pair to the furthest, ties going to the
+# lower pair. Clusters are checked without a threshold and with the given
+# threshold, by default the median of the non-zero values of the plain run.
+#
+# usage: BIN=bin/nearness util/cluster_test.sh data features epsilon [measure] [threshold]
+
+ARGS="[measure] [threshold]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+run "$TMP/full" "$DATA"
+OBJECTS=$(awk '$1 == 0' "$TMP/full" | wc -l)
+THRESHOLD="$5"
+if [ -z "$THRESHOLD" ]
+then
+    THRESHOLD=$(awk '$1 < $2 && $3 != 0 { print $3 }' "$TMP/full" | sort -g | awk '{ v[NR] = $0 } END { print v[int((NR + 1) / 2)] }')
+fi
+
+# the pairs that join their objects, from nearest to furthest
+if [ "$MEASURE" == "sgmd" ]
+then
+    JOINS='$3 != "inf" && (t == "" || $3 <= t + 0)'
+    ORDER="-k3,3g"
+else
+    JOINS='$3 > 0 && (t == "" || $3 >= t + 0)'
+    ORDER="-k3,3gr"
+fi
+
+KRUSKAL='
+    function find(x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]]
+            x = parent[x]
+        }
+        return x
+    }
+    BEGIN {
+        for (i = 0; i < n; ++i) {
+            parent[i] = i
+            size[i] = 1
+            cluster[i] = i
+        }
+    }
+    {
+        a = find($1)
+        b = find($2)
+        if (a == b) next
+        if (method == "single-linkage") {
+            low = cluster[a] < cluster[b] ? cluster[a] : cluster[b]
+            high = cluster[a] < cluster[b] ? cluster[b] : cluster[a]
+            print low "\t" high "\t" $3 "\t" (size[a] + size[b])
+        }
+        if (size[a] < size[b]) {
+            swap = a; a = b; b = swap
+        }
+        parent[b] = a
+        size[a] += size[b]
+        cluster[a] = n + merges++
+    }
+    END {
+        if (method == "components") {
+            for (i = 0; i < n; ++i) {
+                r = find(i)
+                if (!(r in first)) first[r] = i
+                print i "\t" first[r]
+            }
+        }
+    }'
+
+for threshold in "" "$THRESHOLD"
+do
+    if [ -n "$threshold" ]
+    then
+        option="--cluster-threshold $threshold"
+    else
+        option=""
+    fi
+
+    for method in components single-linkage
+    do
+        awk -v t="$threshold" "\$1 < \$2 && $JOINS" "$TMP/full" | sort -s $ORDER -k1,1n -k2,2n \
+            | awk -v n="$OBJECTS" -v method="$method" "$KRUSKAL" > "$TMP/expected"
+        run "$TMP/clusters" --cluster "$method" $option --threads 4 "$DATA"
+        check "$method, threshold = ${threshold:-none}" "$(differ "$TMP/expected" "$TMP/clusters")"
+    done
+done
+
+finish
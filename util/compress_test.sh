@@ -0,0 +1,23 @@
+#!/bin/bash
+#
+# Checks that compressed output decompresses to the output of a plain run
+#
+# usage: BIN=bin/nearness util/compress_test.sh data features epsilon
+
+ARGS=""
+. "$(dirname "$0")/test_common.sh"
+
+run "$TMP/full" "$DATA"
+awk '$1 < $2' "$TMP/full" > "$TMP/upper"
+
+for level in 1 9
+do
+    run "$TMP/compressed" --compress="$level" --threads 4 "$DATA"
+    run "$TMP/streamed" --compress="$level" --stream=8 --threads 4 "$DATA"
+    zcat "$TMP/compressed" > "$TMP/whole"
+    zcat "$TMP/streamed" > "$TMP/stream"
+
+    check "level = $level" "$(differ "$TMP/full" "$TMP/whole"; differ "$TMP/upper" "$TMP/stream")"
+done
+
+finish
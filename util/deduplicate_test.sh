@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# Checks that deduplicating copies of objects gives the output of a plain run.
+# Copies are read before, after and away from their originals, as with mce
+# the value of a pair of objects of different sizes depends on their order.
+#
+# usage: BIN=bin/nearness util/deduplicate_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+DATA_DIRECTORY=1
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+# the objects with copies of the first read last and next to it, and a copy
+# of the last read first
+FILES=($(ls "$DATA" | sort))
+LAST=${FILES[${#FILES[@]} - 1]}
+mkdir "$TMP/objects"
+cp "$DATA"/* "$TMP/objects"
+cp "$DATA/${FILES[0]}" "$TMP/objects/~copy_${FILES[0]}"
+cp "$DATA/${FILES[0]}" "$TMP/objects/${FILES[0]%.*}_copy.${FILES[0]##*.}"
+cp "$DATA/$LAST" "$TMP/objects/!copy_$LAST"
+
+run "$TMP/full" "$TMP/objects"
+
+for threads in 1 4
+do
+    run "$TMP/deduplicated" --deduplicate --threads "$threads" "$TMP/objects"
+    check "threads = $threads" "$(differ "$TMP/full" "$TMP/deduplicated")"
+done
+
+finish
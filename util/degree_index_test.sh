@@ -0,0 +1,27 @@
+#!/bin/bash
+#
+# Checks that sgmd top-k output, found from the index of sorted degrees,
+# gives the nearest objects to each object in a plain sgmd run, ties going to
+# the lower object. Queries use the same index, see query_server_test.sh.
+#
+# usage: BIN=bin/nearness util/degree_index_test.sh data features epsilon [k]
+
+ARGS="[k]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="sgmd"
+K="${4:-5}"
+
+run "$TMP/full" "$DATA"
+
+for k in 1 "$K"
+do
+    awk '$1 != $2' "$TMP/full" | sort -k1,1n -k3,3g -k2,2n | awk -v k="$k" 'c[$1]++ < k' > "$TMP/expected"
+
+    for threads in 1 4
+    do
+        run "$TMP/top_k" --top-k "$k" --threads "$threads" "$DATA"
+        check "k = $k, threads = $threads" "$(differ "$TMP/expected" "$TMP/top_k")"
+    done
+done
+
+finish
@@ -0,0 +1,35 @@
+#!/bin/bash
+#
+# Checks that text formatted in parallel gives the output of a plain run, that
+# exact text gives the values of binary output exactly, and that it agrees
+# with text to the 6 significant digits of text
+#
+# usage: BIN=bin/nearness util/format_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+# the size of a BinaryHeader
+HEADER=16
+
+run "$TMP/full" --threads 1 "$DATA"
+awk '$1 < $2' "$TMP/full" > "$TMP/upper"
+
+for threads in 1 4
+do
+    run "$TMP/text" --threads "$threads" "$DATA"
+    run "$TMP/exact" --output-format exact --threads "$threads" "$DATA"
+    run "$TMP/binary" --output-format binary --threads "$threads" "$DATA"
+
+    # the values of the binary output beside the pairs they belong to
+    od -A n -v -t f4 -w4 -j "$HEADER" "$TMP/binary" | awk '{ print $1 }' \
+        | paste <(cut -f 1,2 "$TMP/upper") - > "$TMP/values"
+    awk '$1 < $2' "$TMP/exact" > "$TMP/exact_upper"
+
+    check "threads = $threads" "$(differ "$TMP/full" "$TMP/text";
+        differ_within "$TMP/values" "$TMP/exact_upper" 0;
+        differ_within "$TMP/full" "$TMP/exact" 5e-6)"
+done
+
+finish
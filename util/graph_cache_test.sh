@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+# Checks that runs caching the graphs of objects give the output of a plain
+# run: the first filling the cache, the next loading every graph from it, and
+# one at half the epsilon, whose graphs are not in the cache
+#
+# usage: BIN=bin/nearness util/graph_cache_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+run "$TMP/full" "$DATA"
+OBJECTS=$(awk '$1 == 0' "$TMP/full" | wc -l)
+HALF=$(awk -v e="$EPSILON" 'BEGIN { print e / 2 }')
+"$BIN" -f "$FEATURES" -e "$HALF" -d "$MEASURE" -o "$TMP/half" "$DATA" > /dev/null 2>&1
+
+STEPS=(
+    "first run"
+    "cached"
+    "half epsilon"
+)
+
+for step in "${STEPS[@]}"
+do
+    if [ "$step" == "half epsilon" ]
+    then
+        epsilon="$HALF"
+        expected_hits=0
+        expected="$TMP/half"
+    else
+        epsilon="$EPSILON"
+        expected_hits=$([ "$step" == "cached" ] && echo "$OBJECTS" || echo 0)
+        expected="$TMP/full"
+    fi
+
+    # the number of graphs loaded is printed with the debug output
+    hits=`"$BIN" -f "$FEATURES" -e "$epsilon" -d "$MEASURE" -o "$TMP/cached" --cache "$TMP/cache" --threads 4 "$DATA" 2> /dev/null \
+        | awk '/ hits = / { print $NF }'`
+
+    errors=`differ "$expected" "$TMP/cached"`
+    if [ "$hits" != "$expected_hits" ]
+    then
+        errors="$errors"$'\n'"loaded ${hits:-no} graphs, expected $expected_hits"
+    fi
+    check "$step" "$errors"
+done
+
+finish
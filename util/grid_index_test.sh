@@ -0,0 +1,24 @@
+#!/bin/bash
+#
+# Checks that skipping the mce pairs of objects the grid index finds disjoint
+# gives the output of a plain run, for a grid over one feature and over every
+# feature. A small epsilon leaves more pairs disjoint.
+#
+# usage: BIN=bin/nearness util/grid_index_test.sh data features epsilon
+
+ARGS=""
+. "$(dirname "$0")/test_common.sh"
+
+run "$TMP/full" "$DATA"
+echo "$(awk '$1 < $2 && $3 == 0' "$TMP/full" | wc -l) disjoint pairs"
+
+for dims in 1 "$FEATURES"
+do
+    for threads in 1 4
+    do
+        run "$TMP/grid" --grid-index="$dims" --threads "$threads" "$DATA"
+        check "dimensions = $dims, threads = $threads" "$(differ "$TMP/full" "$TMP/grid")"
+    done
+done
+
+finish
@@ -0,0 +1,20 @@
+#!/bin/bash
+#
+# Checks that storing results as half precision floats gives the output of a
+# plain run to within the precision of a half, about three significant digits
+#
+# usage: BIN=bin/nearness util/half_precision_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+run "$TMP/full" "$DATA"
+
+for threads in 1 4
+do
+    run "$TMP/half" --half-precision --threads "$threads" "$DATA"
+    check "threads = $threads" "$(differ_within "$TMP/full" "$TMP/half" 0.001 1e-6)"
+done
+
+finish
@@ -0,0 +1,30 @@
+#!/bin/bash
+#
+# Checks that computing several measures in one pass gives the output of a
+# plain run of each measure
+#
+# usage: BIN=bin/nearness util/measures_test.sh data features epsilon
+
+ARGS=""
+. "$(dirname "$0")/test_common.sh"
+
+MEASURES=(
+    mce
+    sgmd
+)
+
+for threads in 1 4
+do
+    MEASURE="mce,sgmd"
+    run "$TMP/measures" --threads "$threads" "$DATA"
+
+    echo "threads = $threads"
+    for measure in "${MEASURES[@]}"
+    do
+        MEASURE="$measure"
+        run "$TMP/full" "$DATA"
+        check "$measure" "$(differ "$TMP/full" "$TMP/measures_$measure")"
+    done
+done
+
+finish
@@ -0,0 +1,45 @@
+#!/bin/bash
+#
+# Checks that runs using a pair cache give the output of a plain run, as
+# objects are added, copied and unchanged between runs
+#
+# usage: BIN=bin/nearness util/pair_cache_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+DATA_DIRECTORY=1
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+FILES=($(ls "$DATA" | sort))
+LAST=$(( ${#FILES[@]} - 2 ))
+
+# the first run sees all but the last two objects
+mkdir "$TMP/objects"
+for (( i = 0; i < LAST; i++ ))
+do
+    cp "$DATA/${FILES[$i]}" "$TMP/objects"
+done
+
+STEPS=(
+    "first run"
+    "objects added"
+    "object copied"
+    "unchanged"
+)
+
+for step in "${STEPS[@]}"
+do
+    if [ "$step" == "objects added" ]
+    then
+        cp "$DATA/${FILES[$LAST]}" "$DATA/${FILES[$LAST + 1]}" "$TMP/objects"
+    elif [ "$step" == "object copied" ]
+    then
+        cp "$DATA/${FILES[0]}" "$TMP/objects/copy_${FILES[0]}"
+    fi
+
+    run "$TMP/full" "$TMP/objects"
+    run "$TMP/cached" --pair-cache "$TMP/cache" --threads 4 "$TMP/objects"
+    check "$step" "$(differ "$TMP/full" "$TMP/cached")"
+done
+
+finish
@@ -0,0 +1,21 @@
+#!/bin/bash
+#
+# Checks that computing with forked worker processes gives the output of a
+# plain run
+#
+# usage: BIN=bin/nearness util/processes_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+run "$TMP/full" "$DATA"
+
+for processes in 2 4
+do
+    rm -f "$TMP/forked"
+    run "$TMP/forked" --processes "$processes" "$DATA"
+    check "processes = $processes" "$(differ "$TMP/full" "$TMP/forked")"
+done
+
+finish
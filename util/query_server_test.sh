@@ -0,0 +1,64 @@
+#!/bin/bash
+#
+# Checks that the answers of a query server give the row of the query in a
+# plain run of the query followed by the data, for the first, middle and last
+# object of the data as queries
+#
+# usage: BIN=bin/nearness util/query_server_test.sh data features epsilon [measure] [k]
+
+ARGS="[measure] [k]"
+DATA_DIRECTORY=1
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+K="${5:-5}"
+SOCKET="$TMP/socket"
+
+# nearest first, ties going to the lower object
+if [ "$MEASURE" == "sgmd" ]
+then
+    ORDER="-k3,3g"
+else
+    ORDER="-k3,3gr"
+fi
+
+"$BIN" serve-queries --socket "$SOCKET" -f "$FEATURES" -e "$EPSILON" -d "$MEASURE" "$DATA" > /dev/null 2>&1 &
+server=$!
+wait_for_socket "$SOCKET"
+
+FILES=($(ls "$DATA" | sort))
+QUERIES=(
+    "${FILES[0]}"
+    "${FILES[${#FILES[@]} / 2]}"
+    "${FILES[${#FILES[@]} - 1]}"
+)
+
+for query in "${QUERIES[@]}"
+do
+    run "$TMP/full" "$DATA/$query" "$DATA"
+    awk '$1 == 0 && $2 > 0 { print $1 "\t" ($2 - 1) "\t" $3 }' "$TMP/full" > "$TMP/row"
+
+    echo "$query"
+    for k in 0 "$K"
+    do
+        if [ "$k" == 0 ]
+        then
+            expected=`cat "$TMP/row"`
+        else
+            expected=`sort -k2,2n "$TMP/row" | sort -s $ORDER | head -n "$k"`
+        fi
+        expected="$DATA/$query"`echo "$expected" | awk '{ printf " %s:%s", $2, $3 }'`
+        answer=`"$BIN" query --socket "$SOCKET" --top-k "$k" "$DATA/$query" 2> /dev/null`
+
+        errors=""
+        if [ "$expected" != "$answer" ]
+        then
+            errors="expected: $expected"$'\n'"answered: $answer"
+        fi
+        check "k = $k" "$errors"
+    done
+done
+
+kill "$server"
+wait "$server" 2> /dev/null
+
+finish
@@ -0,0 +1,36 @@
+#!/bin/bash
+#
+# Checks that computing only the pairs of queries and references gives the
+# pairs of a plain run of the queries followed by the references. The first
+# third of the data are the queries and the rest the references.
+#
+# usage: BIN=bin/nearness util/rectangle_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+DATA_DIRECTORY=1
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+FILES=($(ls "$DATA" | sort))
+NUM_QUERIES=$(( ${#FILES[@]} / 3 ))
+mkdir "$TMP/queries" "$TMP/references"
+for (( i = 0; i < ${#FILES[@]}; i++ ))
+do
+    if [ "$i" -lt "$NUM_QUERIES" ]
+    then
+        cp "$DATA/${FILES[$i]}" "$TMP/queries"
+    else
+        cp "$DATA/${FILES[$i]}" "$TMP/references"
+    fi
+done
+
+run "$TMP/full" "$TMP/queries" "$TMP/references"
+awk -v n="$NUM_QUERIES" '$1 < n && $2 >= n { print $1 "\t" ($2 - n) "\t" $3 }' "$TMP/full" > "$TMP/expected"
+
+for threads in 1 4
+do
+    run "$TMP/rectangle" --threads "$threads" --queries "$TMP/queries" --references "$TMP/references"
+    check "threads = $threads" "$(differ "$TMP/expected" "$TMP/rectangle")"
+done
+
+finish
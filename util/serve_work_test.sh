@@ -0,0 +1,30 @@
+#!/bin/bash
+#
+# Checks that handing rows to workers over a socket gives the output of a
+# plain run
+#
+# usage: BIN=bin/nearness util/serve_work_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+SOCKET="$TMP/socket"
+
+run "$TMP/full" "$DATA"
+
+for workers in 1 3
+do
+    rm -f "$TMP/served"
+    "$BIN" serve-work --socket "$SOCKET" -f "$FEATURES" -e "$EPSILON" -d "$MEASURE" -o "$TMP/served" "$DATA" > /dev/null 2>&1 &
+    wait_for_socket "$SOCKET"
+
+    for (( w = 0; w < workers; w++ ))
+    do
+        "$BIN" worker --socket "$SOCKET" > /dev/null 2>&1 &
+    done
+    wait
+
+    check "workers = $workers" "$(differ "$TMP/full" "$TMP/served")"
+done
+
+finish
@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+# Checks that merging the partial results of shards, or of ranges of rows,
+# gives the output of a plain run, also with more shards than rows so some
+# are empty, and that shards of runs with different settings are not merged
+#
+# usage: BIN=bin/nearness util/shard_test.sh data features epsilon [shards]
+
+ARGS="[shards]"
+. "$(dirname "$0")/test_common.sh"
+SHARDS="${4:-3}"
+
+run "$TMP/full" "$DATA"
+OBJECTS=$(awk '$1 == 0' "$TMP/full" | wc -l)
+
+for split in shard rows empty
+do
+    rm -f "$TMP"/partial* "$TMP/merged"
+    shards=$SHARDS
+    if [ "$split" == "empty" ]
+    then
+        shards=$(( 2 * OBJECTS ))
+    fi
+    for (( k = 0; k < shards; k++ ))
+    do
+        if [ "$split" != "rows" ]
+        then
+            range="--shard $k/$shards"
+        else
+            range="--rows $(( k * OBJECTS / SHARDS )):$(( (k + 1) * OBJECTS / SHARDS ))"
+        fi
+        run "$TMP/partial$k" $range --threads 4 "$DATA"
+    done
+    "$BIN" merge -o "$TMP/merged" "$TMP"/partial* > /dev/null 2>&1
+
+    check "$split" "$(differ "$TMP/full" "$TMP/merged")"
+done
+
+# the first shard at another epsilon
+run "$TMP/partial0" --shard 0/2 "$DATA"
+"$BIN" -f "$FEATURES" -e "2$EPSILON" -o "$TMP/partial1" --shard 1/2 "$DATA" > /dev/null 2>&1
+if "$BIN" merge -o "$TMP/merged" "$TMP/partial0" "$TMP/partial1" > /dev/null 2>&1
+then
+    check "different runs" "merged"
+else
+    check "different runs" ""
+fi
+
+finish
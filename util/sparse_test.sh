@@ -0,0 +1,19 @@
+#!/bin/bash
+#
+# Checks that sparse output gives each non-zero pair of a plain run once
+#
+# usage: BIN=bin/nearness util/sparse_test.sh data features epsilon
+
+ARGS=""
+. "$(dirname "$0")/test_common.sh"
+
+run "$TMP/full" "$DATA"
+awk '$1 < $2 && $3 != 0' "$TMP/full" > "$TMP/expected"
+
+for threads in 1 4
+do
+    run "$TMP/sparse" --sparse --threads "$threads" "$DATA"
+    check "threads = $threads" "$(differ "$TMP/expected" "$TMP/sparse")"
+done
+
+finish
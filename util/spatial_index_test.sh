@@ -0,0 +1,20 @@
+#!/bin/bash
+#
+# Checks that finding the neighbours within each object from its spatial
+# index gives the output of a plain run
+#
+# usage: BIN=bin/nearness util/spatial_index_test.sh data features epsilon [measure]
+
+ARGS="[measure]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+run "$TMP/full" "$DATA"
+
+for threads in 1 4
+do
+    run "$TMP/indexed" --spatial-index --threads "$threads" "$DATA"
+    check "threads = $threads" "$(differ "$TMP/full" "$TMP/indexed")"
+done
+
+finish
@@ -0,0 +1,19 @@
+#!/bin/bash
+#
+# Checks that streamed output gives each pair of a plain run once
+#
+# usage: BIN=bin/nearness util/stream_test.sh data features epsilon
+
+ARGS=""
+. "$(dirname "$0")/test_common.sh"
+
+run "$TMP/full" "$DATA"
+awk '$1 < $2' "$TMP/full" > "$TMP/expected"
+
+for threads in 1 4
+do
+    run "$TMP/stream" --stream=8 --threads "$threads" "$DATA"
+    check "threads = $threads" "$(differ "$TMP/expected" "$TMP/stream")"
+done
+
+finish
@@ -0,0 +1,25 @@
+#!/bin/bash
+#
+# Checks that sweeping several epsilons in one run gives the output of a
+# plain run at each epsilon. Cliques are found in a different order when
+# swept, so values only need to agree to within rounding.
+#
+# usage: BIN=bin/nearness util/sweep_test.sh data features epsilon,epsilon...
+
+ARGS=""
+. "$(dirname "$0")/test_common.sh"
+EPSILONS=(${EPSILON//,/ })
+
+for threads in 1 4
+do
+    run "$TMP/sweep" --threads "$threads" "$DATA"
+
+    echo "threads = $threads"
+    for e in "${EPSILONS[@]}"
+    do
+        "$BIN" -f "$FEATURES" -e "$e" -o "$TMP/full" "$DATA" > /dev/null 2>&1
+        check "e = $e" "$(differ_within "$TMP/full" "$TMP/sweep_e$e" 0 1e-6)"
+    done
+done
+
+finish
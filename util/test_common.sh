@@ -0,0 +1,97 @@
+#!/bin/bash
+#
+# Shared driver of the tests comparing an option with a plain run. A test sets
+# ARGS to the arguments it takes after the data, features and epsilon, then
+# sources this with its own arguments:
+#
+#     ARGS="[measure]"
+#     . "$(dirname "$0")/test_common.sh"
+#
+# which checks the arguments, sets BIN, DATA, FEATURES, EPSILON, MEASURE and
+# a temporary directory TMP, and defines the functions below. A test that
+# needs the data to be a directory of objects also sets DATA_DIRECTORY=1. The
+# test ends with finish, which exits with 1 if any check failed.
+
+if [ $# -lt 3 ] || ( [ -n "$DATA_DIRECTORY" ] && [ ! -d "$1" ] )
+then
+    echo "usage: $0 data features epsilon $ARGS"
+    exit 1
+fi
+
+BIN="${BIN:-$PWD/bin/nearness}"
+DATA="$1"
+FEATURES="$2"
+EPSILON="$3"
+MEASURE="mce"
+
+TMP=$(mktemp -d)
+failed=0
+
+# Run with the features, epsilon and measure of the test, quietly
+# usage: run output [option...] input...
+run() {
+    local output="$1"
+    shift
+    "$BIN" -f "$FEATURES" -e "$EPSILON" -d "$MEASURE" -o "$output" "$@" > /dev/null 2>&1
+}
+
+# Print the pairs that differ between two outputs, or that the outputs differ
+# in length
+# usage: differ expected actual
+differ() {
+    diff "$1" "$2" 2>&1
+}
+
+# Print the pairs of two outputs whose objects differ or whose values differ
+# by more than the given relative and absolute tolerances
+# usage: differ_within expected actual relative [absolute]
+differ_within() {
+    if [ $(wc -l < "$1") -ne $(wc -l < "$2") ]
+    then
+        echo "$(wc -l < "$2") pairs, expected $(wc -l < "$1")"
+    fi
+    paste "$1" "$2" | awk -F '\t' -v r="$3" -v a="${4:-0}" '
+        function abs(x) { return x < 0 ? -x : x }
+        $1 != $4 || $2 != $5 || ($3 != $6 && abs($3 - $6) > r * abs($3) + a)'
+}
+
+# Wait up to ten seconds for a server to listen on a socket
+# usage: wait_for_socket socket
+wait_for_socket() {
+    for (( i = 0; i < 100; i++ ))
+    do
+        if [ -S "$1" ]
+        then
+            return
+        fi
+        sleep 0.1
+    done
+}
+
+# Print the result of a check, the differences found if any. Differences from
+# diff are counted by their changed lines, others by line.
+# usage: check label differences
+check() {
+    echo "$1"
+    if [ -z "$2" ]
+    then
+        echo "Correct!"
+        return
+    fi
+
+    local count=`echo "$2" | grep -c '^[<>]'`
+    if [ "$count" -eq 0 ]
+    then
+        count=`echo "$2" | grep -c .`
+    fi
+    echo "$count error(s)"
+    echo "$2"
+    failed=1
+}
+
+# Remove the temporary directory and exit with whether every check passed
+# usage: finish
+finish() {
+    rm -rf "$TMP"
+    exit $failed
+}
@@ -0,0 +1,38 @@
+#!/bin/bash
+#
+# Checks that a run with a threshold gives the pairs of a plain run that meet
+# it and leaves out the rest: 0 below a minimum mce nearness and infinity
+# above a maximum sgmd distance. The threshold defaults to the median of the
+# non-zero values of the plain run.
+#
+# usage: BIN=bin/nearness util/threshold_test.sh data features epsilon [measure] [threshold]
+
+ARGS="[measure] [threshold]"
+. "$(dirname "$0")/test_common.sh"
+MEASURE="${4:-mce}"
+
+run "$TMP/full" "$DATA"
+
+THRESHOLD="$5"
+if [ -z "$THRESHOLD" ]
+then
+    THRESHOLD=$(awk '$1 < $2 && $3 != 0 { print $3 }' "$TMP/full" | sort -g | awk '{ v[NR] = $0 } END { print v[int((NR + 1) / 2)] }')
+fi
+echo "threshold = $THRESHOLD"
+
+if [ "$MEASURE" == "sgmd" ]
+then
+    OPTION="--max-distance"
+    awk -v t="$THRESHOLD" 'BEGIN { OFS = "\t" } $1 != $2 && $3 > t + 0 { $3 = "inf" } { print }' "$TMP/full" > "$TMP/expected"
+else
+    OPTION="--min-nearness"
+    awk -v t="$THRESHOLD" 'BEGIN { OFS = "\t" } $3 < t + 0 { $3 = 0 } { print }' "$TMP/full" > "$TMP/expected"
+fi
+
+for threads in 1 4
+do
+    run "$TMP/threshold" "$OPTION" "$THRESHOLD" --threads "$threads" "$DATA"
+    check "threads = $threads" "$(differ "$TMP/expected" "$TMP/threshold")"
+done
+
+finish
@@ -0,0 +1,21 @@
+#!/bin/bash
+#
+# Checks that top-k output gives the nearest objects to each object in a
+# plain run, ties going to the lower object
+#
+# usage: BIN=bin/nearness util/top_k_test.sh data features epsilon [k]
+
+ARGS="[k]"
+. "$(dirname "$0")/test_common.sh"
+K="${4:-5}"
+
+run "$TMP/full" "$DATA"
+awk '$1 != $2' "$TMP/full" | sort -k1,1n -k3,3gr -k2,2n | awk -v k="$K" 'c[$1]++ < k' > "$TMP/expected"
+
+for threads in 1 4
+do
+    run "$TMP/top_k" --top-k "$K" --threads "$threads" "$DATA"
+    check "threads = $threads" "$(differ "$TMP/expected" "$TMP/top_k")"
+done
+
+finish